@@ -31,6 +31,9 @@ bool init_rfile(void);
 /* Check whether a file exists. */
 bool check_file_exist(const char *file);
 
+/* Get a canonical file name. (Files with the same content in a package share it.) */
+const char *get_canonical_file_name(const char *file);
+
 /* Open a file stream. */
 bool open_rfile(const char *file, struct rfile **f);
 
@@ -96,6 +99,27 @@ struct image {
 	pixel_t *pixels;
 	bool no_free;
 
+	/* File mapping that holds the pixels. (NULL if not mapped) */
+	void *mapping;
+	size_t mapping_size;
+
+	/* Next smaller mipmap level. (NULL if none) */
+	struct image *mipmap;
+
+	/*
+	 * Coarse alpha classification. (NULL if not built)
+	 *  - One IMAGE_ALPHA_* byte per IMAGE_ALPHA_SEG pixels of each row.
+	 *  - Built at load time, and dropped when the pixels are drawn.
+	 */
+	uint8_t *alpha_map;
+
+	/*
+	 * Callback to reload the pixels of an immutable image. (NULL if mutable)
+	 *  - A GPU renderer releases the pixels of an immutable image after
+	 *    uploading, and reloads them when the texture is lost.
+	 */
+	bool (*reload)(struct image *img, struct image **src);
+
 	/* Texture pointer. */
 	void *texture;
 
@@ -107,6 +131,40 @@ struct image {
 
 	/* Upload flag. */
 	bool need_upload;
+
+	/* Is a render target? (Drawn on GPU, thus never uploaded again or evicted) */
+	bool is_render_target;
+
+	/* GPU residency. (Linked from the most recently drawn if resident) */
+	struct image *resident_prev;
+	struct image *resident_next;
+	size_t resident_size;
+	uint64_t draw_frame;
+	bool is_resident;
+};
+
+/* Width of an alpha map segment in pixels. */
+#define IMAGE_ALPHA_SEG_SHIFT	(4)
+#define IMAGE_ALPHA_SEG		(1 << IMAGE_ALPHA_SEG_SHIFT)
+
+/* Alpha map classes. */
+#define IMAGE_ALPHA_MIXED	(0)	/* Needs blending */
+#define IMAGE_ALPHA_OPAQUE	(1)	/* All alpha values are 255 */
+#define IMAGE_ALPHA_CLEAR	(2)	/* All alpha values are 0 */
+
+/* GPU texture statistics. */
+struct texture_stats {
+	/* Textures on GPU. */
+	int resident_count;
+	size_t resident_bytes;
+
+	/* Budget in bytes. (0 for unlimited) */
+	size_t budget;
+
+	/* Accumulated counts. */
+	uint64_t uploads;
+	uint64_t upload_bytes;
+	uint64_t evictions;
 };
 
 #if !defined(USE_QT) && \
@@ -143,9 +201,9 @@ static INLINE uint32_t get_pixel_a(pixel_t p)
 static INLINE uint32_t get_pixel_r(pixel_t p)
 {
 #ifdef ORDER_RGBA
-	return (p >> 16) & 0xff;
-#else
 	return p & 0xff;
+#else
+	return (p >> 16) & 0xff;
 #endif
 }
 
@@ -163,9 +221,9 @@ static INLINE uint32_t get_pixel_g(pixel_t p)
 static INLINE uint32_t get_pixel_b(pixel_t p)
 {
 #ifdef ORDER_RGBA
-	return p & 0xff;
-#else
 	return (p >> 16) & 0xff;
+#else
+	return p & 0xff;
 #endif
 }
 
@@ -181,6 +239,15 @@ struct image *create_image_from_color_string(int w, int h, const char *color);
 /* Create an image with a pixel buffer. */
 bool create_image_with_pixels(int w, int h, pixel_t *pixels, struct image **img);
 
+/* Create an image with pixels stored in a file. (Fails if not supported.) */
+bool create_image_with_mapped_file(const char *path, size_t offset, int w, int h, struct image **img);
+
+/* Create an image with a PNG, JPEG, or WebP file. (Detected by the content.) */
+bool create_image_with_data(const uint8_t *data, size_t size, struct image **img);
+
+/* Create an image with a PNG, JPEG, or WebP file stream, reduced to 1/scale. (1, 2, 4, or 8) */
+bool create_image_with_rfile(struct rfile *rf, int scale, struct image **img);
+
 /* Create an image with a PNG file. */
 bool create_image_with_png(const uint8_t *data, size_t size, struct image **img);
 
@@ -190,9 +257,58 @@ bool create_image_with_jpeg(const uint8_t *data, size_t size, struct image **img
 /* Create an image with a WebP file. */
 bool create_image_with_webp(const uint8_t *data, size_t size, struct image **img);
 
+/* Create a transparent image to be used as a render target. */
+bool create_render_target_image(int w, int h, struct image **img);
+
 /* Destroy an image. */
 void destroy_image(struct image *img);
 
+/* Destroy an image that has not been passed to the renderer. (Thread-safe) */
+void destroy_decoded_image(struct image *img);
+
+/* Create mipmap levels of an image down to 1x1. */
+bool create_image_mipmaps(struct image *img);
+
+/* Destroy mipmap levels of an image. */
+void destroy_image_mipmaps(struct image *img);
+
+/* Build the alpha map of an image for faster alpha-blending. */
+bool build_image_alpha_map(struct image *img);
+
+/* Drop the alpha map of an image. (Called when the pixels are written.) */
+void invalidate_image_alpha_map(struct image *img);
+
+/* Release the pixels of an immutable image. (The size and the texture are kept.) */
+void release_image_pixels(struct image *img);
+
+/* Restore the released pixels of an immutable image by its reload callback. */
+bool restore_image_pixels(struct image *img);
+
+/* Set the GPU texture memory budget in bytes. (0 for unlimited) */
+void set_texture_budget(size_t bytes);
+
+/* Get the GPU texture statistics. */
+void get_texture_stats(struct texture_stats *stats);
+
+/* Set the bytes of pre-warmed textures uploaded per frame. */
+void set_texture_upload_budget(size_t bytes);
+
+/* Get the bytes of pre-warmed textures uploaded per frame. */
+size_t get_texture_upload_budget(void);
+
+/*
+ * GPU texture residency for renderers:
+ *  - A renderer marks an image drawn, and adds it after uploading.
+ *  - Textures not drawn in the current frame are evicted in LRU order
+ *    while the resident bytes are over the budget.
+ */
+void begin_texture_frame(void);
+void mark_texture_drawn(struct image *img);
+void add_resident_texture(struct image *img, size_t size);
+void remove_resident_texture(struct image *img);
+struct image *evict_resident_texture(void);
+void reset_resident_textures(void);
+
 /* Get an image width. */
 int get_image_width(struct image *img);
 
@@ -253,7 +369,7 @@ void draw_image_melt(struct image *dst_image,
 		     struct image *rule_image,
 		     int threshold);
 
-/* Draw an image with scaling. */
+/* Draw an image with scaling. (Samples a mipmap level when minifying.) */
 void draw_image_scale(struct image *dst_image,
 		      int virtual_dst_width,
 		      int virtual_dst_height,
@@ -261,6 +377,10 @@ void draw_image_scale(struct image *dst_image,
 		      int virtual_dst_top,
 		      struct image *src_image);
 
+/* Draw an image at the half size. (2x2 box filter, dst is floor(src / 2)) */
+void draw_image_half(struct image *dst_image,
+		     struct image *src_image);
+
 /* Clip a rectangle by a source size. */
 bool clip_by_source(int src_cx, int src_cy, int *cx, int *cy,
 		    int *dst_x, int *dst_y, int *src_x, int *src_y);
@@ -339,24 +459,87 @@ bool draw_glyph(struct image *img,
 /* Sound Tracks */
 #define SOUND_TRACKS	(4)
 
+/* Mixer Voices (The tracks are the first voices.) */
+#define SOUND_MAX_VOICES	(64)
+#define SOUND_DEFAULT_VOICES	(16)
+
+/* Resampling Quality (for files not in 44.1kHz) */
+#define SOUND_RESAMPLE_LINEAR	(0)	/* Linear interpolation */
+#define SOUND_RESAMPLE_SINC	(1)	/* Windowed sinc (default) */
+
+/* Sound Outputs */
+#define SOUND_OUTPUT_DEVICE	(0)	/* Sound device (default) */
+#define SOUND_OUTPUT_WAV	(1)	/* WAV file on a virtual clock */
+#define SOUND_OUTPUT_NULL	(2)	/* Discarded on a virtual clock */
+
+/* Sound output statistics. */
+struct sound_stats {
+	/* Accumulated underruns of the read-ahead. (Decoder too late) */
+	uint64_t underruns;
+	uint64_t underrun_frames;
+
+	/* Accumulated device underruns, and recoveries from them. */
+	uint64_t xruns;
+	uint64_t recoveries;
+
+	/* Accumulated output periods, and the time of a period. (usec) */
+	uint64_t periods;
+	int period_usec;
+
+	/* Accumulated and peak time to mix a period. (usec) */
+	uint64_t mix_usec;
+	int mix_usec_max;
+
+	/* Accumulated and peak time to decode. (usec) */
+	uint64_t decode_usec;
+	int decode_usec_max;
+
+	/* Frames queued on the device. (The size is 0 if unknown.) */
+	int device_fill;
+	int device_size;
+
+	/* Fewest frames decoded ahead of the playing voices. (The size is 0 if unknown.) */
+	int ahead_fill;
+	int ahead_size;
+};
+
 /* PCM Stream */
 struct wave;
 
 /* Create a wave stream from a file. */
 struct wave *create_wave_from_file(const char *file, bool loop);
 
+/* Create a wave stream that plays frames in memory. (The frames are not copied.) */
+struct wave *create_wave_from_frames(const uint32_t *frames, int count);
+
+/* Decode a whole file into 44.1kHz 16-bit stereo frames. (Free the frames by free().) */
+bool decode_wave_file(const char *file, uint32_t **frames, int *count);
+
 /* Destroy a wave stream. */
 void destroy_wave(struct wave *w);
 
 /* Set a repeat count of a wave stream. */
 void set_wave_repeat_times(struct wave *w, int n);
 
+/* Crossfade the loop end of a wave stream into its loop start. (msec, call before playback) */
+bool set_wave_loop_crossfade(struct wave *w, int msec);
+
 /* Get whether a wave stream is reached end-of-stream or not. */
 bool is_wave_eos(struct wave *w);
 
 /* Get PCM samples from a wave stream. */
 int get_wave_samples(struct wave *w, uint32_t *buf, int samples);
 
+/* Set the resampling quality of the wave streams created after this. */
+void set_sound_resample_quality(int quality);
+
+/*
+ * Set the read-ahead time of the decoder thread in milliseconds.
+ *  - Must be called before init_sound().
+ *  - Backends without a decoder thread ignore this.
+ */
+void set_sound_read_ahead(int msec);
+
 /************************
  * Texture Manipulation *
  ************************/
@@ -374,6 +557,13 @@ void notify_image_update(struct image *img);
  */
 void notify_image_free(struct image *img);
 
+/*
+ * Notifies an image pre-warm.
+ *  - This function tells a HAL that an image will be drawn soon.
+ *  - A HAL may upload it to GPU over the next frames.
+ */
+void notify_image_prewarm(struct image *img);
+
 /*
  * Returns if RGBA values have to be reversed to BGRA.
  */
@@ -501,6 +691,22 @@ render_image_3d_add(
 	int src_height,			/* The height of the source rectangle */
 	int alpha);			/* The alpha value (0 to 255) */
 
+/*
+ * Starts rendering to an image instead of the screen.
+ *  - The image must be created by create_render_target_image().
+ *  - Render targets cannot be nested.
+ *  - Returns false if the renderer doesn't support render targets.
+ */
+bool
+begin_render_target(
+	struct image *img,		/* [IN] The render target */
+	bool clear);			/* Clear to transparent */
+
+/*
+ * Ends rendering to an image, and restores the screen.
+ */
+void end_render_target(void);
+
 /*************
  * Lap Timer *
  *************/
@@ -545,11 +751,83 @@ bool stop_sound(int stream);
  */
 bool set_sound_volume(int stream, float vol);
 
+/*
+ * Fades sound volume in milliseconds.
+ *  - Returns false if the backend cannot fade. (The caller sets the volume.)
+ */
+bool fade_sound(int stream, float vol, int msec);
+
+/*
+ * Sets sound pan. (-1.0 left to 1.0 right, 0 center)
+ *  - Returns false if the backend cannot pan.
+ */
+bool set_sound_pan(int stream, float pan);
+
 /*
  * Returns whether a sound playback for a stream is already finished.
  */
 bool is_sound_finished(int stream);
 
+/*
+ * Starts playing a one-shot sound on a free voice of the software mixer.
+ *  - The ownership of the wave is delegated to the callee if succeeded.
+ *  - The oldest one-shot sound is stopped if no voice is free.
+ *  - Returns false if the backend has no software mixer. (The caller keeps the wave.)
+ *  - Backends without an output drop the wave and return true.
+ */
+bool play_sound_effect(struct wave *w, float vol);
+
+/*
+ * Stops all one-shot sounds.
+ */
+void stop_sound_effects(void);
+
+/*
+ * Sets the number of voices of the software mixer.
+ *  - Must be called before init_sound(). (SOUND_TRACKS + 1 to SOUND_MAX_VOICES)
+ *  - Backends without the software mixer ignore this.
+ */
+void set_sound_voice_count(int n);
+
+/*
+ * Returns the number of voices of the software mixer.
+ */
+int get_sound_voice_count(void);
+
+/*
+ * Configures the output buffer.
+ *  - Must be called before init_sound().
+ *  - The buffer length is in milliseconds, and 0 uses the default of the
+ *    profile. (Also for the period count.)
+ *  - The low-latency profile uses short periods and a real-time thread.
+ *  - Backends that cannot configure the buffer ignore this.
+ */
+void set_sound_buffer_config(int msec, int periods, bool low_latency);
+
+/*
+ * Selects the sound output.
+ *  - Must be called before init_sound().
+ *  - The WAV and null outputs run the mixer without the device, in real
+ *    time or as fast as possible. (The file is for SOUND_OUTPUT_WAV, and
+ *    NULL writes "sound.wav".)
+ *  - The output stops after msec milliseconds, or never for 0. A WAV
+ *    file also stops at the 4GB limit of the format.
+ *  - Backends without the software mixer ignore this.
+ */
+void set_sound_output(int output, const char *file, bool realtime, int msec);
+
+/*
+ * Returns the measured output latency in milliseconds, or -1 if unknown.
+ */
+int get_sound_latency(void);
+
+/*
+ * Gets the statistics of the sound output.
+ *  - Backends without the statistics return zeros.
+ *  - This is for monitoring, and may block until a decode finishes.
+ */
+void get_sound_stats(struct sound_stats *stats);
+
 /******************
  * Video Playback *
  ******************/
@@ -350,6 +350,33 @@ void notify_image_free(struct image *img)
     CFBridgingRelease(img->texture);
 }
 
+//
+// Notify a texture pre-warm.
+//
+void notify_image_prewarm(struct image *img)
+{
+    // Metal textures are uploaded at notify_image_update().
+    (void)img;
+}
+
+//
+// Start rendering to an image. (Not supported on Metal yet.)
+//
+bool begin_render_target(struct image *img, bool clear)
+{
+    (void)img;
+    (void)clear;
+    log_error("Render targets are not supported.");
+    return false;
+}
+
+//
+// End rendering to an image.
+//
+void end_render_target(void)
+{
+}
+
 //
 // Render an image to the screen with the "normal" pipeline.
 //
@@ -6,13 +6,19 @@
 
 /*
  * Emscripten OpenAL 1.1 Sound
+ *  - The one-shot sounds are mixed by the software mixer, and played on
+ *    one more source with short buffers.
  */
 
 #include "alsound.h"
+#include "mixer.h"
 
 #include <AL/al.h>
 #include <AL/alc.h>
 
+#include <string.h>
+#include <time.h>
+
 /*
  * Sampling Rate and Buffer Samples
  */
@@ -24,6 +30,12 @@
  */
 #define BUFFER_COUNT	(4)
 
+/*
+ * One-Shot Sound Buffers (Short to start a sound soon)
+ */
+#define EFFECT_SAMPLES		(1024)
+#define EFFECT_BUFFER_COUNT	(4)
+
 /*
  * Sound Device
  */
@@ -64,6 +76,24 @@ static bool remain[SOUND_TRACKS];
  */
 static uint32_t tmp_buf[SAMPLES];
 
+/*
+ * One-Shot Sound Source and Buffers
+ */
+static ALuint effect_source;
+static ALuint effect_buffer[EFFECT_BUFFER_COUNT];
+static uint32_t effect_buf[EFFECT_SAMPLES];
+
+/*
+ * Statistics
+ */
+static struct sound_stats out_stats;
+
+/*
+ * Forward Declaration
+ */
+static void fill_effect_buffer(void);
+static uint64_t get_usec(void);
+
 /*
  * Initialize OpenAL
  */
@@ -91,6 +121,24 @@ bool init_openal(void)
 		alSource3f(source[i], AL_POSITION, 0, 0, 0);
 	}
 
+	/* Create a source for the one-shot sounds, and start it with silence. */
+	mixer_reset();
+	alGenBuffers(EFFECT_BUFFER_COUNT, effect_buffer);
+	alGenSources(1, &effect_source);
+	alSourcef(effect_source, AL_GAIN, 1);
+	alSource3f(effect_source, AL_POSITION, 0, 0, 0);
+	memset(effect_buf, 0, sizeof(effect_buf));
+	for (i = 0; i < EFFECT_BUFFER_COUNT; i++) {
+		alBufferData(effect_buffer[i], AL_FORMAT_STEREO16, effect_buf,
+			     sizeof(effect_buf), SAMPLING_RATE);
+	}
+	alSourceQueueBuffers(effect_source, EFFECT_BUFFER_COUNT, effect_buffer);
+	alSourcePlay(effect_source);
+
+	/* Clear the statistics. (A buffer is a period.) */
+	memset(&out_stats, 0, sizeof(out_stats));
+	out_stats.period_usec = (int)((uint64_t)SAMPLES * 1000000 / SAMPLING_RATE);
+
 	return true;
 }
 
@@ -99,6 +147,9 @@ bool init_openal(void)
  */
 void cleanup_openal(void)
 {
+	/* Free the one-shot sounds. */
+	mixer_stop_effects();
+
 	/* TODO */
 }
 
@@ -177,6 +228,76 @@ bool is_sound_finished(int n)
 	return false;
 }
 
+/*
+ * Fade a sound volume for a stream.
+ */
+bool fade_sound(int n, float vol, int msec)
+{
+	/* Not supported. The caller sets the volume. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(vol);
+	UNUSED_PARAMETER(msec);
+	return false;
+}
+
+/*
+ * Set a sound pan for a stream.
+ */
+bool set_sound_pan(int n, float pan)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(pan);
+	return false;
+}
+
+/*
+ * Start a one-shot sound on a free voice.
+ */
+bool play_sound_effect(struct wave *w, float vol)
+{
+	/* Mixed at the next fill_sound_buffer(). */
+	mixer_start_effect(w, vol);
+
+	return true;
+}
+
+/*
+ * Stop all one-shot sounds.
+ */
+void stop_sound_effects(void)
+{
+	mixer_stop_effects();
+}
+
+/*
+ * Configure the output buffer.
+ */
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(msec);
+	UNUSED_PARAMETER(periods);
+	UNUSED_PARAMETER(low_latency);
+}
+
+/*
+ * Get the measured output latency.
+ */
+int get_sound_latency(void)
+{
+	/* Not measured. */
+	return -1;
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+	*stats = out_stats;
+}
+
 /*
  * Fill sound buffers.
  */
@@ -184,27 +305,49 @@ void fill_sound_buffer(void)
 {
 	ALuint buf;
 	ALint state;
-	int n, i, processed, samples;
+	uint64_t start;
+	int n, i, processed, samples, usec, fill;
+
+	out_stats.device_size = BUFFER_COUNT * SAMPLES;
+	out_stats.device_fill = out_stats.device_size;
 
 	for (n = 0; n < SOUND_TRACKS; n++) {
 		/* Resume if dropped due to high loads. */
 		alGetSourcei(source[n], AL_SOURCE_STATE, &state);
-		if (state != AL_PLAYING && !finish[n])
+		if (state != AL_PLAYING && !finish[n]) {
 			alSourcePlay(source[n]);
+			if (stream[n] != NULL) {
+				out_stats.xruns++;
+				out_stats.recoveries++;
+			}
+		}
 
 		/* Get a count of processed buffers. */
 		alGetSourcei(source[n], AL_BUFFERS_PROCESSED, &processed);
 		if (finish[n])
 			remain[n] = remain[n] - processed < 0 ? 0 : remain - processed;
 
+		/* Get the fewest frames queued on the playing sources. */
+		if (stream[n] != NULL && !finish[n]) {
+			fill = (BUFFER_COUNT - processed) * SAMPLES;
+			if (fill < out_stats.device_fill)
+				out_stats.device_fill = fill;
+		}
+
 		/* For each processed buffer: */
 		for (i = 0; i < processed; i++) {
 			/* Unqueue a buffer. */
 			alSourceUnqueueBuffers(source[n], 1, &buf);
 
 			if (!finish[n]) {
-				/* Get PCM samples. */
+				/* Get PCM samples, and measure the decode time. */
+				start = get_usec();
 				samples = get_wave_samples(stream[n], tmp_buf, SAMPLES);
+				usec = (int)(get_usec() - start);
+				out_stats.periods++;
+				out_stats.decode_usec += (uint64_t)usec;
+				if (usec > out_stats.decode_usec_max)
+					out_stats.decode_usec_max = usec;
 				if (samples < SAMPLES) {
 					/* Set a finish flag. */
 					remain[n] = i + 1;
@@ -223,6 +366,38 @@ void fill_sound_buffer(void)
 			alSourceQueueBuffers(source[n], 1, &buf);
 		}
 	}
+
+	fill_effect_buffer();
+}
+
+/* Fill the processed buffers of the one-shot sounds. */
+static void fill_effect_buffer(void)
+{
+	ALuint buf;
+	ALint state;
+	int i, processed;
+
+	/* For each processed buffer: */
+	alGetSourcei(effect_source, AL_BUFFERS_PROCESSED, &processed);
+	for (i = 0; i < processed; i++) {
+		alSourceUnqueueBuffers(effect_source, 1, &buf);
+
+		/* Mix the one-shot sounds, or silence. */
+		mixer_mix_effects(effect_buf, EFFECT_SAMPLES);
+
+		alBufferData(buf, AL_FORMAT_STEREO16, effect_buf,
+			     EFFECT_SAMPLES * sizeof(uint32_t),
+			     SAMPLING_RATE);
+		alSourceQueueBuffers(effect_source, 1, &buf);
+	}
+
+	/* Resume if the short queue ran out. */
+	alGetSourcei(effect_source, AL_SOURCE_STATE, &state);
+	if (state != AL_PLAYING) {
+		alSourcePlay(effect_source);
+		out_stats.xruns++;
+		out_stats.recoveries++;
+	}
 }
 
 /*
@@ -234,6 +409,7 @@ void pause_sound(void)
 	for (i = 0; i < SOUND_TRACKS; i++)
 		if (stream[i] != NULL)
 			alSourceStop(source[i]);
+	alSourceStop(effect_source);
 }
 
 /*
@@ -245,4 +421,15 @@ void resume_sound(void)
 	for (i = 0; i < SOUND_TRACKS; i++)
 		if (stream[i] != NULL)
 			alSourcePlay(source[i]);
+	alSourcePlay(effect_source);
+}
+
+/* Get the monotonic time in microseconds. */
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
 }
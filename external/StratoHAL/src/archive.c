@@ -49,6 +49,10 @@ struct file_entry {
 	char name[FILE_NAME_SIZE];
 	uint64_t size;
 	uint64_t offset;
+
+	/* Not written to an archive: */
+	uint64_t hash;		/* Content hash. */
+	uint64_t body;		/* Index of the entry that owns the body. */
 };
 
 /* File entry */
@@ -66,6 +70,10 @@ static uint64_t next_random;
 /* forward declaration */
 static bool add_file(const char *fname);
 static bool get_file_sizes(void);
+static FILE *open_entry_file(uint64_t index);
+static bool get_file_hash(FILE *fp, uint64_t *hash);
+static bool search_same_body(uint64_t index, uint64_t *body);
+static bool compare_file_bodies(uint64_t index1, uint64_t index2);
 static bool write_archive_file(const char *pkg_file);
 static bool write_file_entries(FILE *fp);
 static bool write_file_bodies(FILE *fp);
@@ -250,32 +258,13 @@ static bool add_file(const char *fname)
 static bool get_file_sizes(void)
 {
 	FILE *fp;
-	uint64_t i;
+	uint64_t i, body;
 
 	/* Get each file size, and calc offsets. */
 	offset = FILE_COUNT_BYTES + ENTRY_BYTES * file_count;
 	for (i = 0; i < file_count; i++) {
-		/*
-		 * Make a path and open the file.
-		 */
-#if defined(TARGET_WINDOWS)
-		/* Make a path on Windows. */
-		char *path = strdup(entry[i].name);
-		char *slash;
-		if (path == NULL) {
-			printf("Out of memory.\n");
-			return false;
-		}
-		while ((slash = strchr(path, '/')) != NULL)
-			*slash = '\\';
-		fp = fopen(path, "rb");
-		free(path);
-#else
-		/* Make path on Mac/Linux. */
-		fp = fopen(entry[i].name, "r");
-#endif
-
-		/* Check the fp. */
+		/* Open the file. */
+		fp = open_entry_file(i);
 		if (fp == NULL) {
 			printf("Failed to open %s.\n", entry[i].name);
 			return false;
@@ -284,9 +273,30 @@ static bool get_file_sizes(void)
 		/* Get the file size. */
 		fseek(fp, 0, SEEK_END);
 		entry[i].size = (uint64_t)ftell(fp);
-		entry[i].offset = offset;
+
+		/* Get the content hash. */
+		rewind(fp);
+		if (!get_file_hash(fp, &entry[i].hash)) {
+			printf("Failed to read %s.\n", entry[i].name);
+			fclose(fp);
+			return false;
+		}
 		fclose(fp);
 
+		/* Share the body if a previous file has the same content. */
+		if (!search_same_body(i, &body))
+			return false;
+		if (body != i) {
+			entry[i].body = body;
+			entry[i].offset = entry[body].offset;
+			printf("Sharing %s with %s\n", entry[i].name, entry[body].name);
+			continue;
+		}
+
+		/* Store the body. */
+		entry[i].body = i;
+		entry[i].offset = offset;
+
 		/* Increment the offset. */
 		offset += entry[i].size;
 
@@ -295,6 +305,117 @@ static bool get_file_sizes(void)
 	return true;
 }
 
+/* Open a file for an entry. */
+static FILE *open_entry_file(uint64_t index)
+{
+	FILE *fp;
+
+#if defined(TARGET_WINDOWS)
+	/* Make a path on Windows. */
+	char *path = strdup(entry[index].name);
+	char *slash;
+	if (path == NULL) {
+		printf("Out of memory.\n");
+		return NULL;
+	}
+	while ((slash = strchr(path, '/')) != NULL)
+		*slash = '\\';
+	fp = fopen(path, "rb");
+	free(path);
+#else
+	/* Make path on Mac/Linux. */
+	fp = fopen(entry[index].name, "r");
+#endif
+
+	return fp;
+}
+
+/* Get a content hash of a file. (64-bit FNV-1a) */
+static bool get_file_hash(FILE *fp, uint64_t *hash)
+{
+	unsigned char buf[8192];
+	uint64_t h;
+	size_t len, i;
+
+	h = 0xcbf29ce484222325ULL;
+	do {
+		len = fread(buf, 1, sizeof(buf), fp);
+		for (i = 0; i < len; i++) {
+			h ^= buf[i];
+			h *= 0x100000001b3ULL;
+		}
+	} while (len == sizeof(buf));
+	if (ferror(fp))
+		return false;
+
+	*hash = h;
+	return true;
+}
+
+/* Search a previous entry that has the same content. */
+static bool search_same_body(uint64_t index, uint64_t *body)
+{
+	uint64_t i;
+
+	*body = index;
+
+	/* Empty files have no body to share. */
+	if (entry[index].size == 0)
+		return true;
+
+	for (i = 0; i < index; i++) {
+		/* Only the entries that own a body. */
+		if (entry[i].body != i)
+			continue;
+		if (entry[i].size != entry[index].size)
+			continue;
+		if (entry[i].hash != entry[index].hash)
+			continue;
+
+		/* Don't trust the hash, compare the contents. */
+		if (!compare_file_bodies(i, index))
+			continue;
+
+		*body = i;
+		break;
+	}
+
+	return true;
+}
+
+/* Compare two files byte by byte. */
+static bool compare_file_bodies(uint64_t index1, uint64_t index2)
+{
+	char buf1[8192], buf2[8192];
+	FILE *fp1, *fp2;
+	size_t len1, len2;
+	bool same;
+
+	fp1 = open_entry_file(index1);
+	if (fp1 == NULL)
+		return false;
+	fp2 = open_entry_file(index2);
+	if (fp2 == NULL) {
+		fclose(fp1);
+		return false;
+	}
+
+	same = true;
+	do {
+		len1 = fread(buf1, 1, sizeof(buf1), fp1);
+		len2 = fread(buf2, 1, sizeof(buf2), fp2);
+		if (len1 != len2 || memcmp(buf1, buf2, len1) != 0) {
+			same = false;
+			break;
+		}
+	} while (len1 == sizeof(buf1));
+
+	fclose(fp1);
+	fclose(fp2);
+
+	return same;
+}
+
 /* Write archive file. */
 static bool write_archive_file(const char *pkg_file)
 {
@@ -360,19 +481,11 @@ static bool write_file_bodies(FILE *fp)
 	size_t len, obf;
 
 	for (i = 0; i < file_count; i++) {
-#ifdef TARGET_WINDOWS
-		char *path = strdup(entry[i].name);
-		char *slash;
-		if (path == NULL) {
-			printf("Out of memory.\n");
-			return false;
-		}
-		while ((slash = strchr(path, '/')) != NULL)
-			*slash = '\\';
-		fpin = fopen(path, "rb");
-#else
-		fpin = fopen(entry[i].name, "r");
-#endif
+		/* Skip an entry that shares a body with a previous entry. */
+		if (entry[i].body != i)
+			continue;
+
+		fpin = open_entry_file(i);
 		if (fpin == NULL) {
 			printf("Failed to open %s.\n", entry[i].name);
 			return false;
@@ -385,13 +498,11 @@ static bool write_file_bodies(FILE *fp)
 					buf[obf] ^= get_next_random();
 				if (fwrite(buf, len, 1, fp) < 1) {
 					printf("Failed to write to the package file.\n");
+					fclose(fpin);
 					return false;
 				}
 			}
 		} while (len == sizeof(buf));
-#ifdef TARGET_WINDOWS
-		free(path);
-#endif
 		fclose(fpin);
 	}
 	return true;
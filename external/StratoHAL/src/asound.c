@@ -6,18 +6,25 @@
 
 /*
  * ALSA Sound
+ *  - The output can be replaced by a sink (a WAV file or nothing) that
+ *    runs the mixer on a virtual clock without the device.
  */
 
 #if defined(__linux__)
 
 /* Base */
 #include "stratohal/platform.h"
+#include "mixer.h"
+#include "soundsink.h"
 
 /* Standard C */
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* POSIX */
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 /* ALSA */
 #include <alsa/asoundlib.h>
@@ -33,79 +40,175 @@
 /*
  * Sound Buffer Config
  */
-#define BUF_FRAMES		(SAMPLING_RATE / 8)
-#define BUF_SIZE		(BUF_FRAMES * FRAME_SIZE)
-#define PERIODS			(4)
-#define PERIOD_FRAMES		(BUF_FRAMES / PERIODS)
-#define PERIOD_SIZE		(BUF_SIZE / PERIODS)
-#define PERIOD_FRAMES_PAD	((PERIOD_SIZE + 63) / 64 * 64 - PERIOD_SIZE)
+#define DEFAULT_BUF_MSEC	(125)
+#define DEFAULT_PERIODS		(4)
+#define LOW_LATENCY_BUF_MSEC	(20)
+#define LOW_LATENCY_PERIODS	(4)
+#define MIN_BUF_MSEC		(5)
+#define MAX_BUF_MSEC		(500)
+#define MIN_PERIODS		(2)
+#define MAX_PERIODS		(16)
 
 /*
- * Stream Data
+ * Read-Ahead Config
  */
+#define DECODE_FRAMES		(2048)
 
-/* ALSA Devices */
-static snd_pcm_t *pcm[SOUND_TRACKS];
+/*
+ * Device Data
+ */
+
+/* ALSA Device */
+static snd_pcm_t *pcm;
+
+/* Is a sink used instead of the device? */
+static bool use_sink;
+
+/* Is the sink paced in real time? (Otherwise as fast as possible) */
+static bool sink_realtime;
+
+/* Time of the virtual clock origin. (usec, 0 to restart) */
+static uint64_t sink_origin;
 
-/* Input Streams */
-static struct wave *wave[SOUND_TRACKS];
+/* Is the output opened? (The device or a sink) */
+static bool is_opened;
 
-/* Sound Threads */
-static pthread_t thread[SOUND_TRACKS];
+/* Buffer Config (set before init_sound()) */
+static int buf_msec = DEFAULT_BUF_MSEC;
+static int periods = DEFAULT_PERIODS;
+static bool low_latency;
+
+/* Mixer Thread */
+static pthread_t thread;
+
+/* Decoder Thread (decodes the waves ahead of the mixer thread) */
+static pthread_t decoder;
+
+/* Mutex Object (mutually exclude between the main thread and the mixer thread) */
+static pthread_mutex_t mutex;
+
+/*
+ * Mutex Object (held while the decoder thread decodes a wave)
+ *  - The main thread takes this before mutex to start or stop a wave.
+ *  - The decoder thread takes only this, and passes the frames to the
+ *    mixer thread through the lock-free rings of the mixer.
+ */
+static pthread_mutex_t decode_mutex;
 
-/* Mutex Objects (mutually exclude between the main thread and a sound thread) */
-static pthread_mutex_t mutex[SOUND_TRACKS];
+/* Condition Variable (wakes the mixer thread up from idle) */
+static pthread_cond_t cond;
+
+/* Condition Variable (wakes the decoder thread up) */
+static pthread_cond_t decode_cond;
 
 /* Exit Requst */
 static bool exit_req;
 
-/* Buffers */
-static uint32_t period_buf[SOUND_TRACKS][PERIOD_FRAMES + PERIOD_FRAMES_PAD];
+/* Period Buffer */
+static uint32_t *period_buf;
+static snd_pcm_uframes_t period_frames;
+
+/* Decode Buffer */
+static uint32_t decode_buf[DECODE_FRAMES];
+
+/* Frames queued on the device after the last write. (-1 if not measured) */
+static snd_pcm_sframes_t delay_frames;
 
-/* Volume Values */
-static float volume[SOUND_TRACKS];
+/* Frames of the device buffer. */
+static snd_pcm_uframes_t buffer_frames;
 
-/* Finish Flags */
-static bool finish[SOUND_TRACKS];
+/* Statistics of the mixer thread. (Under mutex) */
+static struct sound_stats out_stats;
+
+/* Statistics of the decoder thread. (Under decode_mutex) */
+static uint64_t decode_usec;
+static int decode_usec_max;
 
 /*
  * Forward Declarations
  */
-static bool init_pcm(int n);
-static void *sound_thread(void *p);
-static bool playback_period(int n);
-static void scale_samples(uint32_t *buf, int frames, float vol);
+static bool init_pcm(void);
+static bool init_sink(void);
+static void close_output(void);
+static void set_realtime_priority(void);
+static void lock_voices(void);
+static void unlock_voices(void);
+static void *mixer_thread(void *p);
+static void *decoder_thread(void *p);
+static void write_device(snd_pcm_sframes_t *delay, int *xruns, int *recoveries);
+static void write_sink(snd_pcm_sframes_t *delay, int *xruns, int *recoveries);
+static uint64_t get_usec(void);
 
 /*
  * Initialize ALSA.
  */
 bool init_sound(void)
 {
-	int n, ret;
+	int ret;
 
 	exit_req = false;
+	delay_frames = -1;
+	memset(&out_stats, 0, sizeof(out_stats));
+	decode_usec = 0;
+	decode_usec_max = 0;
+
+	use_sink = get_sound_output() != SOUND_OUTPUT_DEVICE;
+	sink_realtime = is_sound_output_realtime();
+	sink_origin = 0;
+
+	/*
+	 * Initialize the voices.
+	 *  - A fast sink doesn't wait for the decoder thread, so the mixer
+	 *    decodes by itself.
+	 */
+	mixer_reset();
+	if (!use_sink || sink_realtime) {
+		if (!mixer_enable_read_ahead())
+			return false;
+	}
 
-	for (n = 0; n < SOUND_TRACKS; n++) {
-		/* Initialize per stream data. */
-		pcm[n] = NULL;
-		wave[n] = NULL;
-		volume[n] = 1.0f;
-		finish[n] = false;
+	/* Initialize a device or a sink. */
+	if (use_sink ? !init_sink() : !init_pcm()) {
+		close_output();
+		mixer_disable_read_ahead();
+		return false;
+	}
 
-		/* Initialize a device. */
-		if (!init_pcm(n))
-			return false;
+	out_stats.period_usec = (int)((uint64_t)period_frames * 1000000 / SAMPLING_RATE);
 
-		/* Create a mutex object. */
-		pthread_mutex_init(&mutex[n], NULL);
+	/* Create the mutex objects and the condition variables. */
+	pthread_mutex_init(&mutex, NULL);
+	pthread_mutex_init(&decode_mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+	pthread_cond_init(&decode_cond, NULL);
 
-		/* Start a sound thread. */
-		ret = pthread_create(&thread[n], NULL, sound_thread, (void *)(intptr_t)n);
+	/* Start the decoder thread. */
+	ret = pthread_create(&decoder, NULL, decoder_thread, NULL);
+	if (ret == 0) {
+		/* Start the mixer thread. */
+		ret = pthread_create(&thread, NULL, mixer_thread, NULL);
 		if (ret != 0) {
-			pthread_mutex_unlock(&mutex[n]);
-			return false;
+			lock_voices();
+			exit_req = true;
+			unlock_voices();
+			pthread_join(decoder, NULL);
 		}
 	}
+	if (ret != 0) {
+		pthread_cond_destroy(&decode_cond);
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&decode_mutex);
+		pthread_mutex_destroy(&mutex);
+		close_output();
+		mixer_disable_read_ahead();
+		return false;
+	}
+
+	is_opened = true;
+
+	/* Run the mixer thread in real-time for the low-latency profile. */
+	if (low_latency)
+		set_realtime_priority();
 
 	return true;
 }
@@ -116,26 +219,32 @@ bool init_sound(void)
 void cleanup_sound(void)
 {
 	void *p1;
-	int n;
-
-	exit_req = true;
 
-	for (n = 0; n < SOUND_TRACKS; n++) {
-		if (pcm[n] == NULL)
-			continue;
+	if (!is_opened)
+		return;
+	is_opened = false;
 
-		stop_sound(n);
+	/* Stop the mixer thread and the decoder thread. */
+	lock_voices();
+	{
+		exit_req = true;
+	}
+	unlock_voices();
+	pthread_join(thread, &p1);
+	pthread_join(decoder, &p1);
 
-		/* Wait for an exit of the sound thread. */
-		pthread_join(thread[n], &p1);
+	/* Free the one-shot sounds and the read-ahead rings. */
+	mixer_stop_effects();
+	mixer_disable_read_ahead();
 
-		/* Close a device. */
-		if (pcm[n] != NULL)
-			snd_pcm_close(pcm[n]);
+	/* Close the device or the sink. */
+	close_output();
 
-		/* Destroy a mutex. */
-		pthread_mutex_destroy(&mutex[n]);
-	}
+	/* Destroy the mutex objects and the condition variables. */
+	pthread_cond_destroy(&decode_cond);
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&decode_mutex);
+	pthread_mutex_destroy(&mutex);
 
 	/* Free caches for Valgrind check. */
 	snd_config_update_free_global();
@@ -149,22 +258,16 @@ bool play_sound(int n, struct wave *w)
 	assert(n < SOUND_TRACKS);
 	assert(w != NULL);
 
-	/* If ALSA is not available, just return. */
-	if (pcm[n] == NULL)
+	/* If the output is not available, just return. */
+	if (!is_opened)
 		return true;
 
-	pthread_mutex_lock(&mutex[n]);
+	lock_voices();
 	{
-		/* Drop the current buffer. */
-		snd_pcm_drop(pcm[n]);
-
-		/* Set a PCM stream. */
-		wave[n] = w;
-
-		/* Reset a finish flag. */
-		finish[n] = false;
+		/* Set a PCM stream to the voice of the track. */
+		mixer_start_voice(n, w);
 	}
-	pthread_mutex_unlock(&mutex[n]);
+	unlock_voices();
 
 	return true;
 }
@@ -176,21 +279,16 @@ bool stop_sound(int n)
 {
 	assert(n < SOUND_TRACKS);
 
-	/* If ALSA is not available, just return. */
-	if (pcm[n] == NULL)
+	/* If the output is not available, just return. */
+	if (!is_opened)
 		return true;
 
-	pthread_mutex_lock(&mutex[n]);
+	lock_voices();
 	{
-		if (wave[n] != NULL) {
-			/* Cancel playback status. */
-			wave[n] = NULL;
-
-			/* Stop an in-flight buffer. */
-			snd_pcm_drop(pcm[n]);
-		}
+		/* Cancel playback status. (The samples already written are played.) */
+		mixer_stop_voice(n);
 	}
-	pthread_mutex_unlock(&mutex[n]);
+	unlock_voices();
 
 	return true;
 }
@@ -203,38 +301,193 @@ bool set_sound_volume(int n, float vol)
 	assert(n < SOUND_TRACKS);
 	assert(vol >= 0 && vol <= 1.0f);
 
-	volume[n] = vol;
+	/* If the output is not available, just return. */
+	if (!is_opened)
+		return true;
+
+	pthread_mutex_lock(&mutex);
+	{
+		mixer_set_voice_volume(n, vol);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+/*
+ * Fade a sound volume for a stream.
+ */
+bool fade_sound(int n, float vol, int msec)
+{
+	assert(n < SOUND_TRACKS);
+	assert(vol >= 0 && vol <= 1.0f);
+	assert(msec >= 0);
+
+	/* If the output is not available, just return. */
+	if (!is_opened)
+		return true;
+
+	pthread_mutex_lock(&mutex);
+	{
+		mixer_fade_voice(n, vol, (int)((int64_t)msec * SAMPLING_RATE / 1000));
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+/*
+ * Set a sound pan for a stream.
+ */
+bool set_sound_pan(int n, float pan)
+{
+	assert(n < SOUND_TRACKS);
+	assert(pan >= -1.0f && pan <= 1.0f);
+
+	/* If the output is not available, just return. */
+	if (!is_opened)
+		return true;
+
+	pthread_mutex_lock(&mutex);
+	{
+		mixer_set_voice_pan(n, pan);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+/*
+ * Start a one-shot sound on a free voice.
+ */
+bool play_sound_effect(struct wave *w, float vol)
+{
+	assert(w != NULL);
+	assert(vol >= 0 && vol <= 1.0f);
+
+	/* Drop the sound if the output is not available. */
+	if (!is_opened) {
+		destroy_wave(w);
+		return true;
+	}
 
-	/* For relaxed consistencies. Not needed for x86 and arm processors. */
-	__sync_synchronize();
+	lock_voices();
+	{
+		mixer_start_effect(w, vol);
+	}
+	unlock_voices();
 
 	return true;
 }
 
+/*
+ * Stop all one-shot sounds.
+ */
+void stop_sound_effects(void)
+{
+	/* If the output is not available, just return. */
+	if (!is_opened)
+		return;
+
+	lock_voices();
+	{
+		mixer_stop_effects();
+	}
+	unlock_voices();
+}
+
 /*
  * Check if a sound stream is finished.
  */
 bool is_sound_finished(int n)
 {
-	/* If ALSA is not available, just return. */
-	if (pcm[n] == NULL)
+	bool ret;
+
+	/* If the output is not available, just return. */
+	if (!is_opened)
 		return true;
 
-	/* For relaxed consistencies. Not needed for x86 and arm processors. */
-	__sync_synchronize();
+	pthread_mutex_lock(&mutex);
+	{
+		ret = mixer_is_voice_finished(n);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return ret;
+}
 
-	if (!finish[n])
-		return false;
+/*
+ * Configure the output buffer.
+ */
+void set_sound_buffer_config(int msec, int count, bool low)
+{
+	low_latency = low;
 
-	return true;
+	/* Use the profile values for 0. */
+	if (msec <= 0)
+		msec = low ? LOW_LATENCY_BUF_MSEC : DEFAULT_BUF_MSEC;
+	if (count <= 0)
+		count = low ? LOW_LATENCY_PERIODS : DEFAULT_PERIODS;
+
+	buf_msec = msec < MIN_BUF_MSEC ? MIN_BUF_MSEC : (msec > MAX_BUF_MSEC ? MAX_BUF_MSEC : msec);
+	periods = count < MIN_PERIODS ? MIN_PERIODS : (count > MAX_PERIODS ? MAX_PERIODS : count);
+}
+
+/*
+ * Get the measured output latency.
+ */
+int get_sound_latency(void)
+{
+	snd_pcm_sframes_t frames;
+
+	/* If the output is not available, just return. */
+	if (!is_opened)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	{
+		frames = delay_frames;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (frames < 0)
+		return -1;
+
+	return (int)(frames * 1000 / SAMPLING_RATE);
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+	/* If the output is not available, just return zeros. */
+	if (!is_opened) {
+		memset(stats, 0, sizeof(struct sound_stats));
+		return;
+	}
+
+	/* Take both locks to see the decoder thread too. */
+	lock_voices();
+	{
+		*stats = out_stats;
+		stats->decode_usec = decode_usec;
+		stats->decode_usec_max = decode_usec_max;
+		stats->device_fill = delay_frames < 0 ? 0 : (int)delay_frames;
+		stats->device_size = (int)buffer_frames;
+		mixer_get_stats(stats);
+	}
+	/* Release without waking the threads up. */
+	pthread_mutex_unlock(&mutex);
+	pthread_mutex_unlock(&decode_mutex);
 }
 
-/* Initialize a device for a stream. */
-static bool init_pcm(int n)
+/* Initialize the device. */
+static bool init_pcm(void)
 {
 	/* Open a device. */
 	int ret;
-	ret = snd_pcm_open(&pcm[n], "default", SND_PCM_STREAM_PLAYBACK, 0);
+	ret = snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
 	if (ret < 0) {
 		log_error("snd_pcm_open() failed.");
 		return false;
@@ -243,161 +496,319 @@ static bool init_pcm(int n)
 	/* Set the format (44.1kHz, stereo, 16-bit signed little endian) */
 	snd_pcm_hw_params_t *params;
 	snd_pcm_uframes_t frames;
+	unsigned int count;
 	snd_pcm_hw_params_alloca(&params);
-	ret = snd_pcm_hw_params_any(pcm[n], params);
+	ret = snd_pcm_hw_params_any(pcm, params);
 	if (ret < 0) {
 		log_error("snd_pcm_hw_params_any() failed.");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_access(pcm[n], params,
+	if (snd_pcm_hw_params_set_access(pcm, params,
 					 SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
 		log_error("snd_pcm_hw_params_set_access() failed.");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_format(pcm[n], params, SND_PCM_FORMAT_S16_LE) < 0) {
+	if (snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE) < 0) {
 		log_error("snd_pcm_hw_params_set_format() failed.");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_rate(pcm[n], params, SAMPLING_RATE, 0) < 0) {
+	if (snd_pcm_hw_params_set_rate(pcm, params, SAMPLING_RATE, 0) < 0) {
 		log_error("snd_pcm_hw_params_set_rate() failed.");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_channels(pcm[n], params, 2) < 0) {
+	if (snd_pcm_hw_params_set_channels(pcm, params, 2) < 0) {
 		log_error("snd_pcm_hw_params_set_channels() failed.");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_periods(pcm[n], params, PERIODS, 0) < 0) {
-		log_error("snd_pcm_hw_params_set_periods() failed.");
+	count = (unsigned int)periods;
+	if (snd_pcm_hw_params_set_periods_near(pcm, params, &count, NULL) < 0) {
+		log_error("snd_pcm_hw_params_set_periods_near() failed.");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_buffer_size(pcm[n], params, BUF_FRAMES) < 0) {
-		frames = BUF_FRAMES;
-		if (snd_pcm_hw_params_set_buffer_size_near(pcm[n], params, &frames) < 0) {
-			log_error("snd_pcm_hw_params_set_buffer_size_near() failed.");
-			return false;
-		}
+	frames = (snd_pcm_uframes_t)(SAMPLING_RATE * buf_msec / 1000);
+	if (snd_pcm_hw_params_set_buffer_size_near(pcm, params, &frames) < 0) {
+		log_error("snd_pcm_hw_params_set_buffer_size_near() failed.");
+		return false;
 	}
-	if (snd_pcm_hw_params(pcm[n], params) < 0) {
+	if (snd_pcm_hw_params(pcm, params) < 0) {
 		log_error("snd_pcm_hw_params() failed.");
 		return false;
 	}
 
+	/* Get the period size that the device accepted. */
+	if (snd_pcm_hw_params_get_period_size(params, &period_frames, NULL) < 0 ||
+	    period_frames == 0) {
+		log_error("snd_pcm_hw_params_get_period_size() failed.");
+		return false;
+	}
+	snd_pcm_hw_params_get_buffer_size(params, &frames);
+	buffer_frames = frames;
+	log_info("ALSA buffer: %lu frames, period: %lu frames.",
+		 (unsigned long)frames, (unsigned long)period_frames);
+
+	period_buf = malloc(period_frames * FRAME_SIZE);
+	if (period_buf == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Initialize a sink.
+ *  - The periods are the same as the device with the buffer config.
+ */
+static bool init_sink(void)
+{
+	period_frames = (snd_pcm_uframes_t)(SAMPLING_RATE * buf_msec / 1000 / periods);
+	if (period_frames == 0)
+		period_frames = 1;
+	buffer_frames = period_frames * (snd_pcm_uframes_t)periods;
+
+	period_buf = malloc(period_frames * FRAME_SIZE);
+	if (period_buf == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+	if (!open_sound_sink())
+		return false;
+
 	return true;
 }
 
+/* Close the device or the sink, and free the period buffer. */
+static void close_output(void)
+{
+	if (use_sink) {
+		close_sound_sink();
+	} else if (pcm != NULL) {
+		snd_pcm_close(pcm);
+		pcm = NULL;
+	}
+	free(period_buf);
+	period_buf = NULL;
+}
+
+/* Raise the mixer thread to real-time priority. */
+static void set_realtime_priority(void)
+{
+	struct sched_param param;
+	int min, max;
+
+	/* Use the middle of the range, below the kernel's IRQ threads. */
+	min = sched_get_priority_min(SCHED_FIFO);
+	max = sched_get_priority_max(SCHED_FIFO);
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = (min + max) / 2;
+
+	/* This fails without CAP_SYS_NICE or an RLIMIT_RTPRIO. */
+	if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+		log_info("Real-time priority is not available for sound.");
+}
+
 /*
- * Sound Threads
+ * Take the locks to start or stop a wave.
+ *  - The decoder thread may be decoding the wave of a voice without
+ *    the lock of the voices, so decode_mutex is taken first.
  */
+static void lock_voices(void)
+{
+	pthread_mutex_lock(&decode_mutex);
+	pthread_mutex_lock(&mutex);
+}
 
-/* The entrypoint of a per-device sound thread. */
-static void *sound_thread(void *p)
+/* Release the locks, and wake the threads up. */
+static void unlock_voices(void)
 {
-	int n = (int)(intptr_t)p;
+	pthread_cond_signal(&cond);
+	pthread_cond_signal(&decode_cond);
+	pthread_mutex_unlock(&mutex);
+	pthread_mutex_unlock(&decode_mutex);
+}
 
+/*
+ * Mixer Thread
+ */
+
+/* The entrypoint of the mixer thread. */
+static void *mixer_thread(void *p)
+{
+	snd_pcm_sframes_t delay;
+	uint64_t start;
+	int usec, xruns, recoveries;
+
+	UNUSED_PARAMETER(p);
+
+	pthread_mutex_lock(&mutex);
 	while (!exit_req) {
-		/* Run a playback loop. */
-		while (playback_period(n)) {
-#if defined(__linux__)
-			/*
-			 * [Important]
-			 *  - We execute context-switch explicitly on Linux by sleep(0).
-			 *  - If we do not call sleep(0), the main thread stops.
-			 *  - We have confirmed this issue on Linux 4.4.0 x86_64.
-			 *  - As we understand, sched_yield() does not solve this issue.
-			 */
-			sleep(0);
-#elif defined(__NetBSD__)
-			/*
-			 * [Important]
-			 *  - We execute context-switch explicitly on NetBSD by sched_yield().
-			 *  - If we do not call sched_yield(), the main thread cannot acquire a mutex.
-			 *  - We have confirmed this issue on NetBSD 9.1 amd64.
-			 *  - As we understand, sleep(0) does not solve this issue.
-			 */
-			sched_yield();
-#endif
+		/*
+		 * Sleep while no voice is playing, or after the sink is full.
+		 * (The virtual clock stops.)
+		 */
+		if (!mixer_is_playing() || (use_sink && is_sound_sink_full())) {
+			sink_origin = 0;
+			pthread_cond_wait(&cond, &mutex);
+			continue;
+		}
+
+		/*
+		 * Mix the voices for a period, and let the decoder refill.
+		 *  - Signaled without decode_mutex so that this thread never
+		 *    waits for a decode. A lost wake-up only delays the refill
+		 *    to the next period.
+		 */
+		start = get_usec();
+		mixer_mix(period_buf, (int)period_frames);
+		pthread_cond_signal(&decode_cond);
+
+		/* Measure the mix time against the period. */
+		usec = (int)(get_usec() - start);
+		out_stats.periods++;
+		out_stats.mix_usec += (uint64_t)usec;
+		if (usec > out_stats.mix_usec_max)
+			out_stats.mix_usec_max = usec;
+
+		/*
+		 * Write to the device without the lock, since it blocks
+		 * until the device has room for a period.
+		 */
+		pthread_mutex_unlock(&mutex);
+		{
+			xruns = 0;
+			recoveries = 0;
+			if (use_sink)
+				write_sink(&delay, &xruns, &recoveries);
+			else
+				write_device(&delay, &xruns, &recoveries);
 		}
+		pthread_mutex_lock(&mutex);
+		delay_frames = delay;
+		out_stats.xruns += (uint64_t)xruns;
+		out_stats.recoveries += (uint64_t)recoveries;
 	}
+	pthread_mutex_unlock(&mutex);
 
 	return (void *)0;
 }
 
-/* Write to a buffer. */
-static bool playback_period(int n)
+/* Write a period to the device. */
+static void write_device(snd_pcm_sframes_t *delay, int *xruns, int *recoveries)
 {
-	int size;
+	/* Repeat while under-running. */
+	while (snd_pcm_writei(pcm, period_buf, period_frames) < 0) {
+		(*xruns)++;
+		if (snd_pcm_prepare(pcm) == 0)
+			(*recoveries)++;
+	}
 
-	pthread_mutex_lock(&mutex[n]);
-	{
-		/* Return false if the main thread stopped a playback. */
-		if (wave[n] == NULL) {
-			pthread_mutex_unlock(&mutex[n]);
-			return false;
-		}
+	/* Measure the latency. */
+	if (snd_pcm_delay(pcm, delay) < 0)
+		*delay = -1;
+}
 
-		/* Get PCM samples. */
-		size = get_wave_samples(wave[n], period_buf[n], PERIOD_FRAMES);
+/*
+ * Write a period to the sink.
+ *  - In real time, this sleeps while the virtual clock is ahead of the
+ *    wall clock by more than the buffer, as the device blocks.
+ *  - The virtual clock behind the wall clock is an underrun, and it is
+ *    recovered by restarting the clock.
+ */
+static void write_sink(snd_pcm_sframes_t *delay, int *xruns, int *recoveries)
+{
+	struct timespec ts;
+	uint64_t now, written;
+	int64_t ahead, buffer_usec;
 
-		/* Fill the remaining samples by zeros for a case where we have reached an end-of-stream. */
-		if (size < PERIOD_FRAMES)
-			memset(period_buf[n] + size, 0, (size_t)(PERIOD_FRAMES - size) * FRAME_SIZE);
+	write_sound_sink(period_buf, (int)period_frames);
 
-		/* Scale samples by a volume value. */
-		scale_samples(period_buf[n], PERIOD_FRAMES, volume[n]);
+	/* Don't wait as fast as possible. */
+	if (!sink_realtime) {
+		*delay = -1;
+		return;
+	}
 
-		/* Write to the device (repeat while under-running) */
-		while (snd_pcm_writei(pcm[n], period_buf[n], PERIOD_FRAMES) < 0)
-			snd_pcm_prepare(pcm[n]);
+	/* Start the clock at the frames written before this period. */
+	now = get_usec();
+	written = get_sound_sink_frames() * 1000000 / SAMPLING_RATE;
+	if (sink_origin == 0)
+		sink_origin = now - (written - (uint64_t)period_frames * 1000000 / SAMPLING_RATE);
+
+	/* Microseconds of the written frames ahead of the wall clock. */
+	ahead = (int64_t)written - (int64_t)(now - sink_origin);
+	if (ahead < 0) {
+		(*xruns)++;
+		(*recoveries)++;
+		sink_origin = 0;
+		*delay = 0;
+		return;
+	}
 
-		/* Return false if we reached an end-of-stream. */
-		if (is_wave_eos(wave[n])) {
-			wave[n] = NULL;
-			finish[n] = true;
-			pthread_mutex_unlock(&mutex[n]);
-			return false;
-		}
+	/* Sleep until the buffer has room for a period. */
+	buffer_usec = (int64_t)buffer_frames * 1000000 / SAMPLING_RATE;
+	if (ahead > buffer_usec) {
+		ts.tv_sec = (time_t)((ahead - buffer_usec) / 1000000);
+		ts.tv_nsec = (long)((ahead - buffer_usec) % 1000000 * 1000);
+		nanosleep(&ts, NULL);
+		ahead = buffer_usec;
 	}
-	pthread_mutex_unlock(&mutex[n]);
 
-	return true;
+	*delay = (snd_pcm_sframes_t)(ahead * SAMPLING_RATE / 1000000);
 }
 
-/* Apply a volume value. */
-static void scale_samples(uint32_t *buf, int frames, float vol)
-{
-	float scale;
-	uint32_t frame;
-	int32_t il, ir;	/* intermediate L/R */
-	int16_t sl, sr;	/* source L/R*/
-	int16_t dl, dr;	/* destination L/R */
-	int i;
+/*
+ * Decoder Thread
+ */
 
-	/* For relaxed consistencies. Not needed for x86 and arm processors. */
-	__sync_synchronize();
+/* The entrypoint of the decoder thread. */
+static void *decoder_thread(void *p)
+{
+	struct wave *w;
+	uint64_t start;
+	int v, room, ret, usec;
 
-	/* Convert a scale factor to an exponential value. */
-	scale = (powf(10.0f, vol) - 1.0f) / (10.0f - 1.0f);
+	UNUSED_PARAMETER(p);
 
-	/* Scale samples. */
-	for (i = 0; i < frames; i++) {
-		frame = buf[i];
+	pthread_mutex_lock(&decode_mutex);
+	while (!exit_req) {
+		/* Sleep while all voices are full or stopped. */
+		v = mixer_get_read_ahead_voice(&w, &room);
+		if (v == -1) {
+			pthread_cond_wait(&decode_cond, &decode_mutex);
+			continue;
+		}
 
-		sl = (int16_t)(uint16_t)frame;
-		sr = (int16_t)(uint16_t)(frame >> 16);
+		/* Decode, and put the frames without the lock of the voices. */
+		if (room > DECODE_FRAMES)
+			room = DECODE_FRAMES;
+		start = get_usec();
+		ret = get_wave_samples(w, decode_buf, room);
+		mixer_put_read_ahead(v, w, decode_buf, ret, ret < room);
+
+		/* Measure the decode time. */
+		usec = (int)(get_usec() - start);
+		decode_usec += (uint64_t)usec;
+		if (usec > decode_usec_max)
+			decode_usec_max = usec;
+
+		/* Let the main thread start or stop a wave between chunks. */
+		pthread_mutex_unlock(&decode_mutex);
+		pthread_mutex_lock(&decode_mutex);
+	}
+	pthread_mutex_unlock(&decode_mutex);
 
-		il = (int)(sl * scale);
-		ir = (int)(sr * scale);
+	return (void *)0;
+}
 
-		il = il > 32767 ? 32767 : il;
-		il = il < -32768 ? -32768 : il;
-		ir = ir > 32767 ? 32767 : ir;
-		ir = ir < -32768 ? -32768 : ir;
+/* Get the monotonic time in microseconds. */
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
 
-		dl = (int16_t)il;
-		dr = (int16_t)ir;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-		buf[i] = ((uint32_t)(uint16_t)dl) | (((uint32_t)(uint16_t)dr) << 16);
-	}
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
 }
 
 #endif /* defined(__linux__) */
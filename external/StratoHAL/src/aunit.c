@@ -6,6 +6,8 @@
 
 /*
  * Apple AudioUnit Sound
+ *  - The one-shot sounds are mixed by the software mixer, and added to
+ *    the tracks.
  */
 
 #include <AudioUnit/AudioUnit.h>
@@ -13,6 +15,7 @@
 
 #include "stratohal/platform.h"
 #include "aunit.h"
+#include "mixer.h"
 
 /* Sound format. */
 #define SAMPLING_RATE   (44100)
@@ -77,6 +80,9 @@ bool init_aunit(void)
     for (n = 0; n < SOUND_TRACKS; n++)
         volume[n] = 1.0f;
 
+    /* Initialize the voices of the one-shot sounds. */
+    mixer_reset();
+
     /* Set initialized. */
     isInitialized = true;
 
@@ -162,6 +168,9 @@ void cleanup_aunit(void)
         /* Stop playback by destroying Audio Unit. */
         destroy_audio_unit();
 
+        /* Free the one-shot sounds. */
+        mixer_stop_effects();
+
         /* Destroy the mutex. */
         pthread_mutex_destroy(&mutex);
     }
@@ -256,6 +265,84 @@ bool is_sound_finished(int stream)
     return false;
 }
 
+/*
+ * Fade a sound volume for a stream.
+ */
+bool fade_sound(int stream, float vol, int msec)
+{
+    /* Not supported. The caller sets the volume. */
+    UNUSED_PARAMETER(stream);
+    UNUSED_PARAMETER(vol);
+    UNUSED_PARAMETER(msec);
+    return false;
+}
+
+/*
+ * Set a sound pan for a stream.
+ */
+bool set_sound_pan(int stream, float pan)
+{
+    /* Not supported. */
+    UNUSED_PARAMETER(stream);
+    UNUSED_PARAMETER(pan);
+    return false;
+}
+
+/*
+ * Start a one-shot sound on a free voice.
+ */
+bool play_sound_effect(struct wave *w, float vol)
+{
+    pthread_mutex_lock(&mutex);
+    {
+        mixer_start_effect(w, vol);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return true;
+}
+
+/*
+ * Stop all one-shot sounds.
+ */
+void stop_sound_effects(void)
+{
+    pthread_mutex_lock(&mutex);
+    {
+        mixer_stop_effects();
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Configure the output buffer.
+ */
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+    /* Not supported. */
+    UNUSED_PARAMETER(msec);
+    UNUSED_PARAMETER(periods);
+    UNUSED_PARAMETER(low_latency);
+}
+
+/*
+ * Get the measured output latency.
+ */
+int get_sound_latency(void)
+{
+    /* Not measured. */
+    return -1;
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+    /* Not measured. */
+    memset(stats, 0, sizeof(struct sound_stats));
+}
+
 /*
  * Callback Thread
  */
@@ -312,6 +399,10 @@ static OSStatus callback(void *inRef,
                 mul_add_pcm(samplePtr, tmpBuf, volume[stream], readSamples);
             }
 
+            /* Add the one-shot sounds. (The mixer applies their volumes.) */
+            mixer_mix_effects(tmpBuf, readSamples);
+            mul_add_pcm(samplePtr, tmpBuf, 1.0f, readSamples);
+
             /* Increment the position. */
             samplePtr += readSamples;
             remain -= readSamples;
@@ -18,6 +18,7 @@
 #define DRAW_IMAGE_RULE		draw_image_rule_avx
 #define DRAW_IMAGE_MELT		draw_image_melt_avx
 #define DRAW_IMAGE_SCALE	draw_image_scale_avx
+#define DRAW_IMAGE_HALF		draw_image_half_avx
 
 #include "drawimage.h"
 
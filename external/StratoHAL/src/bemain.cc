@@ -41,6 +41,7 @@ const uint32 kMsgUpdate = 'updt';
 
 BBitmap* bitmap;
 struct image* image;
+struct image* dst_image;
 char *window_title;
 int window_width;
 int window_height;
@@ -135,6 +136,7 @@ public:
 	{
 		bitmap = new BBitmap(BRect(0, 0, width - 1, height - 1), B_RGBA32);
 		create_image_with_pixels(width, height, (pixel_t*)bitmap->Bits(), &image);
+		dst_image = image;
 
 		NoctView* view = new NoctView(Bounds());
 		AddChild(view);
@@ -202,6 +204,29 @@ void notify_image_free(struct image *img)
 {
 }
 
+void notify_image_prewarm(struct image *img)
+{
+}
+
+bool begin_render_target(struct image *img, bool clear)
+{
+	if (dst_image != image) {
+		log_error("Render targets cannot be nested.");
+		return false;
+	}
+
+	dst_image = img;
+	if (clear)
+		clear_image(dst_image, 0);
+
+	return true;
+}
+
+void end_render_target(void)
+{
+	dst_image = image;
+}
+
 void
 render_image_normal(
 	int dst_left,			/* The X coordinate of the screen */
@@ -224,7 +249,7 @@ render_image_normal(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_alpha(image,
+	draw_image_alpha(dst_image,
 			 dst_left,
 			 dst_top,
 			 src_image,
@@ -452,4 +477,56 @@ bool is_sound_finished(int n)
 	return is_finished[n];
 }
 
+bool fade_sound(int n, float vol, int msec)
+{
+	/* Not supported. The caller sets the volume. */
+	(void)n;
+	(void)vol;
+	(void)msec;
+	return false;
+}
+
+bool set_sound_pan(int n, float pan)
+{
+	/* Not supported. */
+	(void)n;
+	(void)pan;
+	return false;
+}
+
+bool play_sound_effect(struct wave *w, float vol)
+{
+	/* Not supported. The caller keeps the wave. */
+	(void)w;
+	(void)vol;
+	return false;
+}
+
+void stop_sound_effects(void)
+{
+}
+
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported. */
+	(void)msec;
+	(void)periods;
+	(void)low_latency;
+}
+
+int get_sound_latency(void)
+{
+	/* Not measured. */
+	return -1;
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+    /* Not measured. */
+    memset(stats, 0, sizeof(struct sound_stats));
+}
+
 }; /* extern "C" */
@@ -6,11 +6,14 @@
 
 /*
  * BSD / UNIX Sound
+ *  - The one-shot sounds are mixed by the software mixer, and added to
+ *    the tracks.
  */
 
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__sun)
 
 #include "stratohal/platform.h"
+#include "mixer.h"
 
 #if defined(__FreeBSD__)
 #include <sys/soundcard.h>
@@ -34,6 +37,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 
 /*
  * Device
@@ -82,10 +86,15 @@ static float volume[SOUND_TRACKS];
 /* Finish Flags */
 static bool finish[SOUND_TRACKS];
 
+/* Statistics (Under mutex) */
+static struct sound_stats out_stats;
+
 /* Forward Declaration */
 static void *sound_thread(void *p);
 static bool fill_buffer(void);
 static void mul_add_pcm(uint32_t *dst, uint32_t *src, float vol, int samples);
+static void update_stats(int mix_usec, int decode_usec);
+static uint64_t get_usec(void);
 
 /*
  * Initialize sound.
@@ -185,6 +194,11 @@ bool init_sound(void)
 		volume[i] = 1.0f;
 		finish[i] = false;
 	}
+	mixer_reset();
+
+	/* Clear the statistics. */
+	memset(&out_stats, 0, sizeof(out_stats));
+	out_stats.period_usec = (int)((uint64_t)TMP_SAMPLES * 1000000 / SAMPLING_RATE);
 
 	/* Start a sound thread. */
 	ret = pthread_create(&thread, NULL, sound_thread, 0);
@@ -213,6 +227,9 @@ void cleanup_sound(void)
 	if (thread != 0)
 		pthread_join(thread, &p);
 
+	/* Free the one-shot sounds. */
+	mixer_stop_effects();
+
 	/* Close the file handle. */
 	close(dsp_fd);
 	dsp_fd = 0;
@@ -300,6 +317,106 @@ bool is_sound_finished(int n)
 	return true;
 }
 
+/*
+ * Fade a sound volume for a stream.
+ */
+bool fade_sound(int n, float vol, int msec)
+{
+	/* Not supported. The caller sets the volume. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(vol);
+	UNUSED_PARAMETER(msec);
+	return false;
+}
+
+/*
+ * Set a sound pan for a stream.
+ */
+bool set_sound_pan(int n, float pan)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(pan);
+	return false;
+}
+
+/*
+ * Start a one-shot sound on a free voice.
+ */
+bool play_sound_effect(struct wave *w, float vol)
+{
+	assert(w != NULL);
+	assert(vol >= 0 && vol <= 1.0f);
+
+	/* If /dev/dsp is not available, drop the sound. */
+	if (dsp_fd <= 0) {
+		destroy_wave(w);
+		return true;
+	}
+
+	pthread_mutex_lock(&mutex);
+	{
+		mixer_start_effect(w, vol);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+/*
+ * Stop all one-shot sounds.
+ */
+void stop_sound_effects(void)
+{
+	/* If /dev/dsp is not available, just return. */
+	if (dsp_fd <= 0)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	{
+		mixer_stop_effects();
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Configure the output buffer.
+ */
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(msec);
+	UNUSED_PARAMETER(periods);
+	UNUSED_PARAMETER(low_latency);
+}
+
+/*
+ * Get the measured output latency.
+ */
+int get_sound_latency(void)
+{
+	/* Not measured. */
+	return -1;
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+	/* If /dev/dsp is not available, just return zeros. */
+	if (dsp_fd <= 0) {
+		memset(stats, 0, sizeof(struct sound_stats));
+		return;
+	}
+
+	pthread_mutex_lock(&mutex);
+	{
+		*stats = out_stats;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
 /*
  * Sound Thread
  */
@@ -320,7 +437,11 @@ static bool fill_buffer(void)
 {
 	static uint32_t period_buf[TMP_SAMPLES];
 	static uint32_t channel_buf[TMP_SAMPLES];
-	int stream, ret;
+	uint64_t start, decode_start;
+	int stream, ret, decode_usec;
+
+	start = get_usec();
+	decode_usec = 0;
 
 	memset(period_buf, 0, sizeof(uint32_t) * TMP_SAMPLES);
 	memset(channel_buf, 0, sizeof(uint32_t) * TMP_SAMPLES);
@@ -336,7 +457,9 @@ static bool fill_buffer(void)
 			}
 
 			/* Get samples from an input wave stream. */
+			decode_start = get_usec();
 			ret = get_wave_samples(wave[stream], channel_buf, TMP_SAMPLES);
+			decode_usec += (int)(get_usec() - decode_start);
 
 			/* If we reached the end-of-stream. */
 			if(ret < TMP_SAMPLES) {
@@ -356,6 +479,17 @@ static bool fill_buffer(void)
 		mul_add_pcm(period_buf, channel_buf, volume[stream], TMP_SAMPLES);
 	}
 
+	/* Add the one-shot sounds. (The mixer applies their volumes.) */
+	pthread_mutex_lock(&mutex);
+	{
+		mixer_mix_effects(channel_buf, TMP_SAMPLES);
+	}
+	pthread_mutex_unlock(&mutex);
+	mul_add_pcm(period_buf, channel_buf, 1.0f, TMP_SAMPLES);
+
+	/* The mix time excludes the decode time. */
+	update_stats((int)(get_usec() - start) - decode_usec, decode_usec);
+
 	write(dsp_fd, period_buf, sizeof(uint32_t) * TMP_SAMPLES);
 
 	return true;
@@ -393,4 +527,50 @@ static void mul_add_pcm(uint32_t *dst, uint32_t *src, float vol, int samples)
     }
 }
 
+/* Update the statistics for a period. */
+static void update_stats(int mix_usec, int decode_usec)
+{
+#if defined(__FreeBSD__)
+	struct audio_errinfo err;
+	int delay;
+	audio_buf_info info;
+#endif
+
+	pthread_mutex_lock(&mutex);
+	{
+		out_stats.periods++;
+		out_stats.mix_usec += (uint64_t)mix_usec;
+		if (mix_usec > out_stats.mix_usec_max)
+			out_stats.mix_usec_max = mix_usec;
+		out_stats.decode_usec += (uint64_t)decode_usec;
+		if (decode_usec > out_stats.decode_usec_max)
+			out_stats.decode_usec_max = decode_usec;
+
+#if defined(__FreeBSD__)
+		/* OSS recovers from underruns by itself, and resets the counts on a read. */
+		if (ioctl(dsp_fd, SNDCTL_DSP_GETERROR, &err) == 0) {
+			out_stats.xruns += (uint64_t)err.play_underruns;
+			out_stats.recoveries += (uint64_t)err.play_underruns;
+		}
+
+		/* Get the queue fill. */
+		if (ioctl(dsp_fd, SNDCTL_DSP_GETODELAY, &delay) == 0)
+			out_stats.device_fill = delay / FRAME_SIZE;
+		if (ioctl(dsp_fd, SNDCTL_DSP_GETOSPACE, &info) == 0)
+			out_stats.device_size = info.fragstotal * info.fragsize / FRAME_SIZE;
+#endif
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/* Get the monotonic time in microseconds. */
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
+}
+
 #endif /* defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__sun) */
@@ -198,6 +198,28 @@ void notify_image_free(struct image *img)
 	}
 }
 
+void notify_image_prewarm(struct image *img)
+{
+	/* Direct3D textures are uploaded at notify_image_update(). */
+	UNUSED_PARAMETER(img);
+}
+
+bool begin_render_target(struct image *img, bool clear)
+{
+	/* Only GDI supports render targets for now. */
+	if (nGraphicsMode == MODE_GDI)
+		return GDIBeginRenderTarget(img, clear) ? true : false;
+
+	log_error("Render targets are not supported.");
+	return false;
+}
+
+void end_render_target(void)
+{
+	if (nGraphicsMode == MODE_GDI)
+		GDIEndRenderTarget();
+}
+
 void
 render_image_normal(
 	int dst_left,				/* The X coordinate of the screen */
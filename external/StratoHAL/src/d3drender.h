@@ -53,6 +53,8 @@ VOID D3D12NotifyImageFree(struct image* img);
 VOID D3D11NotifyImageFree(struct image* img);
 VOID D3D9NotifyImageFree(struct image *img);
 VOID GDINotifyImageFree(struct image *img);
+BOOL GDIBeginRenderTarget(struct image *img, BOOL bClear);
+VOID GDIEndRenderTarget(void);
 VOID D3D12RenderImageNormal(int dst_left, int dst_top, int dst_width, int dst_height, struct image* src_image, int src_left, int src_top, int src_width, int src_height, int alpha);
 VOID D3D11RenderImageNormal(int dst_left, int dst_top, int dst_width, int dst_height, struct image *src_image, int src_left, int src_top, int src_width, int src_height, int alpha);
 VOID D3D9RenderImageNormal(int dst_left, int dst_top, int dst_width, int dst_height, struct image *src_image, int src_left, int src_top, int src_width, int src_height, int alpha);
@@ -55,6 +55,7 @@ DRAW_IMAGE_COPY(
 		dst_ptr += dw;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -72,9 +73,10 @@ DRAW_IMAGE_ALPHA(
 {
 	pixel_t * RESTRICT src_ptr;
 	pixel_t * RESTRICT dst_ptr;
+	const uint8_t *map;
 	float a, src_r, src_g, src_b, src_a, dst_r, dst_g, dst_b, dst_a;
 	uint32_t src_pix, dst_pix;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+	int src_line_inc, dst_line_inc, x, y, sw, dw, seg, span_end, map_stride, span_class;
 
 	if (!check_draw_image(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
 		return;
@@ -86,37 +88,71 @@ DRAW_IMAGE_ALPHA(
 	src_line_inc = sw - width;
 	dst_line_inc = dw - width;
 	a = (float)alpha / 255.0f;
+	map_stride = (sw + IMAGE_ALPHA_SEG - 1) >> IMAGE_ALPHA_SEG_SHIFT;
 
 	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* Get the source and destination pixel values. */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* Calc alpha values. */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-			dst_a = 1.0f - src_a;
-
-			/* Multiply the alpha value and the source pixel value. */
-			src_r = src_a * (float)get_pixel_r(src_pix);
-			src_g = src_a * (float)get_pixel_g(src_pix);
-			src_b = src_a * (float)get_pixel_b(src_pix);
-
-			/* Multiply the alpha value and the destination pixel value. */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
+		map = src_image->alpha_map != NULL ?
+			src_image->alpha_map + map_stride * (src_top + y) : NULL;
+
+		for(x = 0; x < width; x = span_end) {
+			/* Get a span in an alpha map segment. (or the whole row) */
+			if (map != NULL) {
+				seg = (src_left + x) >> IMAGE_ALPHA_SEG_SHIFT;
+				span_end = ((seg + 1) << IMAGE_ALPHA_SEG_SHIFT) - src_left;
+				if (span_end > width)
+					span_end = width;
+				span_class = map[seg];
+			} else {
+				span_end = width;
+				span_class = IMAGE_ALPHA_MIXED;
+			}
+
+			/* Skip a clear span. */
+			if (span_class == IMAGE_ALPHA_CLEAR) {
+				src_ptr += span_end - x;
+				dst_ptr += span_end - x;
+				continue;
+			}
 
-			/* Store to the destination. */
-			*dst_ptr++ = make_pixel(0xff,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
+			/* Copy an opaque span. */
+			if (span_class == IMAGE_ALPHA_OPAQUE && alpha == 255) {
+				for(; x < span_end; x++)
+					*dst_ptr++ = *src_ptr++;
+				continue;
+			}
+
+			/* Blend the span. */
+			for(; x < span_end; x++) {
+				/* Get the source and destination pixel values. */
+				src_pix	= *src_ptr++;
+				dst_pix	= *dst_ptr;
+
+				/* Calc alpha values. */
+				src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
+				dst_a = 1.0f - src_a;
+
+				/* Multiply the alpha value and the source pixel value. */
+				src_r = src_a * (float)get_pixel_r(src_pix);
+				src_g = src_a * (float)get_pixel_g(src_pix);
+				src_b = src_a * (float)get_pixel_b(src_pix);
+
+				/* Multiply the alpha value and the destination pixel value. */
+				dst_r = dst_a * (float)get_pixel_r(dst_pix);
+				dst_g = dst_a * (float)get_pixel_g(dst_pix);
+				dst_b = dst_a * (float)get_pixel_b(dst_pix);
+
+				/* Store to the destination. (Blend the alpha over a render target.) */
+				*dst_ptr++ = make_pixel((uint32_t)(src_a * 255.0f + dst_a * (float)get_pixel_a(dst_pix) + 0.5f),
+							(uint32_t)(src_r + dst_r),
+							(uint32_t)(src_g + dst_g),
+							(uint32_t)(src_b + dst_b));
+			}
 		}
 		src_ptr += src_line_inc;
 		dst_ptr += dst_line_inc;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -182,6 +218,7 @@ DRAW_IMAGE_GLYPH(
 		dst_ptr += dst_line_inc;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -202,7 +239,7 @@ DRAW_IMAGE_ADD(
 	float a, src_a;
 	uint32_t src_pix, src_r, src_g, src_b;
 	uint32_t dst_pix, dst_r, dst_g, dst_b;
-	uint32_t add_r, add_g, add_b;
+	uint32_t add_r, add_g, add_b, add_a;
 	int src_line_inc, dst_line_inc, x, y, sw, dw;
 
 	if (!check_draw_image(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
@@ -246,8 +283,13 @@ DRAW_IMAGE_ADD(
 			if (add_b > 255)
 				add_b = 255;
 
+			/* Add the alpha over a render target. */
+			add_a = (uint32_t)(src_a * 255.0f) + get_pixel_a(dst_pix);
+			if (add_a > 255)
+				add_a = 255;
+
 			/* Store to the destination. */
-			*dst_ptr++ = make_pixel(0xff,
+			*dst_ptr++ = make_pixel(add_a,
 						add_r,
 						add_g,
 						add_b);
@@ -256,6 +298,7 @@ DRAW_IMAGE_ADD(
 		dst_ptr += dst_line_inc;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -307,8 +350,8 @@ DRAW_IMAGE_DIM(
 			dst_g = dst_a * (float)get_pixel_g(dst_pix);
 			dst_b = dst_a * (float)get_pixel_b(dst_pix);
 
-			/* Store to the destination. */
-			*dst_ptr++ = make_pixel(0xff,
+			/* Store to the destination. (Blend the alpha over a render target.) */
+			*dst_ptr++ = make_pixel((uint32_t)(src_a * 255.0f + dst_a * (float)get_pixel_a(dst_pix) + 0.5f),
 						(uint32_t)(src_r + dst_r),
 						(uint32_t)(src_g + dst_g),
 						(uint32_t)(src_b + dst_b));
@@ -317,6 +360,7 @@ DRAW_IMAGE_DIM(
 		dst_ptr += dst_line_inc;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -369,6 +413,7 @@ DRAW_IMAGE_RULE(
 		rule_ptr += rw;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -453,6 +498,7 @@ DRAW_IMAGE_MELT(
 		rule_ptr += rw;
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
 
@@ -467,12 +513,14 @@ DRAW_IMAGE_SCALE(
 {
 	pixel_t * RESTRICT dst_ptr;
 	pixel_t * RESTRICT src_ptr;
+	struct image *level;
 	float scale_x, scale_y;
 	pixel_t src_pix, dst_pix;
 	float src_a, src_r, src_g, src_b, dst_a, dst_r, dst_g, dst_b;
 	int real_dst_width, real_dst_height;
 	int real_src_width, real_src_height;
 	int real_draw_left, real_draw_top, real_draw_width, real_draw_height;
+	int level_width, level_height, level_y;
 	int virtual_x, virtual_y;
 	int i, j;
 
@@ -497,9 +545,18 @@ DRAW_IMAGE_SCALE(
 	real_draw_width = (int)((float)real_src_width * scale_x);
 	real_draw_height = (int)((float)real_src_height * scale_y);
 
+	/* When minifying, sample the smallest mipmap level that covers the drawn size. */
+	level = src_image;
+	while (level->mipmap != NULL &&
+	       level->mipmap->width >= real_draw_width &&
+	       level->mipmap->height >= real_draw_height)
+		level = level->mipmap;
+	level_width = level->width;
+	level_height = level->height;
+
 	/* Get the pixel pointes. */
 	dst_ptr = dst_image->pixels;
-	src_ptr = src_image->pixels;
+	src_ptr = level->pixels;
 
 	/* Draw. */
 	for (i = real_draw_top; i < real_draw_top + real_draw_height; i++) {
@@ -515,6 +572,7 @@ DRAW_IMAGE_SCALE(
 			continue;
 		if (virtual_y >= real_src_height)
 			continue;
+		level_y = virtual_y * level_height / real_src_height;
 
 		for (j = real_draw_left; j < real_draw_left + real_draw_width;
 		     j++) {
@@ -532,7 +590,7 @@ DRAW_IMAGE_SCALE(
 				continue;
 
 			/* Get a source pixel. */
-			src_pix = src_ptr[real_src_width * virtual_y + virtual_x];
+			src_pix = src_ptr[level_width * level_y + virtual_x * level_width / real_src_width];
 
 			/* Get a destination pixel. */
 			dst_pix = dst_ptr[real_dst_width * i + j];
@@ -559,5 +617,46 @@ DRAW_IMAGE_SCALE(
 		}
 	}
 
+	invalidate_image_alpha_map(dst_image);
 	notify_image_update(dst_image);
 }
+
+void
+DRAW_IMAGE_HALF(
+	struct image *dst_image,
+	struct image *src_image)
+{
+	const uint8_t * RESTRICT s0;
+	const uint8_t * RESTRICT s1;
+	uint8_t * RESTRICT d;
+	int x, y, c, dw, dh, sw, next_x;
+
+	assert(dst_image != NULL);
+	assert(src_image != NULL);
+
+	dw = dst_image->width;
+	dh = dst_image->height;
+	sw = src_image->width;
+	assert(dw == (sw > 1 ? sw / 2 : 1));
+	assert(dh == (src_image->height > 1 ? src_image->height / 2 : 1));
+
+	/* A 1-pixel side uses the same pixel twice. */
+	next_x = sw > 1 ? 4 : 0;
+
+	for (y = 0; y < dh; y++) {
+		s0 = (const uint8_t *)(src_image->pixels + sw * y * 2);
+		s1 = src_image->height > 1 ? s0 + sw * 4 : s0;
+		d = (uint8_t *)(dst_image->pixels + dw * y);
+
+		/* Average 2x2 pixels for each channel. */
+		for (x = 0; x < dw; x++) {
+			for (c = 0; c < 4; c++) {
+				d[x * 4 + c] = (uint8_t)((s0[x * 8 + c] +
+							  s0[x * 8 + next_x + c] +
+							  s1[x * 8 + c] +
+							  s1[x * 8 + next_x + c] +
+							  2) >> 2);
+			}
+		}
+	}
+}
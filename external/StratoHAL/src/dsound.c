@@ -6,10 +6,13 @@
 
 /*
  * DirectSound Audio
+ *  - The one-shot sounds are mixed by the software mixer, and played on
+ *    one more looping buffer that is shorter than the track buffers.
  */
 
 /* Base */
 #include "stratohal/platform.h"
+#include "mixer.h"
 
 /* Windows */
 #include <windows.h>
@@ -20,6 +23,7 @@
 
 /* C */
 #include <math.h>
+#include <string.h>
 #include <assert.h>
 
 /*
@@ -43,12 +47,21 @@
 #define AREA_SAMPLES		(BUF_SAMPLES / BUF_AREAS)
 #define AREA_BYTES			(BUF_BYTES / BUF_AREAS)
 
+/*
+ * One-Shot Sound Buffer (Short to start a sound soon)
+ */
+#define EFFECT_AREA_SAMPLES	(1024)
+#define EFFECT_AREA_BYTES	(EFFECT_AREA_SAMPLES * BYTES_PER_SAMPLE)
+#define EFFECT_BUF_BYTES	(EFFECT_AREA_BYTES * BUF_AREAS)
+
 /*
  * DirectSound Objects
  */
 static LPDIRECTSOUND pDS;
 static LPDIRECTSOUNDBUFFER pDSBuffer[SOUND_TRACKS];
 static LPDIRECTSOUNDNOTIFY pDSNotify[SOUND_TRACKS];
+static LPDIRECTSOUNDBUFFER pDSEffectBuffer;
+static LPDIRECTSOUNDNOTIFY pDSEffectNotify;
 static WAVEFORMATEX wfPrimary;
 
 /*
@@ -60,6 +73,7 @@ static HANDLE hEventThread;
  * For thread communication.
  */
 static HANDLE hNotifyEvent[SOUND_TRACKS];
+static HANDLE hEffectEvent;
 static HANDLE hQuitEvent;
 
 /*
@@ -90,6 +104,11 @@ static int nPosEndArea[SOUND_TRACKS];
  */
 static int bLastTouch[SOUND_TRACKS];
 
+/*
+ * Next area to write the one-shot sounds.
+ */
+static int nEffectArea;
+
 /*
  * Initial volumes.
  */
@@ -105,6 +124,7 @@ static BOOL bInitialized;
  */
 static BOOL CreatePrimaryBuffer();
 static BOOL CreateSecondaryBuffers();
+static BOOL CreateEffectBuffer();
 static BOOL RestoreBuffers(int nBuffer);
 static BOOL PlaySoundBuffer(int nBuffer, struct wave *pStr);
 static VOID StopSoundBuffer(int nBuffer);
@@ -112,6 +132,8 @@ static BOOL SetBufferVolume(int nBuffer, float Vol);
 static BOOL WriteNext(int nBuffer);
 static DWORD WINAPI EventThread(LPVOID lpParameter);
 static VOID OnNotifyPlayPos(int nBuffer);
+static BOOL WriteEffectArea(int nArea);
+static VOID OnNotifyEffectPos(VOID);
 
 /*
  * Initialize DirectSound
@@ -146,6 +168,10 @@ BOOL DSInitialize(HWND hWnd)
 	if(!CreateSecondaryBuffers())
 		return FALSE;
 
+	/* Create a buffer for the one-shot sounds. */
+	if(!CreateEffectBuffer())
+		return FALSE;
+
 	/* Create an event to norify an exit to the event thread. */
 	hQuitEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 	if(hQuitEvent == NULL)
@@ -188,6 +214,25 @@ VOID DSCleanup()
 	/* Delete a critical section object. */
 	DeleteCriticalSection(&StreamCritical);
 
+	/* Release the buffer of the one-shot sounds. */
+	mixer_stop_effects();
+	if(pDSEffectNotify != NULL)
+	{
+		IDirectSoundNotify_Release(pDSEffectNotify);
+		pDSEffectNotify = NULL;
+	}
+	if(pDSEffectBuffer != NULL)
+	{
+		IDirectSoundBuffer_Stop(pDSEffectBuffer);
+		IDirectSoundBuffer_Release(pDSEffectBuffer);
+		pDSEffectBuffer = NULL;
+	}
+	if(hEffectEvent != NULL)
+	{
+		CloseHandle(hEffectEvent);
+		hEffectEvent = NULL;
+	}
+
 	/* Release secondary buffers and notification events. */
 	for(i=0; i<SOUND_TRACKS; i++)
 	{
@@ -286,6 +331,97 @@ bool is_sound_finished(int stream)
     return false;
 }
 
+/*
+ * Fade a sound volume for a stream.
+ */
+bool fade_sound(int n, float vol, int msec)
+{
+	/* Not supported. The caller sets the volume. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(vol);
+	UNUSED_PARAMETER(msec);
+	return false;
+}
+
+/*
+ * Set a sound pan for a stream.
+ */
+bool set_sound_pan(int n, float pan)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(pan);
+	return false;
+}
+
+/*
+ * Start a one-shot sound on a free voice.
+ */
+bool play_sound_effect(struct wave *w, float vol)
+{
+	assert(w != NULL);
+
+	/* Drop the sound if we have no output. */
+	if (!bInitialized)
+	{
+		destroy_wave(w);
+		return true;
+	}
+
+	/* Mixed at the next notification of the effect buffer. */
+	EnterCriticalSection(&StreamCritical);
+	{
+		mixer_start_effect(w, vol);
+	}
+	LeaveCriticalSection(&StreamCritical);
+
+	return true;
+}
+
+/*
+ * Stop all one-shot sounds.
+ */
+void stop_sound_effects(void)
+{
+	if (!bInitialized)
+		return;
+
+	EnterCriticalSection(&StreamCritical);
+	{
+		mixer_stop_effects();
+	}
+	LeaveCriticalSection(&StreamCritical);
+}
+
+/*
+ * Configure the output buffer.
+ */
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(msec);
+	UNUSED_PARAMETER(periods);
+	UNUSED_PARAMETER(low_latency);
+}
+
+/*
+ * Get the measured output latency.
+ */
+int get_sound_latency(void)
+{
+	/* Not measured. */
+	return -1;
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+	/* Not measured. */
+	memset(stats, 0, sizeof(struct sound_stats));
+}
+
 /*
  * Create a primary buffer and set a format.
  */
@@ -379,6 +515,62 @@ static BOOL CreateSecondaryBuffers()
 	return TRUE;
 }
 
+/*
+ * Create a looping buffer for the one-shot sounds and start it with silence.
+ */
+static BOOL CreateEffectBuffer()
+{
+	DSBPOSITIONNOTIFY pn[BUF_AREAS];
+	DSBUFFERDESC dsbd;
+	HRESULT hRet;
+	int i;
+
+	memset(&dsbd, 0, sizeof(DSBUFFERDESC));
+	dsbd.dwSize = sizeof(DSBUFFERDESC);
+	dsbd.dwFlags = DSBCAPS_CTRLPOSITIONNOTIFY |	 /* Use position notification */
+				   DSBCAPS_GETCURRENTPOSITION2 | /* Accurate position on GetCurrentPositon() */
+				   DSBCAPS_GLOBALFOCUS;          /* Play when inactive */
+	dsbd.dwBufferBytes = EFFECT_BUF_BYTES;
+	dsbd.lpwfxFormat = &wfPrimary;
+
+	hRet = IDirectSound_CreateSoundBuffer(pDS, &dsbd, &pDSEffectBuffer, NULL);
+	if(hRet != DS_OK)
+		return FALSE;
+
+	hRet = IDirectSoundBuffer_QueryInterface(pDSEffectBuffer,
+											 &IID_IDirectSoundNotify,
+											 (VOID**)&pDSEffectNotify);
+	if(hRet != S_OK)
+		return FALSE;
+
+	hEffectEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(hEffectEvent == NULL)
+		return FALSE;
+
+	/* Set notification positions at the start of each area. */
+	for(i=0; i<BUF_AREAS; i++)
+	{
+		pn[i].dwOffset = (DWORD)i * EFFECT_AREA_BYTES;
+		pn[i].hEventNotify = hEffectEvent;
+	}
+	hRet = IDirectSoundNotify_SetNotificationPositions(pDSEffectNotify, BUF_AREAS, pn);
+	if(hRet != DS_OK)
+		return FALSE;
+
+	/* Fill silence. (No voice is playing yet.) */
+	mixer_reset();
+	for(i=0; i<BUF_AREAS; i++)
+		WriteEffectArea(i);
+	nEffectArea = 0;
+
+	/* Keep playing. */
+	hRet = IDirectSoundBuffer_Play(pDSEffectBuffer, 0, 0, DSBPLAY_LOOPING);
+	if(hRet != DS_OK)
+		return FALSE;
+
+	return TRUE;
+}
+
 /*
  * Restore buffers.
  */
@@ -608,7 +800,7 @@ static BOOL WriteNext(int nBuffer)
  */
 static DWORD WINAPI EventThread(LPVOID lpParameter)
 {
-	HANDLE hEvents[SOUND_TRACKS+1];
+	HANDLE hEvents[SOUND_TRACKS+2];
 	DWORD dwResult;
 	int i, nBuf;
 
@@ -616,22 +808,32 @@ static DWORD WINAPI EventThread(LPVOID lpParameter)
 
 	/* Create an array for events. */
 	for(i=0; i<SOUND_TRACKS; i++)
-		hEvents[i] = hNotifyEvent[i];	/* For playback position. */
-	hEvents[SOUND_TRACKS] = hQuitEvent;	/* For quit event. */
+		hEvents[i] = hNotifyEvent[i];		/* For playback position. */
+	hEvents[SOUND_TRACKS] = hEffectEvent;		/* For the one-shot sounds. */
+	hEvents[SOUND_TRACKS + 1] = hQuitEvent;	/* For quit event. */
 
 	/* Event wait loop. */
 	while(1)
 	{
 		/* Wait for a notification. */
-		dwResult = WaitForMultipleObjects(SOUND_TRACKS + 1,
+		dwResult = WaitForMultipleObjects(SOUND_TRACKS + 2,
 										  hEvents,
 										  FALSE,
 										  INFINITE);
 		if(dwResult == WAIT_TIMEOUT || dwResult == WAIT_FAILED)
 			continue;
-		if(dwResult == WAIT_OBJECT_0 + SOUND_TRACKS)
+		if(dwResult == WAIT_OBJECT_0 + SOUND_TRACKS + 1)
 			break;		/* hQuitEvent is set. */
 
+		/* Mix the one-shot sounds. */
+		if(dwResult == WAIT_OBJECT_0 + SOUND_TRACKS)
+		{
+			EnterCriticalSection(&StreamCritical);
+			OnNotifyEffectPos();
+			LeaveCriticalSection(&StreamCritical);
+			continue;
+		}
+
 		/* Get a buffer index of notification source. */
 		nBuf = (int)(dwResult - WAIT_OBJECT_0);
 		assert(nBuf >= 0 && nBuf < SOUND_TRACKS);
@@ -705,3 +907,67 @@ static VOID OnNotifyPlayPos(int nBuffer)
 	/* Update the buffer. */
 	WriteNext(nBuffer);
 }
+
+/*
+ * Handler for playback position notification of the one-shot sounds.
+ *  - Fill the areas that finished playing.
+ */
+static VOID OnNotifyEffectPos(VOID)
+{
+	DWORD dwPlayPos;
+	HRESULT hRet;
+	int nPlayArea;
+
+	hRet = IDirectSoundBuffer_GetCurrentPosition(pDSEffectBuffer, &dwPlayPos, NULL);
+	if(hRet != DS_OK)
+		return;
+
+	nPlayArea = (int)(dwPlayPos / EFFECT_AREA_BYTES) % BUF_AREAS;
+	while(nEffectArea != nPlayArea)
+	{
+		WriteEffectArea(nEffectArea);
+		nEffectArea = (nEffectArea + 1) % BUF_AREAS;
+	}
+}
+
+/*
+ * Mix the one-shot sounds to an area of the effect buffer.
+ *  - This function is called inside a critical section on the event thread.
+ */
+static BOOL WriteEffectArea(int nArea)
+{
+	VOID *pBuf[2];
+	DWORD dwLockedBytes[2];
+	HRESULT hRet;
+
+	hRet = IDirectSoundBuffer_Lock(pDSEffectBuffer,
+								   (DWORD)nArea * EFFECT_AREA_BYTES,
+								   EFFECT_AREA_BYTES,
+								   &pBuf[0],
+								   &dwLockedBytes[0],
+								   &pBuf[1],
+								   &dwLockedBytes[1],
+								   0);
+	if(hRet == DSERR_BUFFERLOST)
+	{
+		/* Skip this area, and write to the restored buffer next time. */
+		IDirectSoundBuffer_Restore(pDSEffectBuffer);
+		return FALSE;
+	}
+	if(hRet != DS_OK)
+		return FALSE;
+	assert(pBuf[1] == NULL && dwLockedBytes[1] == 0);
+
+	/* Mix the one-shot sounds, or silence. */
+	mixer_mix_effects((uint32_t *)pBuf[0], EFFECT_AREA_SAMPLES);
+
+	hRet = IDirectSoundBuffer_Unlock(pDSEffectBuffer,
+									 pBuf[0],
+									 dwLockedBytes[0],
+									 pBuf[1],
+									 dwLockedBytes[1]);
+	if(hRet != DS_OK)
+		return FALSE;
+
+	return TRUE;
+}
@@ -580,6 +580,30 @@ void notify_image_free(struct image *img)
 	opengl_notify_image_free(img);
 }
 
+/*
+ * Notify an image pre-warm.
+ */
+void notify_image_prewarm(struct image *img)
+{
+	opengl_notify_image_prewarm(img);
+}
+
+/*
+ * Start rendering to an image.
+ */
+bool begin_render_target(struct image *img, bool clear)
+{
+	return opengl_begin_render_target(img, clear);
+}
+
+/*
+ * End rendering to an image.
+ */
+void end_render_target(void)
+{
+	opengl_end_render_target();
+}
+
 /*
  * Render an image.
  */
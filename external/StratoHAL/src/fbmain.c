@@ -43,6 +43,9 @@
 /* Back Image */
 static struct image *image;
 
+/* Rendering Destination (The back image or a render target) */
+static struct image *dst_image;
+
 /* Screen Info */
 static char *window_title;
 static int fb_fd;
@@ -90,6 +93,7 @@ int main(int argc, char *argv[])
 		return 1;
 
 	create_image(screen_width, screen_height, &image);
+	dst_image = image;
 
 	init_sound();
 	init_input();
@@ -259,6 +263,30 @@ void notify_image_free(struct image *img)
 	UNUSED_PARAMETER(img);
 }
 
+void notify_image_prewarm(struct image *img)
+{
+	UNUSED_PARAMETER(img);
+}
+
+bool begin_render_target(struct image *img, bool clear)
+{
+	if (dst_image != image) {
+		log_error("Render targets cannot be nested.");
+		return false;
+	}
+
+	dst_image = img;
+	if (clear)
+		clear_image(dst_image, 0);
+
+	return true;
+}
+
+void end_render_target(void)
+{
+	dst_image = image;
+}
+
 void
 render_image_normal(
 	int dst_left,			/* The X coordinate of the screen */
@@ -281,7 +309,7 @@ render_image_normal(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_alpha(image,
+	draw_image_alpha(dst_image,
 			 dst_left,
 			 dst_top,
 			 src_image,
@@ -314,7 +342,7 @@ render_image_add(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_add(image,
+	draw_image_add(dst_image,
 		       dst_left,
 		       dst_top,
 		       src_image,
@@ -347,7 +375,7 @@ render_image_dim(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_dim(image,
+	draw_image_dim(dst_image,
 		       dst_left,
 		       dst_top,
 		       src_image,
@@ -364,7 +392,7 @@ render_image_rule(
 	struct image *rule_img,		/* [IN] The rule image */
 	int threshold)			/* The threshold (0 to 255) */
 {
-	draw_image_rule(image, src_img, rule_img, threshold);
+	draw_image_rule(dst_image, src_img, rule_img, threshold);
 }
 
 void render_image_melt(
@@ -372,7 +400,7 @@ void render_image_melt(
 	struct image *rule_img,		/* [IN] The rule image */
 	int progress)			/* The progress (0 to 255) */
 {
-	draw_image_melt(image, src_img, rule_img, progress);
+	draw_image_melt(dst_image, src_img, rule_img, progress);
 }
 
 void
@@ -13,6 +13,7 @@
 static HWND hMainWnd;
 static HDC hWndDC;
 static struct image *pBackImage;
+static struct image *pDstImage;
 static HDC hBitmapDC;
 static HBITMAP hBitmap;
 static int nWindowWidth;
@@ -51,6 +52,7 @@ BOOL GDIInitialize(HWND hWnd, int nWidth, int nHeight)
 	// Create a image.
 	if (!create_image_with_pixels((int)nWidth, (int)nHeight, pixels, &pBackImage))
 		return FALSE;
+	pDstImage = pBackImage;
 
 	return TRUE;
 }
@@ -86,6 +88,26 @@ VOID GDINotifyImageFree(struct image *img)
 	UNUSED_PARAMETER(img);
 }
 
+BOOL GDIBeginRenderTarget(struct image *img, BOOL bClear)
+{
+	if (pDstImage != pBackImage)
+	{
+		log_error("Render targets cannot be nested.");
+		return FALSE;
+	}
+
+	pDstImage = img;
+	if (bClear)
+		clear_image(pDstImage, 0);
+
+	return TRUE;
+}
+
+VOID GDIEndRenderTarget(void)
+{
+	pDstImage = pBackImage;
+}
+
 void GDIRenderImageNormal(
 	int dst_left,				/* The X coordinate of the screen */
 	int dst_top,				/* The Y coordinate of the screen */
@@ -110,7 +132,7 @@ void GDIRenderImageNormal(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_alpha(pBackImage,
+	draw_image_alpha(pDstImage,
 					 dst_left,
 					 dst_top,
 					 src_image,
@@ -145,7 +167,7 @@ void GDIRenderImageAdd(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_add(pBackImage,
+	draw_image_add(pDstImage,
 				   dst_left,
 				   dst_top,
 				   src_image,
@@ -180,7 +202,7 @@ void GDIRenderImageDim(
 	if (src_height == -1)
 		src_height = src_image->height;
 
-	draw_image_dim(pBackImage,
+	draw_image_dim(pDstImage,
 				   dst_left,
 				   dst_top,
 				   src_image,
@@ -196,7 +218,7 @@ void GDIRenderImageRule(
 	struct image *rule_image,
 	int threshold)
 {
-	draw_image_rule(pBackImage,
+	draw_image_rule(pDstImage,
 					src_image,
 					rule_image,
 					threshold);
@@ -207,7 +229,7 @@ void GDIRenderImageMelt(
 	struct image *rule_image,
 	int progress)
 {
-	draw_image_melt(pBackImage,
+	draw_image_melt(pDstImage,
 					src_image,
 					rule_image,
 					progress);
@@ -48,12 +48,30 @@ typedef SSIZE_T ssize_t;
 #define GL_COMPILE_STATUS			0x8B81
 #endif
 
+/*
+ * Define the missing macros for pixel buffer objects. (OpenGL 2.1+)
+ */
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER			0x88EC
+#define GL_STREAM_DRAW				0x88E0
+#endif
+
+/*
+ * Define the missing macros for framebuffer objects. (OpenGL 3.0+)
+ */
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER				0x8D40
+#define GL_COLOR_ATTACHMENT0			0x8CE0
+#define GL_FRAMEBUFFER_COMPLETE			0x8CD5
+#endif
+
 /*
  * Define the missing typedefs if glext.h is not included.
  */
 #ifndef __gl_glext_h_
 typedef char GLchar;
 typedef ssize_t GLsizeiptr;
+typedef ssize_t GLintptr;
 #endif
 
 /*
@@ -88,11 +106,22 @@ extern void (APIENTRY *glVertexAttribPointer)(GLuint index, GLint size, GLenum t
 extern void (APIENTRY *glEnableVertexAttribArray)(GLuint index);
 extern GLint (APIENTRY *glGetUniformLocation)(GLuint program, const GLchar *name);
 extern void (APIENTRY *glUniform1i)(GLint location, GLint v0);
+extern void (APIENTRY *glUniform4f)(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
 extern void (APIENTRY *glBufferData)(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+extern void (APIENTRY *glBufferSubData)(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
 extern void (APIENTRY *glDeleteShader)(GLuint shader);
 extern void (APIENTRY *glDeleteProgram)(GLuint program);
 extern void (APIENTRY *glDeleteVertexArrays)(GLsizei n, const GLuint *arrays);
 extern void (APIENTRY *glDeleteBuffers)(GLsizei n, const GLuint *buffers);
+extern void (APIENTRY *glGenFramebuffers)(GLsizei n, GLuint *framebuffers);
+extern void (APIENTRY *glBindFramebuffer)(GLenum target, GLuint framebuffer);
+extern void (APIENTRY *glFramebufferTexture2D)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+extern GLenum (APIENTRY *glCheckFramebufferStatus)(GLenum target);
+extern void (APIENTRY *glDeleteFramebuffers)(GLsizei n, const GLuint *framebuffers);
+extern void (APIENTRY *glBlendFuncSeparate)(GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha);
+/* Optional: NULL if not available. (OpenGL 3.3+) */
+extern void (APIENTRY *glDrawArraysInstanced)(GLenum mode, GLint first, GLsizei count, GLsizei instancecount);
+extern void (APIENTRY *glVertexAttribDivisor)(GLuint index, GLuint divisor);
 #ifdef TARGET_WINDOWS
 /* Note: only Windows lacks glActiveTexture(), libOpenGL.so exports one that actually works. */
 extern void (APIENTRY *glActiveTexture)(GLenum texture);
@@ -118,16 +147,20 @@ extern void (APIENTRY *glActiveTexture)(GLenum texture);
 #define glTexParameteri q_glTexParameteri
 #define glTexParameteri q_glTexParameteri
 #define glTexImage2D q_glTexImage2D
+#define glTexSubImage2D q_glTexSubImage2D
 #define glActiveTexture q_glActiveTexture
 #define glDeleteTextures q_glDeleteTextures
 #define glEnable q_glEnable
 #define glBlendFunc q_glBlendFunc
+#define glBlendFuncSeparate q_glBlendFuncSeparate
 #define glDrawElements q_glDrawElements
+#define glGetIntegerv q_glGetIntegerv
 void q_glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
 void q_glClear(GLbitfield mask);
 void q_glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
 void q_glEnable(GLenum cap);
 void q_glBlendFunc(GLenum sfactor, GLenum dfactor);
+void q_glBlendFuncSeparate(GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha);
 void q_glFlush(void);
 void q_glGenTextures(GLsizei n, GLuint *textures);
 void q_glActiveTexture(GLenum texture);
@@ -136,7 +169,9 @@ void q_glDeleteTextures(GLsizei n, const GLuint *textures);
 void q_glPixelStorei(GLenum pname, GLint param);
 void q_glTexParameteri(GLenum target, GLenum pname, GLint param);
 void q_glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+void q_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid *pixels);
 void q_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+void q_glGetIntegerv(GLenum pname, GLint *data);
 /* OpenGL 2+ */
 #define glUseProgram q_glUseProgram
 #define glBindBuffer q_glBindBuffer
@@ -146,7 +181,17 @@ void q_glBindBuffer(GLenum target, GLuint buffer);
 void q_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
 /* OpenGL 3+ */
 #define glBindVertexArray q_glBindVertexArray
+#define glGenFramebuffers q_glGenFramebuffers
+#define glBindFramebuffer q_glBindFramebuffer
+#define glFramebufferTexture2D q_glFramebufferTexture2D
+#define glCheckFramebufferStatus q_glCheckFramebufferStatus
+#define glDeleteFramebuffers q_glDeleteFramebuffers
 void q_glBindVertexArray(GLuint array);
+void q_glGenFramebuffers(GLsizei n, GLuint *framebuffers);
+void q_glBindFramebuffer(GLenum target, GLuint framebuffer);
+void q_glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+GLenum q_glCheckFramebufferStatus(GLenum target);
+void q_glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
 #endif	/* ifdef USE_QT */
 
 #endif	/* GLHELPER_H */
@@ -13,6 +13,8 @@
 #include "glrender.h"
 
 /* Standard C */
+#include <stddef.h>
+#include <string.h>
 #include <assert.h>
 
 /*
@@ -65,6 +67,14 @@
 #include "glhelper.h"
 #endif
 
+/*
+ * Instanced sprites need OpenGL 3.3 or OpenGL ES 3.0, and are checked at runtime.
+ * (Qt wraps the buffers by itself, thus we don't use them on Qt.)
+ */
+#if !defined(USE_QT)
+#define USE_INSTANCING
+#endif
+
 /*
  * Pipeline types.
  */
@@ -296,16 +306,167 @@ static const char *fragment_shader_src_melt =
 	"  gl_FragColor = tex;                               \n"
 	"}                                                   \n";
 
+#if defined(USE_INSTANCING)
+/*
+ * Instanced sprite shader sources.
+ *  - A version header is selected at runtime. (GLSL 3.30 or GLSL ES 3.00)
+ *  - A quad is expanded from an instance by gl_VertexID. (0:LT, 1:RT, 2:LB, 3:RB)
+ *  - u_screen is (half width, half height, Y direction, unused).
+ */
+
+/* The version header for OpenGL ES 3.0. */
+static const char *sprite_header_es =
+	"#version 300 es                                     \n"
+	"precision mediump float;                            \n";
+
+/* The version header for OpenGL 3.3. */
+static const char *sprite_header_gl =
+	"#version 330                                        \n";
+
+/* The vertex shader. */
+static const char *sprite_vertex_shader_src =
+	"layout(location = 0) in vec4 a_dst;                 \n" /* (x, y, w, h) */
+	"layout(location = 1) in vec4 a_src;                 \n" /* (u1, v1, u2, v2) */
+	"layout(location = 2) in float a_alpha;              \n"
+	"uniform vec4 u_screen;                              \n"
+	"out vec2 v_texCoord;                                \n"
+	"out float v_alpha;                                  \n"
+	"void main()                                         \n"
+	"{                                                   \n"
+	"  vec2 c = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)); \n"
+	"  vec2 p = (a_dst.xy + c * a_dst.zw - u_screen.xy) / u_screen.xy; \n"
+	"  gl_Position = vec4(p.x, p.y * u_screen.z, 0.0, 1.0); \n"
+	"  v_texCoord = mix(a_src.xy, a_src.zw, c);          \n"
+	"  v_alpha = a_alpha;                                \n"
+	"}                                                   \n";
+
+/* The normal alpha blending shader. */
+static const char *sprite_fragment_shader_src_normal =
+	"in vec2 v_texCoord;                                 \n"
+	"in float v_alpha;                                   \n"
+	"uniform sampler2D s_texture;                        \n"
+	"out vec4 o_color;                                   \n"
+	"void main()                                         \n"
+	"{                                                   \n"
+	"  vec4 tex = texture(s_texture, v_texCoord);        \n"
+	"  tex.a = tex.a * v_alpha;                          \n"
+	"  o_color = tex;                                    \n"
+	"}                                                   \n";
+
+/* The character dimming shader. (RGB 50%) */
+static const char *sprite_fragment_shader_src_dim =
+	"in vec2 v_texCoord;                                 \n"
+	"in float v_alpha;                                   \n"
+	"uniform sampler2D s_texture;                        \n"
+	"out vec4 o_color;                                   \n"
+	"void main()                                         \n"
+	"{                                                   \n"
+	"  vec4 tex = texture(s_texture, v_texCoord);        \n"
+	"  tex.rgb = tex.rgb * 0.5;                          \n"
+	"  o_color = tex;                                    \n"
+	"}                                                   \n";
+#endif
+
 /* Window size. */
 static int window_width;
 static int window_height;
 
-/* Indicates if the first rendering after re-init. */
-static bool is_after_reinit;
-
 /* Re-init count. */
 static int reinit_count;
 
+/* Framebuffer object for render targets. */
+static GLuint target_fbo;
+
+/* Current render target. (NULL for the screen) */
+static struct image *target_image;
+
+/* Size of the current render destination. */
+static int render_width;
+static int render_height;
+
+/* Viewport of the screen saved while rendering to a target. */
+static GLint saved_viewport[4];
+
+/*
+ * Shadow copy of the GL states to skip redundant calls.
+ *  - Invalidated every frame because Qt and the platforms may change
+ *    the states outside this file.
+ *  - STATE_UNKNOWN never matches a real object name.
+ */
+#define STATE_UNKNOWN	((GLuint)-1)
+#define TEXTURE_UNITS	(2)
+static struct {
+	GLuint program;
+	GLuint vao;
+	GLuint array_buffer;
+	GLuint element_buffer;	/* Part of the VAO state */
+	bool is_blend_known;
+	GLenum blend_src;
+	GLenum blend_dst;
+	GLenum blend_src_alpha;
+	GLenum blend_dst_alpha;
+	GLenum active_texture;	/* 0 if unknown */
+	GLuint texture[TEXTURE_UNITS];
+} gl_state;
+
+/* Counters of the state calls. */
+static uint64_t state_calls_issued;
+static uint64_t state_calls_skipped;
+
+#if defined(USE_INSTANCING)
+/*
+ * Instanced sprites.
+ *  - Rectangle draws of the same texture and pipeline are queued, and
+ *    drawn by one instanced call.
+ *  - Falls back to a draw per sprite on OpenGL ES 2.0 and WebGL 1.
+ */
+#define SPRITE_BATCH_SIZE	(256)
+struct sprite_instance {
+	GLfloat dst[4];		/* x, y, width, height */
+	GLfloat src[4];		/* u1, v1, u2, v2 */
+	GLfloat alpha;
+};
+static bool is_instancing_enabled;
+static GLuint sprite_vertex_shader;
+static GLuint sprite_fragment_shader_normal;
+static GLuint sprite_fragment_shader_dim;
+static GLuint sprite_program_normal;
+static GLuint sprite_program_dim;
+static GLint sprite_screen_loc_normal;
+static GLint sprite_screen_loc_dim;
+static GLuint sprite_vao;
+static GLuint sprite_vbo;
+static struct sprite_instance sprite_batch[SPRITE_BATCH_SIZE];
+static int sprite_count;
+static struct image *sprite_image;
+static int sprite_pipeline;
+#endif
+
+/*
+ * Upload queue for pre-warmed textures.
+ *  - Rows are streamed over frames within the per-frame upload budget.
+ */
+#define UPLOAD_QUEUE_SIZE	(64)
+struct upload_entry {
+	struct image *img;
+	bool is_started;
+
+	/* Level being uploaded, and the next row in it. */
+	struct image *level_img;
+	int level;
+	int row;
+
+	/* Total bytes of the levels. */
+	size_t size;
+};
+static struct upload_entry upload_queue[UPLOAD_QUEUE_SIZE];
+static int upload_count;
+
+#if !defined(USE_QT)
+/* Pixel buffer object to stage the rows. (Qt wraps buffers by itself) */
+static GLuint upload_pbo;
+#endif
+
 /*
  * The following functions are defined in this file if we don't use Qt.
  * In the case we use Qt, they are defined in openglwidget.cpp because
@@ -351,7 +512,30 @@ static void draw_elements_3d(float x1,
 			     int src_height,
 			     int alpha,
 			     int pipeline);
-static void update_texture_if_needed(struct image *img);
+static bool update_texture_if_needed(struct image *img);
+static void bind_texture_for_upload(struct image *img);
+static void finish_texture_upload(struct image *img, size_t size);
+static void evict_textures_over_budget(void);
+static void process_upload_queue(void);
+static bool start_queued_upload(struct upload_entry *e);
+static void upload_queued_rows(struct upload_entry *e, int rows);
+static void remove_upload_queue(struct image *img);
+#if defined(USE_INSTANCING)
+static bool is_instancing_supported(void);
+static bool setup_sprite_shaders(void);
+static bool setup_sprite_program(const char *header, const char *fshader_src,
+				 GLuint *fshader, GLuint *prog, GLint *screen_loc);
+static void cleanup_sprite_shaders(void);
+static void queue_sprite(int dst_left, int dst_top, int dst_width, int dst_height,
+			 struct image *src_image, int src_left, int src_top,
+			 int src_width, int src_height, int alpha, int pipeline);
+#endif
+static void flush_sprites(void);
+static void invalidate_gl_state(void);
+static void use_program(GLuint prog, GLuint vao, GLuint vbo, GLuint ibo);
+static void set_blend_func(GLenum src, GLenum dst);
+static void bind_texture(GLenum unit, GLuint tex);
+static void forget_texture(GLuint tex);
 
 /*
  * Initialize OpenGL.
@@ -365,6 +549,8 @@ bool init_opengl(int width, int height)
 	/* Set a viewport. */
 	window_width = width;
 	window_height = height;
+	render_width = width;
+	render_height = height;
 	glViewport(0, 0, window_width, window_height);
 
 	/* Setup a vertex shader. */
@@ -415,9 +601,36 @@ bool init_opengl(int width, int height)
 				   &ibo_melt))
 		return false;
 
-	is_after_reinit = true;
+#if !defined(USE_QT)
+	/* Create a pixel buffer object for the upload queue. */
+	glGenBuffers(1, &upload_pbo);
+#endif
+
+	/* Create a framebuffer object for render targets. */
+	glGenFramebuffers(1, &target_fbo);
+	target_image = NULL;
+
+#if defined(USE_INSTANCING)
+	/* Use instanced sprites if available. */
+	sprite_count = 0;
+	is_instancing_enabled = false;
+	if (is_instancing_supported()) {
+		if (setup_sprite_shaders())
+			is_instancing_enabled = true;
+		else
+			log_info("Falling back to non-instanced sprites.");
+	}
+#endif
+
 	reinit_count++;
 
+	/* The setup above changed the states. */
+	invalidate_gl_state();
+
+	/* Textures of the previous context are lost. */
+	reset_resident_textures();
+	upload_count = 0;
+
 	return true;
 }
 
@@ -638,6 +851,21 @@ void cleanup_opengl(void)
 		cleanup_vertex_shader(vertex_shader);
 		vertex_shader = (GLuint)-1;
 	}
+#if !defined(USE_QT)
+	if (upload_pbo != 0) {
+		glDeleteBuffers(1, &upload_pbo);
+		upload_pbo = 0;
+	}
+#endif
+	if (target_fbo != 0) {
+		glDeleteFramebuffers(1, &target_fbo);
+		target_fbo = 0;
+	}
+#if defined(USE_INSTANCING)
+	cleanup_sprite_shaders();
+	is_instancing_enabled = false;
+#endif
+	invalidate_gl_state();
 }
 
 /*
@@ -652,6 +880,14 @@ void opengl_start_rendering(void)
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 #endif
+
+	begin_texture_frame();
+
+	/* The states may be changed since the last frame. */
+	invalidate_gl_state();
+
+	/* Stream the pre-warmed textures. */
+	process_upload_queue();
 }
 
 /*
@@ -659,8 +895,8 @@ void opengl_start_rendering(void)
  */
 void opengl_end_rendering(void)
 {
+	flush_sprites();
 	glFlush();
-	is_after_reinit = false;
 }
 
 /*
@@ -677,6 +913,46 @@ void opengl_end_rendering(void)
  */
 void opengl_notify_image_update(struct image *img)
 {
+	int i;
+
+	img->need_upload = true;
+
+	/* Restart a queued upload since the pixels are changed. */
+	for (i = 0; i < upload_count; i++) {
+		if (upload_queue[i].img == img) {
+			upload_queue[i].is_started = false;
+			break;
+		}
+	}
+}
+
+/*
+ * Queue an image to upload over the next frames before it is drawn.
+ *  - An image drawn while queued is uploaded at once.
+ */
+void opengl_notify_image_prewarm(struct image *img)
+{
+	int i;
+
+	/* Already on GPU. */
+	if (img->context == reinit_count && img->texture != NULL && !img->need_upload)
+		return;
+
+	/* Already queued. */
+	for (i = 0; i < upload_count; i++) {
+		if (upload_queue[i].img == img)
+			return;
+	}
+
+	/* Uploaded when drawn if the queue is full. */
+	if (upload_count == UPLOAD_QUEUE_SIZE)
+		return;
+
+	upload_queue[upload_count].img = img;
+	upload_queue[upload_count].is_started = false;
+	upload_count++;
+
+	/* Keep it from being drawn before the upload completes. */
 	img->need_upload = true;
 }
 
@@ -687,17 +963,93 @@ void opengl_notify_image_free(struct image *img)
 {
 	GLuint id;
 
+	if (img == target_image)
+		opengl_end_render_target();
+
+	/* Draw the queued sprites before the texture is deleted. */
+#if defined(USE_INSTANCING)
+	if (img == sprite_image)
+		flush_sprites();
+#endif
+
+	remove_upload_queue(img);
+
 	id = (GLuint)(uintptr_t)img->texture - 1;
 
-	/* FIXME: is_after_reinit */
-	if (id != 0) {
+	/* A texture of a previous context is already lost. */
+	if (img->texture != NULL && img->context == reinit_count) {
+		forget_texture(id);
 		glDeleteTextures(1, &id);
-		img->texture = NULL;
 	}
+	img->texture = NULL;
 
 	img->need_upload = false;
 }
 
+/*
+ * Start rendering to an image.
+ */
+bool opengl_begin_render_target(struct image *img, bool clear)
+{
+	GLuint tex;
+
+	assert(img->is_render_target);
+
+	if (target_image != NULL) {
+		log_error("Render targets cannot be nested.");
+		return false;
+	}
+
+	/* Draw the sprites queued for the screen. */
+	flush_sprites();
+
+	/* Create the texture, or restore it after a context loss. */
+	if (!update_texture_if_needed(img))
+		return false;
+	tex = (GLuint)(intptr_t)img->texture - 1;
+
+	glGetIntegerv(GL_VIEWPORT, saved_viewport);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		log_error("Cannot render to a texture.");
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return false;
+	}
+
+	target_image = img;
+	render_width = img->width;
+	render_height = img->height;
+	glViewport(0, 0, img->width, img->height);
+
+	if (clear) {
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+
+	return true;
+}
+
+/*
+ * End rendering to an image.
+ */
+void opengl_end_render_target(void)
+{
+	if (target_image == NULL)
+		return;
+
+	/* Draw the sprites queued for the target. */
+	flush_sprites();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+
+	target_image = NULL;
+	render_width = window_width;
+	render_height = window_height;
+}
+
 /*
  * Render an image with the normal pipeline.
  */
@@ -830,14 +1182,14 @@ void opengl_render_image_rule(struct image *src_image,
 {
 	draw_elements(0,
 		      0,
-		      window_width,
-		      window_height,
+		      render_width,
+		      render_height,
 		      src_image,
 		      rule_image,
 		      0,
 		      0,
-		      window_width,
-		      window_height,
+		      render_width,
+		      render_height,
 		      threshold,
 		      PIPELINE_RULE);
 }
@@ -851,14 +1203,14 @@ void opengl_render_image_melt(struct image *src_image,
 {
 	draw_elements(0,
 		      0,
-		      window_width,
-		      window_height,
+		      render_width,
+		      render_height,
 		      src_image,
 		      rule_image,
 		      0,
 		      0,
-		      window_width,
-		      window_height,
+		      render_width,
+		      render_height,
 		      progress,
 		      PIPELINE_MELT);
 }
@@ -877,6 +1229,16 @@ static void draw_elements(int dst_left,
 			  int alpha,
 			  int pipeline)
 {
+#if defined(USE_INSTANCING)
+	/* Queue a sprite. (The transitions use two textures.) */
+	if (is_instancing_enabled && rule_image == NULL) {
+		queue_sprite(dst_left, dst_top, dst_width, dst_height,
+			     src_image, src_left, src_top, src_width, src_height,
+			     alpha, pipeline);
+		return;
+	}
+#endif
+
 	draw_elements_3d((float)dst_left,
 			 (float)dst_top,
 			 (float)(dst_left + dst_width),
@@ -990,11 +1352,21 @@ static void draw_elements_3d(float x1,
 			     int pipeline)
 {
 	GLfloat pos[24];
-	float hw, hh, tw, th;
+	float hw, hh, tw, th, fy;
 	GLuint tex1, tex2;
 
-	update_texture_if_needed(src_image);
-	update_texture_if_needed(rule_image);
+	/* A texture cannot be sampled while being rendered to. */
+	if (target_image != NULL &&
+	    (src_image == target_image || rule_image == target_image))
+		return;
+
+	/* Keep the draw order with the queued sprites. */
+	flush_sprites();
+
+	/* Skip if a released image cannot be reloaded. */
+	if (!update_texture_if_needed(src_image) ||
+	    !update_texture_if_needed(rule_image))
+		return;
 
 	/* Get textures. */
 	tex1 = (GLuint)(intptr_t)src_image->texture - 1;
@@ -1006,9 +1378,12 @@ static void draw_elements_3d(float x1,
 		tex2 = 0;
 	}
 
-	/* Get the half of the window size. */
-	hw = (float)window_width / 2.0f;
-	hh = (float)window_height / 2.0f;
+	/* Get the half of the destination size. */
+	hw = (float)render_width / 2.0f;
+	hh = (float)render_height / 2.0f;
+
+	/* Keep the top row of a render target at t=0 as uploaded images. */
+	fy = target_image != NULL ? 1.0f : -1.0f;
 
 	/* Get the texture size. */
 	tw = (float)src_image->width;
@@ -1016,7 +1391,7 @@ static void draw_elements_3d(float x1,
 
 	/* Left-Top */
 	pos[0] = (x1 - hw) / hw;
-	pos[1] = -(y1 - hh) / hh;
+	pos[1] = fy * (y1 - hh) / hh;
 	pos[2] = 0.0f;
 	pos[3] = (float)src_left / tw;
 	pos[4] = (float)src_top / th;
@@ -1024,7 +1399,7 @@ static void draw_elements_3d(float x1,
 
 	/* Right-Top */
 	pos[6] = (x2 - hw) / hw;
-	pos[7] = -(y2 - hh) / hh;
+	pos[7] = fy * (y2 - hh) / hh;
 	pos[8] = 0.0f;
 	pos[9] = (float)(src_left + src_width) / tw;
 	pos[10] = (float)(src_top) / th;
@@ -1032,7 +1407,7 @@ static void draw_elements_3d(float x1,
 
 	/* Left-Bottom */
 	pos[12] = (x3 - hw) / hw;
-	pos[13] = -(y3 - hh) / hh;
+	pos[13] = fy * (y3 - hh) / hh;
 	pos[14] = 0.0f;
 	pos[15] = (float)src_left / tw;
 	pos[16] = (float)(src_top + src_height) / th;
@@ -1040,7 +1415,7 @@ static void draw_elements_3d(float x1,
 
 	/* Right-Bottom */
 	pos[18] = (x4 - hw) / hw;
-	pos[19] = -(y4 - hh) / hh;
+	pos[19] = fy * (y4 - hh) / hh;
 	pos[20] = 0.0f;
 	pos[21] = (float)(src_left + src_width) / tw;
 	pos[22] = (float)(src_top + src_height) / th;
@@ -1049,44 +1424,24 @@ static void draw_elements_3d(float x1,
 	/* Setup the shader. */
 	switch (pipeline) {
 	case PIPELINE_NORMAL:
-		glUseProgram(program_normal);
-		glBindVertexArray(vao_normal);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_normal);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_normal);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		use_program(program_normal, vao_normal, vbo_normal, ibo_normal);
+		set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	case PIPELINE_ADD:
-		glUseProgram(program_normal);
-		glBindVertexArray(vao_normal);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_normal);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_normal);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_ONE, GL_ONE);
+		use_program(program_normal, vao_normal, vbo_normal, ibo_normal);
+		set_blend_func(GL_ONE, GL_ONE);
 		break;
 	case PIPELINE_DIM:
-		glUseProgram(program_dim);
-		glBindVertexArray(vao_dim);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_dim);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_dim);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		use_program(program_dim, vao_dim, vbo_dim, ibo_dim);
+		set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	case PIPELINE_RULE:
-		glUseProgram(program_rule);
-		glBindVertexArray(vao_rule);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_rule);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_rule);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		use_program(program_rule, vao_rule, vbo_rule, ibo_rule);
+		set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	case PIPELINE_MELT:
-		glUseProgram(program_melt);
-		glBindVertexArray(vao_melt);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_melt);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_melt);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		use_program(program_melt, vao_melt, vbo_melt, ibo_melt);
+		set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	default:
 		assert(0);
@@ -1097,50 +1452,683 @@ static void draw_elements_3d(float x1,
 	glBufferData(GL_ARRAY_BUFFER, sizeof(pos), pos, GL_STATIC_DRAW);
 
 	/* Select textures. */
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex1);
-	if (rule_image != NULL) {
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, tex2);
-	}
+	if (rule_image != NULL)
+		bind_texture(GL_TEXTURE1, tex2);
+	bind_texture(GL_TEXTURE0, tex1);
 
 	/* Render primitives. */
 	glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT, 0);
 }
 
-/* Upload a texture. */
-static void update_texture_if_needed(struct image *img)
+/*
+ * Upload a texture.
+ *  - Returns false if the image has no texture to draw, i.e., the
+ *    released pixels cannot be reloaded.
+ */
+static bool update_texture_if_needed(struct image *img)
 {
-	GLuint id;
+	struct image *mip;
+	GLint level;
+	size_t size;
 
 	if (img == NULL)
-		return;
-	if (img->context == reinit_count && !is_after_reinit && !img->need_upload)
-		return;
+		return true;
+
+	mark_texture_drawn(img);
 
-	if (img->context == reinit_count || is_after_reinit || img->texture == NULL) {
+	if (img->context == reinit_count && img->texture != NULL && !img->need_upload)
+		return true;
+
+	/* The content of a render target lives on GPU only. */
+	if (img->is_render_target && img->context == reinit_count && img->texture != NULL)
+		return true;
+
+	/* The queued sprites use the current content. */
+#if defined(USE_INSTANCING)
+	if (img == sprite_image)
+		flush_sprites();
+#endif
+
+	/* Drawn before a queued upload completes. */
+	remove_upload_queue(img);
+
+	/* Reload the pixels of an immutable image if released. */
+	if (!restore_image_pixels(img))
+		return false;
+
+	/* Create or update an OpenGL texture. */
+	bind_texture_for_upload(img);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, img->pixels);
+	size = (size_t)img->width * (size_t)img->height * 4;
+
+	/* Upload the mipmap levels generated on CPU. */
+	level = 1;
+	for (mip = img->mipmap; mip != NULL; mip = mip->mipmap) {
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, mip->width, mip->height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, mip->pixels);
+		size += (size_t)mip->width * (size_t)mip->height * 4;
+		level++;
+	}
+
+	finish_texture_upload(img, size);
+
+	return true;
+}
+
+/* Create a texture if it doesn't exist in the current context, and bind it. */
+static void bind_texture_for_upload(struct image *img)
+{
+	GLuint id;
+
+	if (img->context != reinit_count || img->texture == NULL) {
 		glGenTextures(1, &id);
 		img->texture = (void *)(intptr_t)(id + 1);
+		img->context = reinit_count;
 	} else {
 		id = (GLuint)(intptr_t)img->texture - 1;
 	}
 
-	/* Create or update an OpenGL texture. */
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glBindTexture(GL_TEXTURE_2D, id);
+	bind_texture(GL_TEXTURE0, id);
+	if (img->mipmap != NULL) {
+		/* The levels are complete down to 1x1. */
 #ifdef TARGET_WASM
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 #else
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 #endif
+	} else {
+#ifdef TARGET_WASM
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+#else
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+#endif
+	}
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, img->pixels);
-	glActiveTexture(GL_TEXTURE0);
+}
 
+/* Mark a texture uploaded, and keep the memory budget. */
+static void finish_texture_upload(struct image *img, size_t size)
+{
 	img->need_upload = false;
 	img->context = reinit_count;
+
+	/* Drop the CPU copy of an immutable image. */
+	if (img->reload != NULL)
+		release_image_pixels(img);
+
+	add_resident_texture(img, size);
+	evict_textures_over_budget();
+}
+
+/* Free the least recently drawn textures while over the memory budget. */
+static void evict_textures_over_budget(void)
+{
+	struct image *img;
+	GLuint id;
+
+	while ((img = evict_resident_texture()) != NULL) {
+		/* Uploaded again when drawn next time. */
+		remove_upload_queue(img);
+		id = (GLuint)(intptr_t)img->texture - 1;
+		forget_texture(id);
+		glDeleteTextures(1, &id);
+		img->texture = NULL;
+	}
+}
+
+/* Upload the queued textures within the per-frame budget. */
+static void process_upload_queue(void)
+{
+	struct upload_entry *e;
+	struct image *img;
+	size_t budget, row_size, bytes;
+	int rows;
+
+	budget = get_texture_upload_budget();
+	while (upload_count > 0 && budget > 0) {
+		e = &upload_queue[0];
+		if (!e->is_started && !start_queued_upload(e)) {
+			/* Not uploaded, and the draws skip it until reloaded. */
+			remove_upload_queue(e->img);
+			continue;
+		}
+
+		/* Upload the rows in the budget. (At least one row) */
+		row_size = (size_t)e->level_img->width * 4;
+		rows = e->level_img->height - e->row;
+		if ((size_t)rows * row_size > budget) {
+			rows = (int)(budget / row_size);
+			if (rows == 0)
+				rows = 1;
+		}
+		upload_queued_rows(e, rows);
+		e->row += rows;
+		bytes = (size_t)rows * row_size;
+		budget = bytes < budget ? budget - bytes : 0;
+
+		/* Go to the next level. */
+		if (e->row < e->level_img->height)
+			continue;
+		e->level_img = e->level_img->mipmap;
+		e->level++;
+		e->row = 0;
+		if (e->level_img != NULL)
+			continue;
+
+		/* Completed. It is not evicted in this frame. */
+		img = e->img;
+		bytes = e->size;
+		remove_upload_queue(img);
+		mark_texture_drawn(img);
+		finish_texture_upload(img, bytes);
+	}
+}
+
+/* Allocate the levels of a queued texture. (False if the pixels cannot be reloaded) */
+static bool start_queued_upload(struct upload_entry *e)
+{
+	struct image *img, *mip;
+	GLint level;
+
+	img = e->img;
+	if (!restore_image_pixels(img))
+		return false;
+
+	bind_texture_for_upload(img);
+	level = 0;
+	e->size = 0;
+	for (mip = img; mip != NULL; mip = mip->mipmap) {
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, mip->width, mip->height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		e->size += (size_t)mip->width * (size_t)mip->height * 4;
+		level++;
+	}
+
+	e->is_started = true;
+	e->level_img = img;
+	e->level = 0;
+	e->row = 0;
+
+	return true;
+}
+
+/* Upload rows of a queued texture. */
+static void upload_queued_rows(struct upload_entry *e, int rows)
+{
+	struct image *l;
+	const pixel_t *src;
+	GLuint id;
+
+	l = e->level_img;
+	src = l->pixels + (size_t)e->row * (size_t)l->width;
+
+	id = (GLuint)(intptr_t)e->img->texture - 1;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	bind_texture(GL_TEXTURE0, id);
+
+#if !defined(USE_QT)
+	/* Orphan the previous rows so that the driver doesn't wait for them. */
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)rows * l->width * 4, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)rows * l->width * 4, src);
+	glTexSubImage2D(GL_TEXTURE_2D, e->level, 0, e->row, l->width, rows,
+			GL_RGBA, GL_UNSIGNED_BYTE, (const void *)0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#else
+	glTexSubImage2D(GL_TEXTURE_2D, e->level, 0, e->row, l->width, rows,
+			GL_RGBA, GL_UNSIGNED_BYTE, src);
+#endif
+}
+
+/* Remove an image from the upload queue. */
+static void remove_upload_queue(struct image *img)
+{
+	int i;
+
+	for (i = 0; i < upload_count; i++) {
+		if (upload_queue[i].img == img)
+			break;
+	}
+	if (i == upload_count)
+		return;
+
+	/* Keep the order. */
+	memmove(&upload_queue[i], &upload_queue[i + 1],
+		(size_t)(upload_count - i - 1) * sizeof(struct upload_entry));
+	upload_count--;
+}
+
+#if defined(USE_INSTANCING)
+
+/* Check for OpenGL 3.3 or OpenGL ES 3.0. */
+static bool is_instancing_supported(void)
+{
+	const char *ver;
+	int major, minor;
+	bool is_es;
+
+#if defined(TARGET_LINUX) || defined(TARGET_POSIX)
+	/* Optional API pointers. */
+	if (glDrawArraysInstanced == NULL || glVertexAttribDivisor == NULL)
+		return false;
+#endif
+
+	/* "3.3.0 ..." or "OpenGL ES 3.0 ..." */
+	ver = (const char *)glGetString(GL_VERSION);
+	if (ver == NULL)
+		return false;
+	is_es = strncmp(ver, "OpenGL ES ", 10) == 0;
+	if (is_es)
+		ver += 10;
+
+	major = 0;
+	while (*ver >= '0' && *ver <= '9')
+		major = major * 10 + (*ver++ - '0');
+	minor = 0;
+	if (*ver == '.') {
+		ver++;
+		while (*ver >= '0' && *ver <= '9')
+			minor = minor * 10 + (*ver++ - '0');
+	}
+
+	if (is_es)
+		return major >= 3;
+	return major > 3 || (major == 3 && minor >= 3);
+}
+
+/* Setup the instanced sprite shaders, a VAO and a VBO. */
+static bool setup_sprite_shaders(void)
+{
+	const char *header;
+	const char *src[2];
+	char buf[1024];
+	GLint compiled;
+	int len;
+
+	header = strncmp((const char *)glGetString(GL_VERSION), "OpenGL ES ", 10) == 0 ?
+		sprite_header_es : sprite_header_gl;
+
+	/* Create the vertex shader. */
+	src[0] = header;
+	src[1] = sprite_vertex_shader_src;
+	sprite_vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(sprite_vertex_shader, 2, src, NULL);
+	glCompileShader(sprite_vertex_shader);
+	glGetShaderiv(sprite_vertex_shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled) {
+		log_info("Sprite vertex shader compile error");
+		glGetShaderInfoLog(sprite_vertex_shader, sizeof(buf), &len, &buf[0]);
+		log_info("%s", buf);
+		return false;
+	}
+
+	/* Create the programs. */
+	if (!setup_sprite_program(header,
+				  sprite_fragment_shader_src_normal,
+				  &sprite_fragment_shader_normal,
+				  &sprite_program_normal,
+				  &sprite_screen_loc_normal))
+		return false;
+	if (!setup_sprite_program(header,
+				  sprite_fragment_shader_src_dim,
+				  &sprite_fragment_shader_dim,
+				  &sprite_program_dim,
+				  &sprite_screen_loc_dim))
+		return false;
+
+	/* Create a VAO with per-instance attributes. (Shared by the programs) */
+	glGenVertexArrays(1, &sprite_vao);
+	glBindVertexArray(sprite_vao);
+	glGenBuffers(1, &sprite_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, sprite_vbo);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(struct sprite_instance),
+			      (const GLvoid *)offsetof(struct sprite_instance, dst));
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct sprite_instance),
+			      (const GLvoid *)offsetof(struct sprite_instance, src));
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(struct sprite_instance),
+			      (const GLvoid *)offsetof(struct sprite_instance, alpha));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(0, 1);
+	glVertexAttribDivisor(1, 1);
+	glVertexAttribDivisor(2, 1);
+
+	return true;
+}
+
+/* Setup an instanced sprite program. */
+static bool setup_sprite_program(const char *header,
+				 const char *fshader_src,
+				 GLuint *fshader,
+				 GLuint *prog,
+				 GLint *screen_loc)
+{
+	const char *src[2];
+	char buf[1024];
+	GLint is_succeeded;
+	int len;
+
+	src[0] = header;
+	src[1] = fshader_src;
+	*fshader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(*fshader, 2, src, NULL);
+	glCompileShader(*fshader);
+	glGetShaderiv(*fshader, GL_COMPILE_STATUS, &is_succeeded);
+	if (!is_succeeded) {
+		log_info("Sprite fragment shader compile error");
+		glGetShaderInfoLog(*fshader, sizeof(buf), &len, &buf[0]);
+		log_info("%s", buf);
+		return false;
+	}
+
+	*prog = glCreateProgram();
+	glAttachShader(*prog, sprite_vertex_shader);
+	glAttachShader(*prog, *fshader);
+	glLinkProgram(*prog);
+	glGetProgramiv(*prog, GL_LINK_STATUS, &is_succeeded);
+	if (!is_succeeded) {
+		log_info("Sprite program link error");
+		glGetProgramInfoLog(*prog, sizeof(buf), &len, &buf[0]);
+		log_info("%s", buf);
+		return false;
+	}
+
+	glUseProgram(*prog);
+	glUniform1i(glGetUniformLocation(*prog, "s_texture"), 0);
+	*screen_loc = glGetUniformLocation(*prog, "u_screen");
+
+	return true;
+}
+
+/* Cleanup the instanced sprite shaders. */
+static void cleanup_sprite_shaders(void)
+{
+	if (sprite_vbo != 0) {
+		glDeleteBuffers(1, &sprite_vbo);
+		sprite_vbo = 0;
+	}
+	if (sprite_vao != 0) {
+		glDeleteVertexArrays(1, &sprite_vao);
+		sprite_vao = 0;
+	}
+	if (sprite_program_normal != 0) {
+		glDeleteProgram(sprite_program_normal);
+		sprite_program_normal = 0;
+	}
+	if (sprite_program_dim != 0) {
+		glDeleteProgram(sprite_program_dim);
+		sprite_program_dim = 0;
+	}
+	if (sprite_fragment_shader_normal != 0) {
+		glDeleteShader(sprite_fragment_shader_normal);
+		sprite_fragment_shader_normal = 0;
+	}
+	if (sprite_fragment_shader_dim != 0) {
+		glDeleteShader(sprite_fragment_shader_dim);
+		sprite_fragment_shader_dim = 0;
+	}
+	if (sprite_vertex_shader != 0) {
+		glDeleteShader(sprite_vertex_shader);
+		sprite_vertex_shader = 0;
+	}
+	sprite_count = 0;
+	sprite_image = NULL;
+}
+
+/* Queue a sprite for an instanced draw. */
+static void queue_sprite(int dst_left,
+			 int dst_top,
+			 int dst_width,
+			 int dst_height,
+			 struct image *src_image,
+			 int src_left,
+			 int src_top,
+			 int src_width,
+			 int src_height,
+			 int alpha,
+			 int pipeline)
+{
+	struct sprite_instance *s;
+	float tw, th;
+
+	/* A texture cannot be sampled while being rendered to. */
+	if (target_image != NULL && src_image == target_image)
+		return;
+
+	/* Start a new batch. */
+	if (sprite_count > 0 &&
+	    (src_image != sprite_image ||
+	     pipeline != sprite_pipeline ||
+	     sprite_count == SPRITE_BATCH_SIZE))
+		flush_sprites();
+
+	/* Skip if a released image cannot be reloaded. */
+	if (!update_texture_if_needed(src_image))
+		return;
+	assert(src_image->texture != NULL);
+
+	tw = (float)src_image->width;
+	th = (float)src_image->height;
+
+	s = &sprite_batch[sprite_count++];
+	s->dst[0] = (GLfloat)dst_left;
+	s->dst[1] = (GLfloat)dst_top;
+	s->dst[2] = (GLfloat)dst_width;
+	s->dst[3] = (GLfloat)dst_height;
+	s->src[0] = (GLfloat)src_left / tw;
+	s->src[1] = (GLfloat)src_top / th;
+	s->src[2] = (GLfloat)(src_left + src_width) / tw;
+	s->src[3] = (GLfloat)(src_top + src_height) / th;
+	s->alpha = (GLfloat)alpha / 255.0f;
+
+	sprite_image = src_image;
+	sprite_pipeline = pipeline;
+}
+
+#endif	/* defined(USE_INSTANCING) */
+
+/* Draw the queued sprites. */
+static void flush_sprites(void)
+{
+#if defined(USE_INSTANCING)
+	GLuint tex;
+	GLint screen_loc;
+
+	if (sprite_count == 0)
+		return;
+
+	switch (sprite_pipeline) {
+	case PIPELINE_NORMAL:
+		use_program(sprite_program_normal, sprite_vao, sprite_vbo, 0);
+		screen_loc = sprite_screen_loc_normal;
+		set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		break;
+	case PIPELINE_ADD:
+		use_program(sprite_program_normal, sprite_vao, sprite_vbo, 0);
+		screen_loc = sprite_screen_loc_normal;
+		set_blend_func(GL_ONE, GL_ONE);
+		break;
+	case PIPELINE_DIM:
+		use_program(sprite_program_dim, sprite_vao, sprite_vbo, 0);
+		screen_loc = sprite_screen_loc_dim;
+		set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		break;
+	default:
+		assert(0);
+		return;
+	}
+
+	/* Keep the top row of a render target at t=0 as uploaded images. */
+	glUniform4f(screen_loc,
+		    (float)render_width / 2.0f,
+		    (float)render_height / 2.0f,
+		    target_image != NULL ? 1.0f : -1.0f,
+		    0.0f);
+
+	/* Transfer the instances to an orphaned buffer. */
+	glBufferData(GL_ARRAY_BUFFER,
+		     (GLsizeiptr)(sprite_count * (int)sizeof(struct sprite_instance)),
+		     sprite_batch,
+		     GL_STREAM_DRAW);
+
+	tex = (GLuint)(intptr_t)sprite_image->texture - 1;
+	bind_texture(GL_TEXTURE0, tex);
+
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, sprite_count);
+
+	sprite_count = 0;
+	sprite_image = NULL;
+#endif
+}
+
+/*
+ * Get the counters of the GL state calls.
+ */
+void opengl_get_state_stats(uint64_t *issued, uint64_t *skipped)
+{
+	*issued = state_calls_issued;
+	*skipped = state_calls_skipped;
+}
+
+/* Forget the shadow states. */
+static void invalidate_gl_state(void)
+{
+	int i;
+
+	gl_state.program = STATE_UNKNOWN;
+	gl_state.vao = STATE_UNKNOWN;
+	gl_state.array_buffer = STATE_UNKNOWN;
+	gl_state.element_buffer = STATE_UNKNOWN;
+	gl_state.is_blend_known = false;
+	gl_state.active_texture = 0;
+	for (i = 0; i < TEXTURE_UNITS; i++)
+		gl_state.texture[i] = STATE_UNKNOWN;
+}
+
+/* Bind a program and its vertex objects. (ibo is 0 if not used) */
+static void use_program(GLuint prog, GLuint vao, GLuint vbo, GLuint ibo)
+{
+	if (gl_state.program != prog) {
+		glUseProgram(prog);
+		gl_state.program = prog;
+		state_calls_issued++;
+	} else {
+		state_calls_skipped++;
+	}
+
+	if (gl_state.vao != vao) {
+		glBindVertexArray(vao);
+		gl_state.vao = vao;
+		gl_state.element_buffer = STATE_UNKNOWN;
+		state_calls_issued++;
+	} else {
+		state_calls_skipped++;
+	}
+
+	if (gl_state.array_buffer != vbo) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		gl_state.array_buffer = vbo;
+		state_calls_issued++;
+	} else {
+		state_calls_skipped++;
+	}
+
+	if (ibo != 0) {
+		if (gl_state.element_buffer != ibo) {
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+			gl_state.element_buffer = ibo;
+			state_calls_issued++;
+		} else {
+			state_calls_skipped++;
+		}
+	}
+}
+
+/*
+ * Enable blending with a function.
+ *  - Over a render target, the alpha is accumulated as (1, 1 - src_alpha)
+ *    so that a transparent target keeps its coverage for a later draw
+ */
+static void set_blend_func(GLenum src, GLenum dst)
+{
+	GLenum src_alpha, dst_alpha;
+
+	if (target_image != NULL && src == GL_SRC_ALPHA) {
+		src_alpha = GL_ONE;
+		dst_alpha = GL_ONE_MINUS_SRC_ALPHA;
+	} else {
+		src_alpha = src;
+		dst_alpha = dst;
+	}
+
+	if (!gl_state.is_blend_known) {
+		glEnable(GL_BLEND);
+		glBlendFuncSeparate(src, dst, src_alpha, dst_alpha);
+		gl_state.is_blend_known = true;
+		gl_state.blend_src = src;
+		gl_state.blend_dst = dst;
+		gl_state.blend_src_alpha = src_alpha;
+		gl_state.blend_dst_alpha = dst_alpha;
+		state_calls_issued += 2;
+		return;
+	}
+
+	/* Blending is always enabled once known. */
+	state_calls_skipped++;
+
+	if (gl_state.blend_src != src ||
+	    gl_state.blend_dst != dst ||
+	    gl_state.blend_src_alpha != src_alpha ||
+	    gl_state.blend_dst_alpha != dst_alpha) {
+		glBlendFuncSeparate(src, dst, src_alpha, dst_alpha);
+		gl_state.blend_src = src;
+		gl_state.blend_dst = dst;
+		gl_state.blend_src_alpha = src_alpha;
+		gl_state.blend_dst_alpha = dst_alpha;
+		state_calls_issued++;
+	} else {
+		state_calls_skipped++;
+	}
+}
+
+/* Bind a texture to a texture unit. */
+static void bind_texture(GLenum unit, GLuint tex)
+{
+	int index;
+
+	index = (int)(unit - GL_TEXTURE0);
+	assert(index >= 0 && index < TEXTURE_UNITS);
+
+	if (gl_state.active_texture != unit) {
+		glActiveTexture(unit);
+		gl_state.active_texture = unit;
+		state_calls_issued++;
+	} else {
+		state_calls_skipped++;
+	}
+
+	if (gl_state.texture[index] != tex) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		gl_state.texture[index] = tex;
+		state_calls_issued++;
+	} else {
+		state_calls_skipped++;
+	}
+}
+
+/* Forget a texture to be deleted. (GL rebinds 0 to the units) */
+static void forget_texture(GLuint tex)
+{
+	int i;
+
+	for (i = 0; i < TEXTURE_UNITS; i++) {
+		if (gl_state.texture[i] == tex)
+			gl_state.texture[i] = STATE_UNKNOWN;
+	}
 }
 
 /*
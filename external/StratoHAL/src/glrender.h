@@ -19,6 +19,9 @@ void opengl_start_rendering(void);
 void opengl_end_rendering(void);
 void opengl_notify_image_update(struct image *img);
 void opengl_notify_image_free(struct image *img);
+void opengl_notify_image_prewarm(struct image *img);
+bool opengl_begin_render_target(struct image *img, bool clear);
+void opengl_end_render_target(void);
 
 void
 opengl_render_image_normal(
@@ -107,4 +110,7 @@ opengl_render_image_3d_add(
 
 void opengl_set_screen(int x, int y, int w, int h);
 
+/* Get the counters of the GL state calls issued and skipped as redundant. */
+void opengl_get_state_stats(uint64_t *issued, uint64_t *skipped);
+
 #endif
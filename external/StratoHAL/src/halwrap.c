@@ -233,6 +233,25 @@ void notify_image_free(struct image *img)
 	wrap_notify_image_free(img->id);
 }
 
+void notify_image_prewarm(struct image *img)
+{
+	/* Unity uploads textures by itself. */
+	UNUSED_PARAMETER(img);
+}
+
+bool begin_render_target(struct image *img, bool clear)
+{
+	/* Not supported on Unity. */
+	UNUSED_PARAMETER(img);
+	UNUSED_PARAMETER(clear);
+	log_error("Render targets are not supported.");
+	return false;
+}
+
+void end_render_target(void)
+{
+}
+
 void render_image_normal(int dst_left, int dst_top, int dst_width, int dst_height, struct image *src_img, int src_left, int src_top, int src_width, int src_height, int alpha)
 {
 	if (dst_width == -1)
@@ -340,6 +359,65 @@ bool is_sound_finished(int stream)
 }
 #endif
 
+#if defined(USE_UNITY)
+bool fade_sound(int stream, float vol, int msec)
+{
+	/* Not supported on Unity. The caller sets the volume. */
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(vol);
+	UNUSED_PARAMETER(msec);
+	return false;
+}
+#endif
+
+#if defined(USE_UNITY)
+bool set_sound_pan(int stream, float pan)
+{
+	/* Not supported on Unity. */
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(pan);
+	return false;
+}
+#endif
+
+#if defined(USE_UNITY)
+bool play_sound_effect(struct wave *w, float vol)
+{
+	/* Not supported on Unity. The caller keeps the wave. */
+	UNUSED_PARAMETER(w);
+	UNUSED_PARAMETER(vol);
+	return false;
+}
+#endif
+
+#if defined(USE_UNITY)
+void stop_sound_effects(void)
+{
+}
+#endif
+
+#if defined(USE_UNITY)
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported on Unity. */
+	UNUSED_PARAMETER(msec);
+	UNUSED_PARAMETER(periods);
+	UNUSED_PARAMETER(low_latency);
+}
+
+int get_sound_latency(void)
+{
+	/* Not measured on Unity. */
+	return -1;
+}
+
+void get_sound_stats(struct sound_stats *stats)
+{
+	/* Not measured on Unity. */
+	memset(stats, 0, sizeof(struct sound_stats));
+}
+#endif
+
 bool play_video(const char *fname, bool is_skippable)
 {
 	bool ret;
@@ -445,6 +523,13 @@ bool check_file_exist(const char *file)
 }
 #endif
 
+#if defined(USE_UNITY)
+const char *get_canonical_file_name(const char *file)
+{
+	return file;
+}
+#endif
+
 #if defined(USE_UNITY)
 bool open_rfile(const char *file, struct rfile **rf)
 {
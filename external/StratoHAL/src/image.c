@@ -19,11 +19,38 @@
 #include <malloc.h>	/* _aligned_mallo() */
 #endif
 
+#if !defined(__GNUC__)
+#include <windows.h>	/* InterlockedIncrement() */
+#endif
+
+/* File mapping for pixels. */
+#if defined(TARGET_POSIX) || defined(TARGET_MACOS) || defined(TARGET_IOS)
+#define USE_MAPPED_IMAGE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 /* 512-bit alignment */
 #define ALIGN_BYTES	(64)
 
-/* Texture ID */
-static int id_top;
+/* Texture ID (Taken on the loader threads too.) */
+static volatile int id_top;
+
+/* GPU residency list. (From the most recently drawn) */
+static struct image *resident_head;
+static struct image *resident_tail;
+
+/* Current frame number for residency. */
+static uint64_t texture_frame;
+
+/* GPU texture statistics. */
+static struct texture_stats tex_stats;
+
+/* Bytes of pre-warmed textures uploaded per frame. */
+#define DEFAULT_UPLOAD_BUDGET	(4 * 1024 * 1024)
+static size_t upload_budget = DEFAULT_UPLOAD_BUDGET;
 
 /*
  * SSE Flags
@@ -46,10 +73,14 @@ bool check_draw_image(struct image *dst_image, int *dst_left, int *dst_top,
 		      struct image *src_image, int *width, int *height,
 		      int *src_left, int *src_top, int alpha);
 
+static void free_image(struct image *img);
+static void free_image_pixels(struct image *img);
+static void unlink_resident_texture(struct image *img);
 #if defined(TARGET_WINDOWS)
 static void *wrap_aligned_malloc(size_t size, size_t align);
 static void wrap_aligned_free(void *p);
 #endif
+static int get_next_id(void);
 
 /*
  * Initialization
@@ -59,6 +90,11 @@ static void wrap_aligned_free(void *p);
 void cleanup_image(void)
 {
 	id_top = 0;
+	resident_head = NULL;
+	resident_tail = NULL;
+	texture_frame = 0;
+	memset(&tex_stats, 0, sizeof(tex_stats));
+	upload_budget = DEFAULT_UPLOAD_BUDGET;
 }
 #endif
 
@@ -107,7 +143,7 @@ bool create_image(int w, int h, struct image **img)
 	(*img)->width = w;
 	(*img)->height = h;
 	(*img)->pixels = pixels;
-	(*img)->id = id_top++;
+	(*img)->id = get_next_id();
 
 	return true;
 }
@@ -162,7 +198,77 @@ bool create_image_with_pixels(int w, int h, pixel_t *pixels, struct image **img)
 	(*img)->height = h;
 	(*img)->pixels = pixels;
 	(*img)->no_free = true;
-	(*img)->id = id_top++;
+	(*img)->id = get_next_id();
+
+	return true;
+}
+
+/*
+ * Create an image with pixels stored in a file.
+ *  - The file is mapped privately, so the pixels are writable.
+ *  - "offset" must be a multiple of 64 to keep the pixel alignment.
+ */
+bool create_image_with_mapped_file(const char *path, size_t offset, int w, int h, struct image **img)
+{
+#if defined(USE_MAPPED_IMAGE)
+	struct stat st;
+	size_t size;
+	void *addr;
+	int fd;
+
+	assert(w > 0 && h > 0);
+	assert(offset % ALIGN_BYTES == 0);
+	assert(img != NULL);
+
+	/* Open the file and check the size. */
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	size = offset + (size_t)w * (size_t)h * sizeof(pixel_t);
+	if ((size_t)st.st_size < size) {
+		close(fd);
+		return false;
+	}
+
+	/* Map the file. */
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return false;
+
+	/* Create an image that doesn't own the pixels. */
+	if (!create_image_with_pixels(w, h, (pixel_t *)((char *)addr + offset), img)) {
+		munmap(addr, size);
+		return false;
+	}
+	(*img)->mapping = addr;
+	(*img)->mapping_size = size;
+
+	return true;
+#else
+	UNUSED_PARAMETER(path);
+	UNUSED_PARAMETER(offset);
+	UNUSED_PARAMETER(w);
+	UNUSED_PARAMETER(h);
+	UNUSED_PARAMETER(img);
+	return false;
+#endif
+}
+
+/*
+ * Create a transparent image to be used as a render target.
+ */
+bool create_render_target_image(int w, int h, struct image **img)
+{
+	if (!create_image(w, h, img))
+		return false;
+
+	clear_image(*img, 0);
+	(*img)->is_render_target = true;
 
 	return true;
 }
@@ -174,23 +280,412 @@ void destroy_image(struct image *img)
 {
 	assert(img != NULL);
 	assert(img->width > 0 && img->height > 0);
-	assert(img->pixels != NULL);
+	assert(img->pixels != NULL || img->reload != NULL);
 
 	/* Free a texture. */
 	notify_image_free(img);
+	remove_resident_texture(img);
+
+	free_image(img);
+}
+
+/*
+ * Destroy an image that has not been passed to the renderer.
+ *  - This doesn't touch the renderer state, so it can be called on
+ *    a worker thread.
+ */
+void destroy_decoded_image(struct image *img)
+{
+	assert(img != NULL);
+
+	free_image(img);
+}
+
+/*
+ * Create mipmap levels of an image.
+ *  - Each level is the half size of the previous one, down to 1x1.
+ *  - Existing levels are replaced.
+ */
+bool create_image_mipmaps(struct image *img)
+{
+	struct image *src, *dst;
+	int w, h;
+
+	assert(img != NULL);
+
+	destroy_image_mipmaps(img);
+
+	src = img;
+	while (src->width > 1 || src->height > 1) {
+		w = src->width > 1 ? src->width / 2 : 1;
+		h = src->height > 1 ? src->height / 2 : 1;
+		if (!create_image(w, h, &dst)) {
+			destroy_image_mipmaps(img);
+			return false;
+		}
+		draw_image_half(dst, src);
+		src->mipmap = dst;
+		src = dst;
+	}
+
+	return true;
+}
+
+/*
+ * Destroy mipmap levels of an image.
+ *  - The levels don't have textures, and are freed without notifications.
+ */
+void destroy_image_mipmaps(struct image *img)
+{
+	struct image *level, *next;
+
+	assert(img != NULL);
+
+	level = img->mipmap;
+	while (level != NULL) {
+		next = level->mipmap;
+		level->mipmap = NULL;
+		free_image(level);
+		level = next;
+	}
+	img->mipmap = NULL;
+}
+
+/*
+ * Build the alpha map of an image.
+ *  - Each row is split into segments of IMAGE_ALPHA_SEG pixels, and
+ *    a segment is classified as opaque, clear, or mixed.
+ *  - draw_image_alpha() copies opaque segments and skips clear ones.
+ */
+bool build_image_alpha_map(struct image *img)
+{
+	pixel_t *p;
+	uint32_t a, all_and, all_or;
+	int stride, x, y, seg, end;
+
+	assert(img != NULL);
+	assert(img->pixels != NULL);
+
+	stride = (img->width + IMAGE_ALPHA_SEG - 1) >> IMAGE_ALPHA_SEG_SHIFT;
+
+	if (img->alpha_map == NULL) {
+		img->alpha_map = malloc((size_t)stride * (size_t)img->height);
+		if (img->alpha_map == NULL) {
+			log_out_of_memory();
+			return false;
+		}
+	}
+
+	p = img->pixels;
+	for (y = 0; y < img->height; y++) {
+		for (seg = 0; seg < stride; seg++) {
+			end = (seg + 1) << IMAGE_ALPHA_SEG_SHIFT;
+			if (end > img->width)
+				end = img->width;
+
+			all_and = 0xff;
+			all_or = 0;
+			for (x = seg << IMAGE_ALPHA_SEG_SHIFT; x < end; x++) {
+				a = get_pixel_a(*p++);
+				all_and &= a;
+				all_or |= a;
+			}
+
+			if (all_and == 0xff)
+				img->alpha_map[stride * y + seg] = IMAGE_ALPHA_OPAQUE;
+			else if (all_or == 0)
+				img->alpha_map[stride * y + seg] = IMAGE_ALPHA_CLEAR;
+			else
+				img->alpha_map[stride * y + seg] = IMAGE_ALPHA_MIXED;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Drop the alpha map of an image.
+ */
+void invalidate_image_alpha_map(struct image *img)
+{
+	assert(img != NULL);
+
+	if (img->alpha_map != NULL) {
+		free(img->alpha_map);
+		img->alpha_map = NULL;
+	}
+}
+
+/*
+ * Release the pixels of an immutable image.
+ *  - This is called by a GPU renderer after uploading the texture.
+ *  - The size and the texture are kept, and restore_image_pixels()
+ *    brings the pixels back when the texture needs to be uploaded again.
+ */
+void release_image_pixels(struct image *img)
+{
+	assert(img != NULL);
+	assert(img->reload != NULL);
+
+	free_image_pixels(img);
+}
+
+/*
+ * Restore the released pixels of an immutable image.
+ *  - The reload callback loads the source again as a new image, and
+ *    its pixels and mipmap levels are moved to the image.
+ */
+bool restore_image_pixels(struct image *img)
+{
+	struct image *src;
+
+	assert(img != NULL);
+
+	if (img->pixels != NULL)
+		return true;
+	if (img->reload == NULL)
+		return false;
+
+	if (!img->reload(img, &src))
+		return false;
+	if (src->width != img->width || src->height != img->height) {
+		log_error("Reloaded image size mismatch.");
+		free_image(src);
+		return false;
+	}
+
+	img->pixels = src->pixels;
+	img->no_free = src->no_free;
+	img->mapping = src->mapping;
+	img->mapping_size = src->mapping_size;
+	img->mipmap = src->mipmap;
+
+	/* The source never had a texture. */
+	free(src);
+
+	return true;
+}
+
+/* Take a new texture ID atomically, since images are created on the loader threads. */
+static int get_next_id(void)
+{
+#if defined(__GNUC__)
+	return __atomic_fetch_add(&id_top, 1, __ATOMIC_RELAXED);
+#else
+	return (int)InterlockedIncrement((volatile LONG *)&id_top) - 1;
+#endif
+}
+
+/* Free the pixels, the mipmap levels, and the struct of an image. */
+static void free_image(struct image *img)
+{
+	free_image_pixels(img);
+
+	/* Free an alpha map. (Kept while the pixels are released.) */
+	invalidate_image_alpha_map(img);
+
+	/* Free a struct buffer. */
+	free(img);
+}
+
+/* Free the pixels and the mipmap levels of an image. */
+static void free_image_pixels(struct image *img)
+{
+	/* Free the mipmap levels. */
+	if (img->mipmap != NULL)
+		destroy_image_mipmaps(img);
 
 	/* Free a pixel buffer. */
-	if (!img->no_free) {
+	if (!img->no_free && img->pixels != NULL) {
 #if defined(TARGET_WINDOWS)
 		wrap_aligned_free(img->pixels);
 #else
 		free(img->pixels);
 #endif
 	}
+#if defined(USE_MAPPED_IMAGE)
+	if (img->mapping != NULL)
+		munmap(img->mapping, img->mapping_size);
+#endif
 	img->pixels = NULL;
+	img->no_free = false;
+	img->mapping = NULL;
+	img->mapping_size = 0;
+}
 
-	/* Free a struct buffer. */
-	free(img);
+/*
+ * GPU Texture Residency
+ */
+
+/*
+ * Set the GPU texture memory budget in bytes. (0 for unlimited)
+ */
+void set_texture_budget(size_t bytes)
+{
+	tex_stats.budget = bytes;
+}
+
+/*
+ * Get the GPU texture statistics.
+ */
+void get_texture_stats(struct texture_stats *stats)
+{
+	*stats = tex_stats;
+}
+
+/*
+ * Set the bytes of pre-warmed textures uploaded per frame.
+ */
+void set_texture_upload_budget(size_t bytes)
+{
+	upload_budget = bytes;
+}
+
+/*
+ * Get the bytes of pre-warmed textures uploaded per frame.
+ */
+size_t get_texture_upload_budget(void)
+{
+	return upload_budget;
+}
+
+/*
+ * Start a frame.
+ *  - Textures drawn in the current frame are not evicted.
+ */
+void begin_texture_frame(void)
+{
+	texture_frame++;
+}
+
+/*
+ * Mark an image drawn in the current frame.
+ */
+void mark_texture_drawn(struct image *img)
+{
+	img->draw_frame = texture_frame;
+
+	/* Move to the head of the LRU list. */
+	if (img->is_resident && resident_head != img) {
+		unlink_resident_texture(img);
+		img->resident_next = resident_head;
+		if (resident_head != NULL)
+			resident_head->resident_prev = img;
+		resident_head = img;
+		if (resident_tail == NULL)
+			resident_tail = img;
+	}
+}
+
+/*
+ * Add an image uploaded to GPU.
+ *  - The size includes the mipmap levels.
+ *  - Re-uploads of a resident image update the size.
+ */
+void add_resident_texture(struct image *img, size_t size)
+{
+	tex_stats.uploads++;
+	tex_stats.upload_bytes += size;
+
+	if (img->is_resident) {
+		tex_stats.resident_bytes -= img->resident_size;
+		tex_stats.resident_bytes += size;
+		img->resident_size = size;
+		return;
+	}
+
+	img->is_resident = true;
+	img->resident_size = size;
+	img->resident_prev = NULL;
+	img->resident_next = resident_head;
+	if (resident_head != NULL)
+		resident_head->resident_prev = img;
+	resident_head = img;
+	if (resident_tail == NULL)
+		resident_tail = img;
+
+	tex_stats.resident_count++;
+	tex_stats.resident_bytes += size;
+}
+
+/*
+ * Remove an image from GPU residency. (Called when a texture is freed.)
+ */
+void remove_resident_texture(struct image *img)
+{
+	if (!img->is_resident)
+		return;
+
+	unlink_resident_texture(img);
+	img->is_resident = false;
+
+	tex_stats.resident_count--;
+	tex_stats.resident_bytes -= img->resident_size;
+	img->resident_size = 0;
+}
+
+/*
+ * Pick the least recently drawn image to evict if over the budget.
+ *  - Render targets are skipped.
+ *  - The image is removed from residency, and the renderer must free
+ *    its texture. It is uploaded again when drawn next time.
+ *  - Returns NULL if within the budget, or if all resident textures are
+ *    drawn in the current frame.
+ */
+struct image *evict_resident_texture(void)
+{
+	struct image *img;
+
+	if (tex_stats.budget == 0 || tex_stats.resident_bytes <= tex_stats.budget)
+		return NULL;
+
+	/* Render targets have no other copy of the content. */
+	img = resident_tail;
+	while (img != NULL && img->is_render_target)
+		img = img->resident_prev;
+	if (img == NULL || img->draw_frame == texture_frame)
+		return NULL;
+
+	remove_resident_texture(img);
+	tex_stats.evictions++;
+
+	return img;
+}
+
+/*
+ * Forget all resident textures. (Called when a graphics context is lost.)
+ */
+void reset_resident_textures(void)
+{
+	struct image *img, *next;
+
+	for (img = resident_head; img != NULL; img = next) {
+		next = img->resident_next;
+		img->resident_prev = NULL;
+		img->resident_next = NULL;
+		img->resident_size = 0;
+		img->is_resident = false;
+	}
+	resident_head = NULL;
+	resident_tail = NULL;
+
+	tex_stats.resident_count = 0;
+	tex_stats.resident_bytes = 0;
+}
+
+/* Unlink an image from the LRU list. */
+static void unlink_resident_texture(struct image *img)
+{
+	if (img->resident_prev != NULL)
+		img->resident_prev->resident_next = img->resident_next;
+	else
+		resident_head = img->resident_next;
+	if (img->resident_next != NULL)
+		img->resident_next->resident_prev = img->resident_prev;
+	else
+		resident_tail = img->resident_prev;
+	img->resident_prev = NULL;
+	img->resident_next = NULL;
 }
 
 /*
@@ -235,6 +730,9 @@ void clear_image_rect(struct image *img, int x, int y, int w, int h, pixel_t col
 		for (j = x; j < x + w; j++)
 			pixels[img->width * i + j] = color;
 
+	/* The alpha map is no longer valid. */
+	invalidate_image_alpha_map(img);
+
 	/* Request a texture update. */
 	notify_image_update(img);
 }
@@ -256,6 +754,9 @@ void fill_image_alpha(struct image *img)
 			p++;
 		}
 	}
+
+	/* The alpha map is no longer valid. */
+	invalidate_image_alpha_map(img);
 }
 
 /*
@@ -274,6 +775,8 @@ void fill_image_alpha(struct image *img)
 #define DRAW_IMAGE_DIM		draw_image_dim
 #define DRAW_IMAGE_RULE		draw_image_rule
 #define DRAW_IMAGE_MELT		draw_image_melt
+#define DRAW_IMAGE_SCALE	draw_image_scale
+#define DRAW_IMAGE_HALF		draw_image_half
 #include "drawimage.h"
 
 #else
@@ -597,6 +1100,40 @@ void draw_image_scale(struct image *dst_image,
 		
 }
 
+void draw_image_half(struct image *dst_image,
+		     struct image *src_image)
+{
+	void draw_image_half_avx2(struct image *, struct image *);
+	void draw_image_half_avx(struct image *, struct image *);
+	void draw_image_half_sse42(struct image *, struct image *);
+	void draw_image_half_sse4(struct image *, struct image *);
+	void draw_image_half_sse3(struct image *, struct image *);
+	void draw_image_half_sse2(struct image *, struct image *);
+	void draw_image_half_sse(struct image *, struct image *);
+	void draw_image_half_scalar(struct image *, struct image *);
+
+	if (is_avx2_available)
+		draw_image_half_avx2(dst_image, src_image);
+	else if (is_avx_available)
+		draw_image_half_avx(dst_image, src_image);
+#if !defined(_MSC_VER)
+	else if (is_sse42_available)
+		draw_image_half_sse42(dst_image, src_image);
+	else if (is_sse4_available)
+		draw_image_half_sse4(dst_image, src_image);
+	else if (is_sse3_available)
+		draw_image_half_sse3(dst_image, src_image);
+#endif
+	else if (is_sse2_available)
+		draw_image_half_sse2(dst_image, src_image);
+#if !defined(_MSC_VER) && defined(ARCH_X86)
+	else if (is_sse_available)
+		draw_image_half_sse(dst_image, src_image);
+#endif
+	else
+		draw_image_half_scalar(dst_image, src_image);
+}
+
 #endif
 
 /*
@@ -790,6 +1327,185 @@ static void wrap_aligned_free(void *p)
 }
 #endif
 
+/*
+ * Image Files
+ */
+
+/* Size of a chunk read from a file stream. */
+#define STREAM_BUF_SIZE		(4096)
+
+/* A file stream that replays the magic bytes read to detect the format. */
+struct image_stream {
+	struct rfile *rf;
+	uint8_t head[12];
+	size_t head_size;
+	size_t head_pos;
+};
+
+static size_t read_image_stream(struct image_stream *st, void *buf, size_t size);
+static bool decode_png_stream(struct image_stream *st, int scale, struct image **img);
+static bool decode_jpeg_stream(struct image_stream *st, int scale, struct image **img);
+static bool decode_webp_stream(struct image_stream *st, int scale, struct image **img);
+static void add_box_row(uint32_t *acc, const uint8_t *src, int width, int scale);
+static void store_box_row(uint32_t *acc, uint8_t *dst, int width, int scale, int rows);
+
+/*
+ * Create an image with a PNG, JPEG, or WebP file.
+ *  - The decoder is selected by the magic bytes.
+ */
+bool create_image_with_data(const uint8_t *data, size_t size, struct image **img)
+{
+	/* PNG: "\x89PNG" */
+	if (size >= 8 &&
+	    data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G')
+		return create_image_with_png(data, size, img);
+
+	/* JPEG: SOI marker */
+	if (size >= 3 &&
+	    data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+		return create_image_with_jpeg(data, size, img);
+
+	/* WebP: "RIFF....WEBP" */
+	if (size >= 12 &&
+	    memcmp(data, "RIFF", 4) == 0 &&
+	    memcmp(data + 8, "WEBP", 4) == 0)
+		return create_image_with_webp(data, size, img);
+
+	/* Unknown format. */
+	return false;
+}
+
+/*
+ * Create an image with a PNG, JPEG, or WebP file stream.
+ *  - Compressed bytes are read as the decoder needs them, and rows are
+ *    decoded into the image, so the whole file is not kept in memory.
+ *  - The image is reduced to 1/scale at decode time. (1, 2, 4, or 8)
+ */
+bool create_image_with_rfile(struct rfile *rf, int scale, struct image **img)
+{
+	struct image_stream st;
+	const uint8_t *h;
+
+	*img = NULL;
+
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+		return false;
+
+	/* Read the magic bytes. (They are replayed to the decoder.) */
+	st.rf = rf;
+	st.head_size = 0;
+	st.head_pos = 0;
+	if (!read_rfile(rf, st.head, sizeof(st.head), &st.head_size))
+		return false;
+	h = st.head;
+
+	/* PNG: "\x89PNG" */
+	if (st.head_size >= 8 &&
+	    h[0] == 0x89 && h[1] == 'P' && h[2] == 'N' && h[3] == 'G')
+		return decode_png_stream(&st, scale, img);
+
+	/* JPEG: SOI marker */
+	if (st.head_size >= 3 &&
+	    h[0] == 0xff && h[1] == 0xd8 && h[2] == 0xff)
+		return decode_jpeg_stream(&st, scale, img);
+
+	/* WebP: "RIFF....WEBP" */
+	if (st.head_size >= 12 &&
+	    memcmp(h, "RIFF", 4) == 0 &&
+	    memcmp(h + 8, "WEBP", 4) == 0)
+		return decode_webp_stream(&st, scale, img);
+
+	/* Unknown format. */
+	return false;
+}
+
+/* Read from an image stream. (Returns 0 at the end of the file.) */
+static size_t read_image_stream(struct image_stream *st, void *buf, size_t size)
+{
+	uint8_t *dst;
+	size_t len, ret;
+
+	dst = buf;
+
+	/* Replay the magic bytes first. */
+	len = st->head_size - st->head_pos;
+	if (len > size)
+		len = size;
+	memcpy(dst, st->head + st->head_pos, len);
+	st->head_pos += len;
+
+	/* Then read from the file. */
+	if (len < size) {
+		if (!read_rfile(st->rf, dst + len, size - len, &ret))
+			ret = 0;
+		len += ret;
+	}
+
+	return len;
+}
+
+/*
+ * Box Filter
+ *  - Reduces PNG rows at decode time. (JPEG and WebP decoders scale by
+ *    themselves.)
+ *  - Colors are weighted by alpha so that transparent pixels don't
+ *    darken the edges.
+ */
+
+/* Add a row of 4-byte pixels to the accumulators of the reduced row. */
+static void add_box_row(uint32_t *acc, const uint8_t *src, int width, int scale)
+{
+	uint32_t a;
+	int x;
+
+	for (x = 0; x < width; x++) {
+		a = src[3];
+		acc[0] += src[0] * a;
+		acc[1] += src[1] * a;
+		acc[2] += src[2] * a;
+		acc[3] += a;
+		src += 4;
+		if ((x + 1) % scale == 0)
+			acc += 4;
+	}
+}
+
+/* Store the averages of the accumulators to a reduced row, and clear them. */
+static void store_box_row(uint32_t *acc, uint8_t *dst, int width, int scale, int rows)
+{
+	uint32_t n, a;
+	int dst_width, x, w;
+
+	dst_width = (width + scale - 1) / scale;
+	for (x = 0; x < dst_width; x++) {
+		/* The last box may be narrower. */
+		w = width - x * scale;
+		if (w > scale)
+			w = scale;
+		n = (uint32_t)(w * rows);
+
+		a = acc[3];
+		if (a == 0) {
+			dst[0] = 0;
+			dst[1] = 0;
+			dst[2] = 0;
+			dst[3] = 0;
+		} else {
+			dst[0] = (uint8_t)((acc[0] + a / 2) / a);
+			dst[1] = (uint8_t)((acc[1] + a / 2) / a);
+			dst[2] = (uint8_t)((acc[2] + a / 2) / a);
+			dst[3] = (uint8_t)((a + n / 2) / n);
+		}
+
+		acc[0] = 0;
+		acc[1] = 0;
+		acc[2] = 0;
+		acc[3] = 0;
+		acc += 4;
+		dst += 4;
+	}
+}
+
 /*
  * PNG
  */
@@ -810,22 +1526,19 @@ struct png_reader {
 	size_t pos;
 };
 
+static bool decode_png(png_rw_ptr read_fn, void *io, int scale, struct image **img);
 static void png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len);
+static void png_stream_callback(png_structp png_ptr, png_bytep buf, png_size_t len);
 
 /*
  * Create an image with a PNG file.
+ *  - Rows are decoded directly into the image pixels.
  */
 bool create_image_with_png(const uint8_t *data, size_t size, struct image **img)
 {
 	struct png_reader reader;
-	png_structp png_ptr;
-	png_byte color_type, bit_depth;
-	png_infop info_ptr;
-	png_bytep *rows;
-	int width;
-	int height;
-	int y;
-	pixel_t *pixels;
+
+	*img = NULL;
 
 	/* Check a signature. */
 	if (size < 8)
@@ -833,6 +1546,36 @@ bool create_image_with_png(const uint8_t *data, size_t size, struct image **img)
 	if (png_sig_cmp(data, 0, 8) != 0)
 		return false;
 
+	reader.data = data;
+	reader.size = size;
+	reader.pos = 0;
+
+	return decode_png(png_read_callback, &reader, 1, img);
+}
+
+/* Decode a PNG file stream. */
+static bool decode_png_stream(struct image_stream *st, int scale, struct image **img)
+{
+	return decode_png(png_stream_callback, st, scale, img);
+}
+
+/* Decode a PNG image. */
+static bool decode_png(png_rw_ptr read_fn, void *io, int scale, struct image **img)
+{
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_byte color_type, bit_depth;
+	struct image *volatile full;
+	uint8_t *volatile line;
+	uint32_t *volatile acc;
+	struct image *tmp;
+	uint8_t *row;
+	int width, height;
+	int dst_width, dst_height;
+	int passes, pass, rows, y;
+
+	*img = NULL;
+
 	/* Create a png read struct. */
 	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (png_ptr == NULL)
@@ -846,24 +1589,24 @@ bool create_image_with_png(const uint8_t *data, size_t size, struct image **img)
 	}
 
 	/* Return here if failed. */
-	rows = NULL;
+	full = NULL;
+	line = NULL;
+	acc = NULL;
 	if (setjmp(png_jmpbuf(png_ptr))) {
 		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 		if (*img != NULL) {
-			destroy_image(*img);
+			destroy_decoded_image(*img);
 			*img = NULL;
 		}
-		if (rows != NULL)
-			free(rows);
+		if (full != NULL)
+			destroy_decoded_image(full);
+		free(line);
+		free(acc);
 		return false;
 	}
 
 	/* Read a header. */
-	reader.data = data + 8;
-	reader.size = size;
-	reader.pos = 0;
-	png_set_read_fn(png_ptr, &reader, png_read_callback);
-	png_set_sig_bytes(png_ptr, 8);
+	png_set_read_fn(png_ptr, io, read_fn);
 	png_read_info(png_ptr, info_ptr);
 
 	/* Get metrics. */
@@ -872,75 +1615,116 @@ bool create_image_with_png(const uint8_t *data, size_t size, struct image **img)
 	color_type = png_get_color_type(png_ptr, info_ptr);
 	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
 
-	/* Convert palette to RGBA. */
-	switch(color_type) {
-	case PNG_COLOR_TYPE_GRAY:
-		png_set_gray_to_rgb(png_ptr);
-		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-		png_read_update_info(png_ptr, info_ptr);
-		break;
-	case PNG_COLOR_TYPE_PALETTE:
-#if !defined(ORDER_OPENGL)
-		png_set_bgr(png_ptr);
-#endif
+	/* Convert to 8-bit RGBA in the engine byte order. */
+	if (color_type == PNG_COLOR_TYPE_PALETTE)
 		png_set_palette_to_rgb(png_ptr);
-		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-		png_read_update_info(png_ptr, info_ptr);
-		break;
-	case PNG_COLOR_TYPE_RGB:
-#if !defined(ORDER_OPENGL)
-		png_set_bgr(png_ptr);
-#endif
-		if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
-			png_set_tRNS_to_alpha(png_ptr);
-		} else {
-			png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-			png_read_update_info(png_ptr, info_ptr);
-		}
-		break;
-	case PNG_COLOR_TYPE_RGB_ALPHA:
+	if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+		png_set_expand_gray_1_2_4_to_8(png_ptr);
+	if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+		png_set_tRNS_to_alpha(png_ptr);
+	if (bit_depth == 16)
+		png_set_strip_16(png_ptr);
+	if (color_type == PNG_COLOR_TYPE_GRAY ||
+	    color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(png_ptr);
+	if (!(color_type & PNG_COLOR_MASK_ALPHA))
+		png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
 #if !defined(ORDER_OPENGL)
-		png_set_bgr(png_ptr);
+	png_set_bgr(png_ptr);
 #endif
-		break;
-	case PNG_COLOR_TYPE_GRAY_ALPHA:
-		png_set_gray_to_rgb(png_ptr);
-		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-		png_read_update_info(png_ptr, info_ptr);
-		break;
-	default:
+	passes = png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+	if (png_get_rowbytes(png_ptr, info_ptr) != (size_t)width * 4) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 		return false;
 	}
 
-	/* 16-bit to 8-bit. */
-	if (bit_depth == 16)
-		png_set_strip_16(png_ptr);
-
-	/* Allocate an image. */
-	if (!create_image(width, height, img))
-		return false;
+	/* Without a reduction, decode rows directly into the image. */
+	if (scale == 1) {
+		if (!create_image(width, height, img)) {
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			return false;
+		}
+		for (pass = 0; pass < passes; pass++) {
+			for (y = 0; y < height; y++) {
+				row = (uint8_t *)&(*img)->pixels[width * y];
+				png_read_row(png_ptr, row, NULL);
+			}
+		}
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return true;
+	}
 
-	/* Allocate a rows buffer. */
-	rows = malloc(sizeof(png_bytep) * (size_t)height);
-	if (rows == NULL) {
-		destroy_image(*img);
+	/* Allocate the reduced image and the accumulators. */
+	dst_width = (width + scale - 1) / scale;
+	dst_height = (height + scale - 1) / scale;
+	acc = calloc((size_t)dst_width * 4, sizeof(uint32_t));
+	if (acc == NULL) {
 		log_out_of_memory();
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
+	if (!create_image(dst_width, dst_height, img)) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		free(acc);
 		return false;
 	}
-	assert(png_get_rowbytes(png_ptr, info_ptr) == (size_t)(width*4));
 
-	/* Read an image. */
-#ifdef _MSC_VER
-#pragma warning(disable:6386)
-#endif
-	pixels = (*img)->pixels;
-	for (y = 0; y < height; y++)
-		rows[y] = (png_bytep)&pixels[width * y];
-	png_read_image(png_ptr, rows);
+	if (passes > 1) {
+		/* An interlaced image needs all passes before reducing. */
+		if (!create_image(width, height, &tmp)) {
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			destroy_decoded_image(*img);
+			*img = NULL;
+			free(acc);
+			return false;
+		}
+		full = tmp;
+		for (pass = 0; pass < passes; pass++) {
+			for (y = 0; y < height; y++) {
+				row = (uint8_t *)&full->pixels[width * y];
+				png_read_row(png_ptr, row, NULL);
+			}
+		}
+	} else {
+		/* Otherwise, only one source row is kept. */
+		line = malloc((size_t)width * 4);
+		if (line == NULL) {
+			log_out_of_memory();
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			destroy_decoded_image(*img);
+			*img = NULL;
+			free(acc);
+			return false;
+		}
+	}
+
+	/* Reduce rows. */
+	rows = 0;
+	for (y = 0; y < height; y++) {
+		if (full != NULL) {
+			row = (uint8_t *)&full->pixels[width * y];
+		} else {
+			row = line;
+			png_read_row(png_ptr, row, NULL);
+		}
+		add_box_row(acc, row, width, scale);
+		if (++rows == scale || y == height - 1) {
+			store_box_row(acc,
+				      (uint8_t *)&(*img)->pixels[dst_width * (y / scale)],
+				      width,
+				      scale,
+				      rows);
+			rows = 0;
+		}
+	}
 
 	/* Cleanup. */
 	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-	free(rows);
+	if (full != NULL)
+		destroy_decoded_image(full);
+	free(line);
+	free(acc);
 
 	return true;
 }
@@ -951,14 +1735,26 @@ static void png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len
 
 	reader = png_get_io_ptr(png_ptr);
 
+	/* Truncated. */
 	if (reader->pos + len > reader->size)
-		len = reader->size - reader->pos;
+		png_error(png_ptr, "Unexpected end of data.");
 
 	memcpy(buf, reader->data + reader->pos, len);
 
 	reader->pos += len;
 }
 
+static void png_stream_callback(png_structp png_ptr, png_bytep buf, png_size_t len)
+{
+	struct image_stream *st;
+
+	st = png_get_io_ptr(png_ptr);
+
+	/* Truncated. */
+	if (read_image_stream(st, buf, len) != len)
+		png_error(png_ptr, "Unexpected end of file.");
+}
+
 /*
  * JPEG
  */
@@ -970,31 +1766,109 @@ static void png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len
 #else
 #include <jpeg/jpeglib.h>
 #endif
+#include <setjmp.h>
+
+/* Error manager that returns to the decoder instead of exit(). */
+struct jpeg_error_jmp {
+	struct jpeg_error_mgr pub;
+	jmp_buf jmp;
+};
+
+/* Source manager that reads from an image stream. */
+struct jpeg_stream_src {
+	struct jpeg_source_mgr pub;
+	struct image_stream *st;
+	JOCTET buf[STREAM_BUF_SIZE];
+};
+
+static bool decode_jpeg(struct image_stream *st, const uint8_t *data, size_t size, int scale, struct image **img);
+static void jpeg_error_exit(j_common_ptr cinfo);
+static void jpeg_stream_init(j_decompress_ptr cinfo);
+static boolean jpeg_stream_fill(j_decompress_ptr cinfo);
+static void jpeg_stream_skip(j_decompress_ptr cinfo, long num_bytes);
+static void jpeg_stream_term(j_decompress_ptr cinfo);
 
 /*
  * Create an image with a JPEG file.
+ *  - Scanlines are decoded directly into the image pixels.
  */
 bool create_image_with_jpeg(const uint8_t *data, size_t size, struct image **img)
+{
+	return decode_jpeg(NULL, data, size, 1, img);
+}
+
+/* Decode a JPEG file stream. */
+static bool decode_jpeg_stream(struct image_stream *st, int scale, struct image **img)
+{
+	return decode_jpeg(st, NULL, 0, scale, img);
+}
+
+/* Decode a JPEG image from a stream or a memory. */
+static bool decode_jpeg(struct image_stream *st, const uint8_t *data, size_t size, int scale, struct image **img)
 {
 	struct jpeg_decompress_struct jpeg;
-	struct jpeg_error_mgr jerr;
-	pixel_t *p;
-	unsigned char *line;
-	unsigned int width, height, x, y;
-	int components;
+	struct jpeg_error_jmp jerr;
+	struct jpeg_stream_src src;
+	JSAMPROW row;
+	unsigned int width, height, y;
+#if !defined(JCS_EXTENSIONS)
+	unsigned char *s, *dst;
+	unsigned char r, g, b;
+	unsigned int x;
+#endif
+
+	*img = NULL;
+
+	/* Return here if failed. */
+	jpeg.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = jpeg_error_exit;
+	if (setjmp(jerr.jmp)) {
+		jpeg_destroy_decompress(&jpeg);
+		if (*img != NULL) {
+			destroy_decoded_image(*img);
+			*img = NULL;
+		}
+		return false;
+	}
 
 	/* Start decoding. */
 	jpeg_create_decompress(&jpeg);
-	jpeg_mem_src(&jpeg, data, size);
-	jpeg.err = jpeg_std_error(&jerr);
+	if (st != NULL) {
+		src.pub.init_source = jpeg_stream_init;
+		src.pub.fill_input_buffer = jpeg_stream_fill;
+		src.pub.skip_input_data = jpeg_stream_skip;
+		src.pub.resync_to_restart = jpeg_resync_to_restart;
+		src.pub.term_source = jpeg_stream_term;
+		src.pub.next_input_byte = NULL;
+		src.pub.bytes_in_buffer = 0;
+		src.st = st;
+		jpeg.src = &src.pub;
+	} else {
+		jpeg_mem_src(&jpeg, (unsigned char *)data, (unsigned long)size);
+	}
 	jpeg_read_header(&jpeg, TRUE);
+#if defined(JCS_EXTENSIONS)
+	/* libjpeg-turbo outputs 4 bytes per pixel in the engine order. */
+#if defined(ORDER_OPENGL)
+	jpeg.out_color_space = JCS_EXT_RGBA;
+#else
+	jpeg.out_color_space = JCS_EXT_BGRA;
+#endif
+#else
+	jpeg.out_color_space = JCS_RGB;
+#endif
+	jpeg.scale_num = 1;
+	jpeg.scale_denom = (unsigned int)scale;
 	jpeg_start_decompress(&jpeg);
 
-	/* Get metrics. */
+	/* Get metrics. (Already reduced by the IDCT scaling.) */
 	width = jpeg.output_width;
 	height = jpeg.output_height;
-	components = jpeg.out_color_components;
-	if (components != 3) {
+#if defined(JCS_EXTENSIONS)
+	if (jpeg.output_components != 4) {
+#else
+	if (jpeg.output_components != 3) {
+#endif
 		jpeg_destroy_decompress(&jpeg);
 		return false;
 	}
@@ -1005,41 +1879,97 @@ bool create_image_with_jpeg(const uint8_t *data, size_t size, struct image **img
 		return false;
 	}
 
-	/* Allocate a line buffer. */
-	line = malloc(width * height * 3);
-	if (line == NULL) {
-		log_out_of_memory();
-		jpeg_destroy_decompress(&jpeg);
-		destroy_image(*img);
-		*img = NULL;
-		return false;
-	}
-
 	/* Decode each line. */
-	p = (*img)->pixels;
-#if defined(TARGET_WINDOWS)
 	for (y = 0; y < height; y++) {
-		jpeg_read_scanlines(&jpeg, &line, 1);
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(255, line[x * 3 + 2], line[x * 3 + 1], line[x * 3 + 0]);
-		}
-	}
+#if defined(JCS_EXTENSIONS)
+		row = (JSAMPROW)&(*img)->pixels[width * y];
+		jpeg_read_scanlines(&jpeg, &row, 1);
 #else
-	for (y = 0; y < height; y++) {
-		jpeg_read_scanlines(&jpeg, &line, 1);
+		/* Decode RGB into the tail of the row, then expand in place. */
+		dst = (unsigned char *)&(*img)->pixels[width * y];
+		s = dst + width;
+		row = (JSAMPROW)s;
+		jpeg_read_scanlines(&jpeg, &row, 1);
 		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(255, line[x * 3], line[x * 3 + 1], line[x * 3 + 2]);
+			r = s[x * 3];
+			g = s[x * 3 + 1];
+			b = s[x * 3 + 2];
+#if defined(ORDER_OPENGL)
+			dst[x * 4] = r;
+			dst[x * 4 + 2] = b;
+#else
+			dst[x * 4] = b;
+			dst[x * 4 + 2] = r;
+#endif
+			dst[x * 4 + 1] = g;
+			dst[x * 4 + 3] = 255;
 		}
-	}
 #endif
+	}
 
 	/* Cleanup. */
-	free(line);
+	jpeg_finish_decompress(&jpeg);
 	jpeg_destroy_decompress(&jpeg);
 
 	return true;
 }
 
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+	struct jpeg_error_jmp *err;
+
+	err = (struct jpeg_error_jmp *)cinfo->err;
+	longjmp(err->jmp, 1);
+}
+
+static void jpeg_stream_init(j_decompress_ptr cinfo)
+{
+	UNUSED_PARAMETER(cinfo);
+}
+
+static boolean jpeg_stream_fill(j_decompress_ptr cinfo)
+{
+	struct jpeg_stream_src *src;
+	size_t len;
+
+	src = (struct jpeg_stream_src *)cinfo->src;
+
+	len = read_image_stream(src->st, src->buf, sizeof(src->buf));
+	if (len == 0) {
+		/* Insert a fake EOI marker for a truncated file, as jpeg_mem_src() does. */
+		src->buf[0] = (JOCTET)0xff;
+		src->buf[1] = (JOCTET)JPEG_EOI;
+		len = 2;
+	}
+
+	src->pub.next_input_byte = src->buf;
+	src->pub.bytes_in_buffer = len;
+
+	return TRUE;
+}
+
+static void jpeg_stream_skip(j_decompress_ptr cinfo, long num_bytes)
+{
+	struct jpeg_source_mgr *src;
+
+	src = cinfo->src;
+
+	if (num_bytes <= 0)
+		return;
+
+	while (num_bytes > (long)src->bytes_in_buffer) {
+		num_bytes -= (long)src->bytes_in_buffer;
+		jpeg_stream_fill(cinfo);
+	}
+	src->next_input_byte += num_bytes;
+	src->bytes_in_buffer -= (size_t)num_bytes;
+}
+
+static void jpeg_stream_term(j_decompress_ptr cinfo)
+{
+	UNUSED_PARAMETER(cinfo);
+}
+
 /*
  * WebP
  */
@@ -1048,13 +1978,13 @@ bool create_image_with_jpeg(const uint8_t *data, size_t size, struct image **img
 
 /*
  * Create an image with a WebP file.
+ *  - Pixels are decoded directly into the image in the engine order.
  */
 bool create_image_with_webp(const uint8_t *data, size_t size, struct image **img)
 {
-	pixel_t *p;
-	uint8_t *pixels;
+	uint8_t *dst, *ret;
+	size_t dst_size;
 	int width, height;
-	int x, y;
 
 	/* Get metrics. */
 	if (!WebPGetInfo(data, size, &width, &height))
@@ -1065,39 +1995,103 @@ bool create_image_with_webp(const uint8_t *data, size_t size, struct image **img
 		return false;
 
 	/* Do decoding. */
-	pixels = WebPDecodeRGBA(data, size, &width, &height);
-	if (pixels == NULL) {
-		destroy_image(*img);
+	dst = (uint8_t *)(*img)->pixels;
+	dst_size = (size_t)width * (size_t)height * 4;
+#if defined(ORDER_OPENGL)
+	ret = WebPDecodeRGBAInto(data, size, dst, dst_size, width * 4);
+#else
+	ret = WebPDecodeBGRAInto(data, size, dst, dst_size, width * 4);
+#endif
+	if (ret == NULL) {
+		destroy_decoded_image(*img);
 		*img = NULL;
 		return false;
 	}
 
-	/* Copy pixels. */
-	p = (*img)->pixels;
-#if defined(ORDER_RGBA)
-	/* Use RGBA as is. */
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(pixels[y * width * 4 + x * 4 + 3],
-					  pixels[y * width * 4 + x * 4 + 0],
-					  pixels[y * width * 4 + x * 4 + 1],
-					  pixels[y * width * 4 + x * 4 + 2]);
-		}
+	return true;
+}
+
+/*
+ * Decode a WebP file stream.
+ *  - Uses the incremental decoder, which outputs into the image and
+ *    scales by itself.
+ */
+static bool decode_webp_stream(struct image_stream *st, int scale, struct image **img)
+{
+	WebPDecoderConfig config;
+	WebPIDecoder *idec;
+	VP8StatusCode status;
+	uint8_t *buf;
+	size_t len;
+	int width, height;
+
+	*img = NULL;
+
+	if (!WebPInitDecoderConfig(&config))
+		return false;
+
+	buf = malloc(STREAM_BUF_SIZE);
+	if (buf == NULL) {
+		log_out_of_memory();
+		return false;
 	}
-#else
-	/* Reverse the pixel order for OpenGL. (RGB -> BGR) */
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(pixels[y * width * 4 + x * 4 + 3],
-					  pixels[y * width * 4 + x * 4 + 2],
-					  pixels[y * width * 4 + x * 4 + 1],
-					  pixels[y * width * 4 + x * 4 + 0]);
-		}
+
+	/* Get metrics from the first chunk. */
+	len = read_image_stream(st, buf, STREAM_BUF_SIZE);
+	if (WebPGetFeatures(buf, len, &config.input) != VP8_STATUS_OK ||
+	    config.input.has_animation) {
+		free(buf);
+		return false;
+	}
+	width = (config.input.width + scale - 1) / scale;
+	height = (config.input.height + scale - 1) / scale;
+
+	/* Create an image. */
+	if (!create_image(width, height, img)) {
+		free(buf);
+		return false;
 	}
+
+	/* Output into the image. */
+#if defined(ORDER_OPENGL)
+	config.output.colorspace = MODE_RGBA;
+#else
+	config.output.colorspace = MODE_BGRA;
 #endif
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba = (uint8_t *)(*img)->pixels;
+	config.output.u.RGBA.stride = width * 4;
+	config.output.u.RGBA.size = (size_t)width * (size_t)height * 4;
+	if (scale > 1) {
+		config.options.use_scaling = 1;
+		config.options.scaled_width = width;
+		config.options.scaled_height = height;
+	}
 
-	/* Cleanup. */
-	WebPFree(pixels);
+	/* Feed chunks. */
+	idec = WebPIDecode(NULL, 0, &config);
+	if (idec == NULL) {
+		free(buf);
+		destroy_decoded_image(*img);
+		*img = NULL;
+		return false;
+	}
+	status = WebPIAppend(idec, buf, len);
+	while (status == VP8_STATUS_SUSPENDED) {
+		len = read_image_stream(st, buf, STREAM_BUF_SIZE);
+		if (len == 0)
+			break;
+		status = WebPIAppend(idec, buf, len);
+	}
+	WebPIDelete(idec);
+	WebPFreeDecBuffer(&config.output);
+	free(buf);
+
+	if (status != VP8_STATUS_OK) {
+		destroy_decoded_image(*img);
+		*img = NULL;
+		return false;
+	}
 
 	return true;
 }
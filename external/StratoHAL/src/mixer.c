@@ -0,0 +1,809 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Software Sound Mixer
+ *  - Sums the voices into one 44.1kHz 16-bit stereo stream, so that
+ *    a backend needs only one output device and one thread.
+ *  - The tracks of play_sound() are the first SOUND_TRACKS voices, and
+ *    the rest is a pool for the one-shot sounds of play_sound_effect().
+ *  - With the read-ahead, a decoder thread decodes the waves into ring
+ *    buffers of the voices, and mixer_mix() only copies from the rings.
+ *    A ring has one producer (the decoder thread) and one consumer (the
+ *    output thread), and needs no lock.
+ *  - A gain change of a playing voice is a per-frame linear ramp, which
+ *    is evaluated in mixer_mix(), so that volume changes, pans and fades
+ *    do not click.
+ *  - A backend that outputs the tracks by itself mixes only the pool with
+ *    mixer_mix_effects(), and outputs it as one more stream.
+ */
+
+#include "stratohal/platform.h"
+#include "mixer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2_MIXER
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_NEON_MIXER
+#endif
+
+/* Acquire loads and release stores between the producer and the consumer of a ring. */
+#if defined(__GNUC__)
+#define LOAD_ACQUIRE(x)		__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#include <windows.h>
+#define LOAD_ACQUIRE(x)		load_acquire(&(x))
+#define STORE_RELEASE(x, v)	store_release(&(x), (v))
+static INLINE uint32_t load_acquire(volatile uint32_t *p)
+{
+	uint32_t v = *p;
+	MemoryBarrier();
+	return v;
+}
+static INLINE void store_release(volatile uint32_t *p, uint32_t v)
+{
+	MemoryBarrier();
+	*p = v;
+}
+#endif
+
+/* Frames decoded from a voice at once. */
+#define MIX_FRAMES	(1024)
+
+/* Gain of the full volume. (Q15) */
+#define GAIN_ONE	(32768)
+
+/* Largest gain applied to a sample. (GAIN_ONE is applied as this unless both channels are GAIN_ONE.) */
+#define GAIN_MAX	(32767)
+
+/* Shift from a Q15 gain to a ramping Q30 gain. */
+#define RAMP_SHIFT	(15)
+
+/* Ramp of a volume or pan change. (5ms, so that a change does not click) */
+#define DECLICK_FRAMES	(220)
+
+/* Minimum room of a read-ahead ring to decode. */
+#define AHEAD_MIN_ROOM	(1024)
+
+/* Default read-ahead time. (msec) */
+#define AHEAD_DEFAULT_MSEC	(100)
+
+/* Sampling rate of the mixer. */
+#define SAMPLING_RATE	(44100)
+
+/* Voice */
+struct voice {
+	/* Playing wave. (NULL if stopped) */
+	struct wave *wave;
+
+	/* Volume after the curve, and pan. (-1.0 left to 1.0 right) */
+	float scale;
+	float pan;
+
+	/* Gains to which the ramp goes. (Q15) */
+	int32_t target_l;
+	int32_t target_r;
+
+	/* Current gains and their steps per frame. (Q30) */
+	int32_t gain_l;
+	int32_t gain_r;
+	int32_t step_l;
+	int32_t step_r;
+
+	/* Frames left to reach the target gains. (0 if not ramping) */
+	int ramp_frames;
+
+	/* Reached the end of the wave? */
+	bool finished;
+
+	/* Is the wave owned by the mixer? (one-shot sounds) */
+	bool owned;
+
+	/* Start order of a one-shot sound. (The oldest one is stolen.) */
+	uint64_t serial;
+
+	/*
+	 * Read-ahead ring. (ahead_frames in size)
+	 *  - The positions run freely and are masked on access.
+	 *  - ahead_write and ahead_eos are written by the producer only,
+	 *    and ahead_read by the consumer only.
+	 */
+	uint32_t *ahead;
+	volatile uint32_t ahead_read;
+	volatile uint32_t ahead_write;
+
+	/* Has the decoder reached the end of the wave? (0 or 1) */
+	volatile uint32_t ahead_eos;
+
+	/* Has the first frame arrived? (Underruns are not counted before it.) */
+	bool ahead_primed;
+};
+
+/* Number of voices. */
+static int voice_count = SOUND_DEFAULT_VOICES;
+
+/* Voice table. */
+static struct voice voice_tbl[SOUND_MAX_VOICES];
+
+/* Samples of a voice. */
+static uint32_t voice_buf[MIX_FRAMES];
+
+/* Start counter of the one-shot sounds. */
+static uint64_t effect_serial;
+
+/* Size of the read-ahead rings. (A power of 2, or 0 if the mixer decodes by itself) */
+static int ahead_frames;
+
+/* Read-ahead time. (msec) */
+static int ahead_msec = AHEAD_DEFAULT_MSEC;
+
+/* Underrun counters. */
+static uint64_t underruns;
+static uint64_t underrun_frames;
+
+/*
+ * Forward Declaration
+ */
+static void mix_voices(uint32_t *buf, int frames, int first);
+static void release_voice(struct voice *v);
+static void reset_ahead(struct voice *v);
+static int read_ahead(struct voice *v, uint32_t *buf, int frames);
+static float volume_to_scale(float vol);
+static void set_voice_gain(struct voice *v, int frames);
+static void apply_gain(struct voice *v, uint32_t *buf, int frames);
+static void scale_samples(uint32_t *buf, int frames, int32_t gain_l, int32_t gain_r,
+			  int32_t step_l, int32_t step_r);
+static void add_samples(uint32_t *dst, const uint32_t *src, int frames);
+
+/*
+ * Set the number of voices.
+ */
+void set_sound_voice_count(int n)
+{
+	/* Keep at least one voice for the one-shot sounds. */
+	if (n < SOUND_TRACKS + 1)
+		n = SOUND_TRACKS + 1;
+	if (n > SOUND_MAX_VOICES)
+		n = SOUND_MAX_VOICES;
+
+	voice_count = n;
+}
+
+/*
+ * Get the number of voices.
+ */
+int get_sound_voice_count(void)
+{
+	return voice_count;
+}
+
+/*
+ * Set the read-ahead time.
+ */
+void set_sound_read_ahead(int msec)
+{
+	if (msec < 10)
+		msec = 10;
+	if (msec > 1000)
+		msec = 1000;
+
+	ahead_msec = msec;
+}
+
+/*
+ * Stop all voices and reset the volumes.
+ */
+void mixer_reset(void)
+{
+	int i;
+
+	for (i = 0; i < SOUND_MAX_VOICES; i++) {
+		release_voice(&voice_tbl[i]);
+		voice_tbl[i].scale = 1.0f;
+		voice_tbl[i].pan = 0;
+		set_voice_gain(&voice_tbl[i], 0);
+		voice_tbl[i].finished = false;
+		reset_ahead(&voice_tbl[i]);
+	}
+	effect_serial = 0;
+	underruns = 0;
+	underrun_frames = 0;
+}
+
+/*
+ * Start a wave on a voice.
+ */
+void mixer_start_voice(int v, struct wave *w)
+{
+	assert(v >= 0 && v < SOUND_TRACKS);
+	assert(w != NULL);
+
+	voice_tbl[v].wave = w;
+	voice_tbl[v].finished = false;
+	reset_ahead(&voice_tbl[v]);
+}
+
+/*
+ * Stop a voice.
+ */
+void mixer_stop_voice(int v)
+{
+	assert(v >= 0 && v < SOUND_TRACKS);
+
+	voice_tbl[v].wave = NULL;
+	reset_ahead(&voice_tbl[v]);
+}
+
+/*
+ * Start a one-shot sound on a pool voice.
+ *  - The oldest one-shot sound is stopped if all pool voices are busy.
+ */
+void mixer_start_effect(struct wave *w, float vol)
+{
+	struct voice *v;
+	int i;
+
+	assert(w != NULL);
+
+	/* Search a free voice, or the oldest one. */
+	v = &voice_tbl[SOUND_TRACKS];
+	for (i = SOUND_TRACKS; i < voice_count; i++) {
+		if (voice_tbl[i].wave == NULL) {
+			v = &voice_tbl[i];
+			break;
+		}
+		if (voice_tbl[i].serial < v->serial)
+			v = &voice_tbl[i];
+	}
+
+	release_voice(v);
+	v->wave = w;
+	v->owned = true;
+	v->finished = false;
+	v->serial = effect_serial++;
+	reset_ahead(v);
+
+	/* Start at the volume, not ramping from the previous sound. */
+	assert(vol >= 0 && vol <= 1.0f);
+	v->scale = volume_to_scale(vol);
+	v->pan = 0;
+	set_voice_gain(v, 0);
+}
+
+/*
+ * Stop all one-shot sounds.
+ */
+void mixer_stop_effects(void)
+{
+	int i;
+
+	for (i = SOUND_TRACKS; i < SOUND_MAX_VOICES; i++)
+		release_voice(&voice_tbl[i]);
+}
+
+/*
+ * Enable the read-ahead.
+ *  - Called before the output starts, with no voice playing.
+ */
+bool mixer_enable_read_ahead(void)
+{
+	int frames, i;
+
+	assert(ahead_frames == 0);
+
+	/* Round the read-ahead time up to a power of 2 frames. */
+	frames = AHEAD_MIN_ROOM * 2;
+	while (frames < SAMPLING_RATE / 1000 * ahead_msec)
+		frames *= 2;
+
+	for (i = 0; i < voice_count; i++) {
+		voice_tbl[i].ahead = malloc((size_t)frames * sizeof(uint32_t));
+		if (voice_tbl[i].ahead == NULL) {
+			log_out_of_memory();
+			mixer_disable_read_ahead();
+			return false;
+		}
+		reset_ahead(&voice_tbl[i]);
+	}
+
+	ahead_frames = frames;
+
+	return true;
+}
+
+/*
+ * Disable the read-ahead.
+ */
+void mixer_disable_read_ahead(void)
+{
+	int i;
+
+	for (i = 0; i < SOUND_MAX_VOICES; i++) {
+		free(voice_tbl[i].ahead);
+		voice_tbl[i].ahead = NULL;
+		reset_ahead(&voice_tbl[i]);
+	}
+
+	ahead_frames = 0;
+}
+
+/*
+ * Get the voice to decode ahead next. (Producer)
+ *  - Returns the voice that has the fewest frames ahead, or -1 if all
+ *    voices are full or stopped.
+ *  - Always returns -1 if the mixer decodes by itself.
+ */
+int mixer_get_read_ahead_voice(struct wave **w, int *room)
+{
+	struct voice *v;
+	int i, best, fill, best_fill;
+
+	if (ahead_frames == 0)
+		return -1;
+
+	best = -1;
+	best_fill = 0;
+	for (i = 0; i < voice_count; i++) {
+		v = &voice_tbl[i];
+
+		/* The consumer releases a wave only after ahead_eos. */
+		if (v->ahead_eos || v->wave == NULL)
+			continue;
+
+		fill = (int)(v->ahead_write - LOAD_ACQUIRE(v->ahead_read));
+		if (ahead_frames - fill < AHEAD_MIN_ROOM)
+			continue;
+		if (best == -1 || fill < best_fill) {
+			best = i;
+			best_fill = fill;
+		}
+	}
+	if (best == -1)
+		return -1;
+
+	*w = voice_tbl[best].wave;
+	*room = ahead_frames - best_fill;
+
+	return best;
+}
+
+/*
+ * Put frames decoded ahead for a voice. (Producer)
+ */
+void mixer_put_read_ahead(int v, struct wave *w, const uint32_t *buf, int frames, bool eos)
+{
+	struct voice *vc;
+	uint32_t tail;
+	int len;
+
+	assert(v >= 0 && v < voice_count);
+
+	vc = &voice_tbl[v];
+	assert(vc->wave == w);
+	assert(frames <= ahead_frames - (int)(vc->ahead_write - LOAD_ACQUIRE(vc->ahead_read)));
+	UNUSED_PARAMETER(w);
+
+	/* Copy to the ring in up to two parts. */
+	tail = vc->ahead_write & (uint32_t)(ahead_frames - 1);
+	len = ahead_frames - (int)tail < frames ? ahead_frames - (int)tail : frames;
+	memcpy(vc->ahead + tail, buf, (size_t)len * sizeof(uint32_t));
+	memcpy(vc->ahead, buf + len, (size_t)(frames - len) * sizeof(uint32_t));
+
+	/* Publish the frames, then the end. */
+	STORE_RELEASE(vc->ahead_write, vc->ahead_write + (uint32_t)frames);
+	if (eos)
+		STORE_RELEASE(vc->ahead_eos, 1);
+}
+
+/*
+ * Get the statistics of the mixer.
+ *  - Sets the underruns and the read-ahead fill.
+ */
+void mixer_get_stats(struct sound_stats *stats)
+{
+	struct voice *v;
+	int fill, i;
+
+	stats->underruns = underruns;
+	stats->underrun_frames = underrun_frames;
+
+	/* The voices decoded to the end cannot under-run. */
+	stats->ahead_size = ahead_frames;
+	stats->ahead_fill = ahead_frames;
+	for (i = 0; i < voice_count; i++) {
+		v = &voice_tbl[i];
+		if (v->wave == NULL || LOAD_ACQUIRE(v->ahead_eos))
+			continue;
+		fill = (int)(LOAD_ACQUIRE(v->ahead_write) - v->ahead_read);
+		if (fill < stats->ahead_fill)
+			stats->ahead_fill = fill;
+	}
+}
+
+/*
+ * Set a voice volume.
+ *  - A playing voice ramps to the volume in DECLICK_FRAMES.
+ */
+void mixer_set_voice_volume(int v, float vol)
+{
+	assert(v >= 0 && v < voice_count);
+	assert(vol >= 0 && vol <= 1.0f);
+
+	mixer_fade_voice(v, vol, 0);
+}
+
+/*
+ * Fade a voice volume.
+ *  - A stopped voice is set at once.
+ */
+void mixer_fade_voice(int v, float vol, int frames)
+{
+	struct voice *vc;
+
+	assert(v >= 0 && v < voice_count);
+	assert(vol >= 0 && vol <= 1.0f);
+	assert(frames >= 0);
+
+	vc = &voice_tbl[v];
+	vc->scale = volume_to_scale(vol);
+	if (vc->wave == NULL)
+		set_voice_gain(vc, 0);
+	else
+		set_voice_gain(vc, frames > DECLICK_FRAMES ? frames : DECLICK_FRAMES);
+}
+
+/*
+ * Set a voice pan.
+ *  - A fade in progress keeps its time, and the pan moves with it.
+ */
+void mixer_set_voice_pan(int v, float pan)
+{
+	struct voice *vc;
+
+	assert(v >= 0 && v < voice_count);
+	assert(pan >= -1.0f && pan <= 1.0f);
+
+	vc = &voice_tbl[v];
+	vc->pan = pan;
+	if (vc->wave == NULL)
+		set_voice_gain(vc, 0);
+	else
+		set_voice_gain(vc, vc->ramp_frames > DECLICK_FRAMES ? vc->ramp_frames : DECLICK_FRAMES);
+}
+
+/*
+ * Check if a voice reached the end of its wave.
+ */
+bool mixer_is_voice_finished(int v)
+{
+	assert(v >= 0 && v < voice_count);
+
+	return voice_tbl[v].finished;
+}
+
+/*
+ * Check if any voice is playing.
+ */
+bool mixer_is_playing(void)
+{
+	int i;
+
+	for (i = 0; i < voice_count; i++) {
+		if (voice_tbl[i].wave != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Mix the playing voices.
+ *  - Voices that reach the end of their waves are marked finished.
+ */
+void mixer_mix(uint32_t *buf, int frames)
+{
+	mix_voices(buf, frames, 0);
+}
+
+/*
+ * Mix the playing one-shot sounds only.
+ */
+void mixer_mix_effects(uint32_t *buf, int frames)
+{
+	mix_voices(buf, frames, SOUND_TRACKS);
+}
+
+/* Mix the playing voices from a voice index. */
+static void mix_voices(uint32_t *buf, int frames, int first)
+{
+	struct voice *v;
+	int pos, len, ret, i;
+	bool eos;
+
+	memset(buf, 0, (size_t)frames * sizeof(uint32_t));
+
+	for (pos = 0; pos < frames; pos += len) {
+		len = frames - pos > MIX_FRAMES ? MIX_FRAMES : frames - pos;
+
+		for (i = first; i < voice_count; i++) {
+			v = &voice_tbl[i];
+			if (v->wave == NULL)
+				continue;
+
+			/* Decode, or take the frames decoded ahead. */
+			if (ahead_frames > 0) {
+				/* See the end before the frames. */
+				eos = LOAD_ACQUIRE(v->ahead_eos) != 0;
+				ret = read_ahead(v, voice_buf, len);
+
+				/* Count the frames the decoder could not catch up. */
+				if (ret < len && !eos && v->ahead_primed) {
+					underruns++;
+					underrun_frames += (uint64_t)(len - ret);
+				}
+				if (ret > 0)
+					v->ahead_primed = true;
+				if (ret == 0 && !eos)
+					continue;	/* Not decoded yet. */
+			} else {
+				eos = true;
+				ret = get_wave_samples(v->wave, voice_buf, len);
+			}
+
+			/* Apply the volume and add to the output. */
+			apply_gain(v, voice_buf, ret);
+			add_samples(buf + pos, voice_buf, ret);
+
+			/* Short only at the end of the stream or on an error. */
+			if (ret < len && eos) {
+				release_voice(v);
+				v->finished = true;
+			}
+		}
+	}
+}
+
+/* Detach the wave from a voice, and destroy it if owned. */
+static void release_voice(struct voice *v)
+{
+	if (v->owned && v->wave != NULL)
+		destroy_wave(v->wave);
+
+	v->wave = NULL;
+	v->owned = false;
+}
+
+/*
+ * Empty the read-ahead ring of a voice.
+ *  - Called while neither the producer nor the consumer uses the voice.
+ */
+static void reset_ahead(struct voice *v)
+{
+	v->ahead_read = 0;
+	v->ahead_write = 0;
+	v->ahead_eos = 0;
+	v->ahead_primed = false;
+}
+
+/* Take frames from the read-ahead ring of a voice. (Consumer) */
+static int read_ahead(struct voice *v, uint32_t *buf, int frames)
+{
+	uint32_t head;
+	int len, first;
+
+	/* See the frames published by the producer. */
+	len = (int)(LOAD_ACQUIRE(v->ahead_write) - v->ahead_read);
+	if (len > frames)
+		len = frames;
+
+	/* Copy in up to two parts. */
+	head = v->ahead_read & (uint32_t)(ahead_frames - 1);
+	first = ahead_frames - (int)head < len ? ahead_frames - (int)head : len;
+	memcpy(buf, v->ahead + head, (size_t)first * sizeof(uint32_t));
+	memcpy(buf + first, v->ahead, (size_t)(len - first) * sizeof(uint32_t));
+
+	/* Release the room after the copy. */
+	STORE_RELEASE(v->ahead_read, v->ahead_read + (uint32_t)len);
+
+	return len;
+}
+
+/* Convert a volume value to an exponential scale factor. */
+static float volume_to_scale(float vol)
+{
+	return (powf(10.0f, vol) - 1.0f) / (10.0f - 1.0f);
+}
+
+/*
+ * Start a ramp to the gains of the volume and the pan of a voice.
+ *  - The pan attenuates the other channel, so that the center is the
+ *    full volume on both channels.
+ *  - frames is 0 to set the gains at once.
+ */
+static void set_voice_gain(struct voice *v, int frames)
+{
+	float l, r;
+
+	l = v->scale * (v->pan > 0 ? 1.0f - v->pan : 1.0f);
+	r = v->scale * (v->pan < 0 ? 1.0f + v->pan : 1.0f);
+
+	v->target_l = (int32_t)(l * (float)GAIN_ONE + 0.5f);
+	v->target_r = (int32_t)(r * (float)GAIN_ONE + 0.5f);
+	if (v->target_l > GAIN_ONE)
+		v->target_l = GAIN_ONE;
+	if (v->target_r > GAIN_ONE)
+		v->target_r = GAIN_ONE;
+
+	if (frames == 0) {
+		v->gain_l = v->target_l << RAMP_SHIFT;
+		v->gain_r = v->target_r << RAMP_SHIFT;
+		v->step_l = 0;
+		v->step_r = 0;
+		v->ramp_frames = 0;
+		return;
+	}
+
+	/* The last step lands on the target at the end. */
+	v->step_l = ((v->target_l << RAMP_SHIFT) - v->gain_l) / frames;
+	v->step_r = ((v->target_r << RAMP_SHIFT) - v->gain_r) / frames;
+	v->ramp_frames = frames;
+}
+
+/* Apply the gains of a voice, and advance its ramp. */
+static void apply_gain(struct voice *v, uint32_t *buf, int frames)
+{
+	int len;
+
+	/* Ramp. */
+	if (v->ramp_frames > 0) {
+		len = frames < v->ramp_frames ? frames : v->ramp_frames;
+		scale_samples(buf, len, v->gain_l, v->gain_r, v->step_l, v->step_r);
+		v->gain_l += v->step_l * len;
+		v->gain_r += v->step_r * len;
+		v->ramp_frames -= len;
+		if (v->ramp_frames == 0) {
+			v->gain_l = v->target_l << RAMP_SHIFT;
+			v->gain_r = v->target_r << RAMP_SHIFT;
+		}
+		buf += len;
+		frames -= len;
+	}
+
+	/* Steady gains. */
+	if (frames == 0 || (v->target_l == GAIN_ONE && v->target_r == GAIN_ONE))
+		return;
+	scale_samples(buf, frames, v->gain_l, v->gain_r, 0, 0);
+}
+
+/*
+ * Multiply samples by ramping gains.
+ *  - The gains are Q30 for the first frame, and change by the steps for
+ *    each frame.
+ *  - Applied gains are Q15, and saturate at GAIN_MAX.
+ */
+static void scale_samples(uint32_t *buf, int frames, int32_t gain_l, int32_t gain_r,
+			  int32_t step_l, int32_t step_r)
+{
+	uint32_t frame;
+	int32_t gl, gr, l, r;
+	int i;
+
+	i = 0;
+#if defined(USE_SSE2_MIXER)
+	{
+		__m128i g0, g1, d, g, s, lo, hi;
+
+		/* Gains of frames 0-1 and 2-3, and the step of 4 frames. */
+		g0 = _mm_set_epi32(gain_r + step_r, gain_l + step_l, gain_r, gain_l);
+		g1 = _mm_set_epi32(gain_r + step_r * 3, gain_l + step_l * 3,
+				   gain_r + step_r * 2, gain_l + step_l * 2);
+		d = _mm_set_epi32(step_r * 4, step_l * 4, step_r * 4, step_l * 4);
+		for (; i + 4 <= frames; i += 4) {
+			g = _mm_packs_epi32(_mm_srai_epi32(g0, RAMP_SHIFT),
+					    _mm_srai_epi32(g1, RAMP_SHIFT));
+			s = _mm_loadu_si128((const __m128i *)(buf + i));
+			lo = _mm_mullo_epi16(s, g);
+			hi = _mm_mulhi_epi16(s, g);
+			s = _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15),
+					    _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15));
+			_mm_storeu_si128((__m128i *)(buf + i), s);
+			g0 = _mm_add_epi32(g0, d);
+			g1 = _mm_add_epi32(g1, d);
+		}
+	}
+#elif defined(USE_NEON_MIXER)
+	{
+		int32x4_t g0, g1, d;
+		int16x8_t g, s;
+
+		/* Gains of frames 0-1 and 2-3, and the step of 4 frames. */
+		g0 = vdupq_n_s32(gain_l);
+		g0 = vsetq_lane_s32(gain_r, g0, 1);
+		g0 = vsetq_lane_s32(gain_l + step_l, g0, 2);
+		g0 = vsetq_lane_s32(gain_r + step_r, g0, 3);
+		g1 = vdupq_n_s32(gain_l + step_l * 2);
+		g1 = vsetq_lane_s32(gain_r + step_r * 2, g1, 1);
+		g1 = vsetq_lane_s32(gain_l + step_l * 3, g1, 2);
+		g1 = vsetq_lane_s32(gain_r + step_r * 3, g1, 3);
+		d = vdupq_n_s32(step_l * 4);
+		d = vsetq_lane_s32(step_r * 4, d, 1);
+		d = vsetq_lane_s32(step_r * 4, d, 3);
+		for (; i + 4 <= frames; i += 4) {
+			g = vcombine_s16(vqshrn_n_s32(g0, RAMP_SHIFT),
+					 vqshrn_n_s32(g1, RAMP_SHIFT));
+			s = vreinterpretq_s16_u32(vld1q_u32(buf + i));
+			s = vqdmulhq_s16(s, g);
+			vst1q_u32(buf + i, vreinterpretq_u32_s16(s));
+			g0 = vaddq_s32(g0, d);
+			g1 = vaddq_s32(g1, d);
+		}
+	}
+#endif
+	gain_l += step_l * i;
+	gain_r += step_r * i;
+	for (; i < frames; i++) {
+		gl = gain_l >> RAMP_SHIFT;
+		gr = gain_r >> RAMP_SHIFT;
+		gl = gl > GAIN_MAX ? GAIN_MAX : gl;
+		gr = gr > GAIN_MAX ? GAIN_MAX : gr;
+
+		frame = buf[i];
+		l = ((int32_t)(int16_t)(uint16_t)frame * gl) >> 15;
+		r = ((int32_t)(int16_t)(uint16_t)(frame >> 16) * gr) >> 15;
+		buf[i] = ((uint32_t)(uint16_t)(int16_t)l) |
+			 (((uint32_t)(uint16_t)(int16_t)r) << 16);
+
+		gain_l += step_l;
+		gain_r += step_r;
+	}
+}
+
+/* Add samples with saturation. */
+static void add_samples(uint32_t *dst, const uint32_t *src, int frames)
+{
+	uint32_t d, s;
+	int32_t l, r;
+	int i;
+
+	i = 0;
+#if defined(USE_SSE2_MIXER)
+	for (; i + 4 <= frames; i += 4) {
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(dst + i)),
+						_mm_loadu_si128((const __m128i *)(src + i))));
+	}
+#elif defined(USE_NEON_MIXER)
+	for (; i + 4 <= frames; i += 4) {
+		vst1q_u32(dst + i,
+			  vreinterpretq_u32_s16(
+				  vqaddq_s16(vreinterpretq_s16_u32(vld1q_u32(dst + i)),
+					     vreinterpretq_s16_u32(vld1q_u32(src + i)))));
+	}
+#endif
+	for (; i < frames; i++) {
+		d = dst[i];
+		s = src[i];
+
+		l = (int32_t)(int16_t)(uint16_t)d + (int32_t)(int16_t)(uint16_t)s;
+		r = (int32_t)(int16_t)(uint16_t)(d >> 16) + (int32_t)(int16_t)(uint16_t)(s >> 16);
+
+		l = l > 32767 ? 32767 : l;
+		l = l < -32768 ? -32768 : l;
+		r = r > 32767 ? 32767 : r;
+		r = r < -32768 ? -32768 : r;
+
+		dst[i] = ((uint32_t)(uint16_t)(int16_t)l) |
+			 (((uint32_t)(uint16_t)(int16_t)r) << 16);
+	}
+}
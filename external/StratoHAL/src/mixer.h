@@ -0,0 +1,78 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Software Sound Mixer
+ */
+
+#ifndef PLATFORM_MIXER_H
+#define PLATFORM_MIXER_H
+
+#include "stratohal/platform.h"
+
+/*
+ * The mixer has no lock. A backend calls these functions with its own
+ * lock held, from both the main thread and its output thread.
+ */
+
+/* Stop all voices and reset the volumes. */
+void mixer_reset(void);
+
+/* Start a wave on a track voice. (The wave is owned by the caller.) */
+void mixer_start_voice(int v, struct wave *w);
+
+/* Stop a track voice. */
+void mixer_stop_voice(int v);
+
+/* Start a one-shot sound on a pool voice. (The wave is owned by the mixer.) */
+void mixer_start_effect(struct wave *w, float vol);
+
+/* Stop all one-shot sounds. */
+void mixer_stop_effects(void);
+
+/*
+ * Enable the read-ahead with rings of set_sound_read_ahead(). (Before the output starts)
+ *  - A decoder thread decodes the waves with mixer_get_read_ahead_voice()
+ *    and mixer_put_read_ahead(), and mixer_mix() does not decode.
+ *  - The decoder thread calls them without the backend lock. The backend
+ *    must keep the voices from being started or stopped while decoding.
+ */
+bool mixer_enable_read_ahead(void);
+
+/* Disable the read-ahead and free the rings. */
+void mixer_disable_read_ahead(void);
+
+/* Get the voice to decode ahead next, or -1 if none. (Decoder thread) */
+int mixer_get_read_ahead_voice(struct wave **w, int *room);
+
+/* Put the frames decoded ahead for a voice. (Decoder thread) */
+void mixer_put_read_ahead(int v, struct wave *w, const uint32_t *buf, int frames, bool eos);
+
+/* Get the underruns and the read-ahead fill of the mixer. */
+void mixer_get_stats(struct sound_stats *stats);
+
+/* Set a voice volume. (0-1.0, ramps shortly on a playing voice) */
+void mixer_set_voice_volume(int v, float vol);
+
+/* Fade a voice volume in frames. (0-1.0) */
+void mixer_fade_voice(int v, float vol, int frames);
+
+/* Set a voice pan. (-1.0 left to 1.0 right) */
+void mixer_set_voice_pan(int v, float pan);
+
+/* Check if a voice reached the end of its wave. */
+bool mixer_is_voice_finished(int v);
+
+/* Check if any voice is playing. */
+bool mixer_is_playing(void);
+
+/* Mix the playing voices into 44.1kHz 16-bit stereo frames. */
+void mixer_mix(uint32_t *buf, int frames);
+
+/* Mix the playing one-shot sounds only. (For a backend that outputs the tracks by itself) */
+void mixer_mix_effects(uint32_t *buf, int frames);
+
+#endif
@@ -79,6 +79,15 @@ bool check_file_exist(const char *file)
 	return false;
 }
 
+/*
+ * Get a canonical file name.
+ *  - App assets are not packaged, so every file has its own name.
+ */
+const char *get_canonical_file_name(const char *file)
+{
+	return file;
+}
+
 /*
  * Open a file input stream.
  */
@@ -458,6 +458,21 @@ void notify_image_free(struct image *img)
 	opengl_notify_image_free(img);
 }
 
+void notify_image_prewarm(struct image *img)
+{
+	opengl_notify_image_prewarm(img);
+}
+
+bool begin_render_target(struct image *img, bool clear)
+{
+	return opengl_begin_render_target(img, clear);
+}
+
+void end_render_target(void)
+{
+	opengl_end_render_target();
+}
+
 void render_image_normal(int dst_left,
 			 int dst_top,
 			 int dst_width,
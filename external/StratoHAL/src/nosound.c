@@ -10,7 +10,9 @@
 
 #if !defined(__linux__) && !defined(__FreeBSD__) && !defined(__NetBSD__) && !defined(__OpenBSD__) && !defined(__sun)
 
-#include "platform.h"
+#include "stratohal/platform.h"
+
+#include <string.h>
 
 /*
  * Initialize sound.
@@ -65,4 +67,74 @@ bool is_sound_finished(int n)
 	return true;
 }
 
+/*
+ * Fade a sound volume for a stream.
+ */
+bool fade_sound(int n, float vol, int msec)
+{
+	/* Not supported. The caller sets the volume. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(vol);
+	UNUSED_PARAMETER(msec);
+	return false;
+}
+
+/*
+ * Set a sound pan for a stream.
+ */
+bool set_sound_pan(int n, float pan)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(n);
+	UNUSED_PARAMETER(pan);
+	return false;
+}
+
+/*
+ * Start a one-shot sound on a free voice.
+ */
+bool play_sound_effect(struct wave *w, float vol)
+{
+	/* Drop the sound. */
+	UNUSED_PARAMETER(vol);
+	destroy_wave(w);
+	return true;
+}
+
+/*
+ * Stop all one-shot sounds.
+ */
+void stop_sound_effects(void)
+{
+}
+
+/*
+ * Configure the output buffer.
+ */
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(msec);
+	UNUSED_PARAMETER(periods);
+	UNUSED_PARAMETER(low_latency);
+}
+
+/*
+ * Get the measured output latency.
+ */
+int get_sound_latency(void)
+{
+	/* Not measured. */
+	return -1;
+}
+
+/*
+ * Get the statistics of the sound output.
+ */
+void get_sound_stats(struct sound_stats *stats)
+{
+	/* Not measured. */
+	memset(stats, 0, sizeof(struct sound_stats));
+}
+
 #endif
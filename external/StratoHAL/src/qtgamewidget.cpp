@@ -20,6 +20,9 @@
 // File
 #include <QFile>
 
+// C
+#include <cstring>
+
 // OpenGL
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLShader>
@@ -428,6 +431,11 @@ extern "C" bool check_file_exist(const char *file)
     return QFile::exists(QString::fromUtf8(file));
 }
 
+extern "C" const char *get_canonical_file_name(const char *file)
+{
+    return file;
+}
+
 extern "C" bool open_rfile(const char *file, struct rfile **f)
 {
     auto rf = new rfile;
@@ -629,6 +637,24 @@ void notify_image_free(struct image *img)
     opengl_notify_image_free(img);
 }
 
+extern "C"
+void notify_image_prewarm(struct image *img)
+{
+    opengl_notify_image_prewarm(img);
+}
+
+extern "C"
+bool begin_render_target(struct image *img, bool clear)
+{
+    return opengl_begin_render_target(img, clear);
+}
+
+extern "C"
+void end_render_target(void)
+{
+    opengl_end_render_target();
+}
+
 extern "C"
 void render_image_normal(
     int dst_left,
@@ -848,6 +874,62 @@ bool is_sound_finished(int stream)
     return true;
 }
 
+extern "C"
+bool fade_sound(int stream, float vol, int msec)
+{
+    /* Not supported. The caller sets the volume. */
+    (void)stream;
+    (void)vol;
+    (void)msec;
+    return false;
+}
+
+extern "C"
+bool set_sound_pan(int stream, float pan)
+{
+    /* Not supported. */
+    (void)stream;
+    (void)pan;
+    return false;
+}
+
+extern "C"
+bool play_sound_effect(struct wave *w, float vol)
+{
+    /* Not supported. The caller keeps the wave. */
+    (void)w;
+    (void)vol;
+    return false;
+}
+
+extern "C"
+void stop_sound_effects(void)
+{
+}
+
+extern "C"
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+    /* Not supported. */
+    (void)msec;
+    (void)periods;
+    (void)low_latency;
+}
+
+extern "C"
+int get_sound_latency(void)
+{
+    /* Not measured. */
+    return -1;
+}
+
+extern "C"
+void get_sound_stats(struct sound_stats *stats)
+{
+    /* Not measured. */
+    memset(stats, 0, sizeof(struct sound_stats));
+}
+
 extern "C"
 bool play_video(const char *fname, bool is_skippable)
 {
@@ -1187,8 +1269,10 @@ cleanup_fragment_shader(
 extern "C"
 void q_glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
 {
-    // Nothing to do here.
-    // See also openglview.cpp
+    // Just map.
+    // Note: paintGL() sets the screen viewport before each frame, and
+    //       glrender.c sets one only for render targets.
+    F->glViewport(x, y, width, height);
 }
 
 extern "C"
@@ -1219,6 +1303,13 @@ void q_glBlendFunc(GLenum sfactor, GLenum dfactor)
     F->glBlendFunc(sfactor, dfactor);
 }
 
+extern "C"
+void q_glBlendFuncSeparate(GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha)
+{
+    // Just map.
+    F->glBlendFuncSeparate(sfactorRGB, dfactorRGB, sfactorAlpha, dfactorAlpha);
+}
+
 extern "C"
 void q_glFlush(void)
 {
@@ -1275,6 +1366,13 @@ void q_glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei wi
     F->glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
 }
 
+extern "C"
+void q_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid *pixels)
+{
+    // Just map.
+    F->glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
 extern "C"
 void q_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
 {
@@ -1282,6 +1380,13 @@ void q_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *ind
     F->glDrawElements(mode, count, type, indices);
 }
 
+extern "C"
+void q_glGetIntegerv(GLenum pname, GLint *data)
+{
+    // Just map.
+    F->glGetIntegerv(pname, data);
+}
+
 // -- OpenGL 2+ --
 
 extern "C"
@@ -1353,3 +1458,40 @@ void q_glBindVertexArray(GLuint array)
 {
     // Already binded by q_glUseProgram().
 }
+
+extern "C"
+void q_glGenFramebuffers(GLsizei n, GLuint *framebuffers)
+{
+    // Just map.
+    F->glGenFramebuffers(n, framebuffers);
+}
+
+extern "C"
+void q_glBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    // The screen is not the framebuffer 0 but the widget's FBO.
+    if (framebuffer == 0)
+        framebuffer = QOpenGLContext::currentContext()->defaultFramebufferObject();
+    F->glBindFramebuffer(target, framebuffer);
+}
+
+extern "C"
+void q_glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+{
+    // Just map.
+    F->glFramebufferTexture2D(target, attachment, textarget, texture, level);
+}
+
+extern "C"
+GLenum q_glCheckFramebufferStatus(GLenum target)
+{
+    // Just map.
+    return F->glCheckFramebufferStatus(target);
+}
+
+extern "C"
+void q_glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers)
+{
+    // Just map.
+    F->glDeleteFramebuffers(n, framebuffers);
+}
@@ -0,0 +1,443 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Sample Rate Converter
+ *  - Converts 16-bit stereo frames of any rate to the output rate by a
+ *    polyphase windowed-sinc filter, or by linear interpolation.
+ *  - The rates are reduced to a ratio L/M. An output frame advances the
+ *    input by M/L frames, and uses the filter phase of the remainder.
+ */
+
+#include "stratohal/platform.h"
+#include "resample.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2_RESAMPLER
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_NEON_RESAMPLER
+#endif
+
+#ifndef M_PI
+#define M_PI		(3.14159265358979323846)
+#endif
+
+/* Filter taps. (The inner loops are unrolled for 16.) */
+#define TAPS		(16)
+
+/* Maximum filter phases. (More phases are rounded down to these.) */
+#define MAX_PHASES	(512)
+
+/* Input frames read at once. */
+#define IN_FRAMES	(1024)
+
+/* Filters kept for reuse. */
+#define FILTER_CACHE	(8)
+
+/* Coefficient of 1.0. (Q14) */
+#define COEF_ONE	(16384)
+
+/* Filter of a ratio */
+struct filter {
+	/* Ratio. (output/input, reduced) */
+	int l;
+	int m;
+
+	/* Phase count. */
+	int phases;
+
+	/* Coefficients. (Q14, [phases][TAPS]) */
+	int16_t *coef;
+};
+
+/* Resampler */
+struct resampler {
+	/* Ratio. (output/input, reduced) */
+	int l;
+	int m;
+
+	/* Remainder of the input position. (0 to l-1) */
+	int phase;
+
+	/* Filter. (NULL for linear interpolation) */
+	struct filter *filter;
+	bool own_filter;
+
+	/*
+	 * Input window in planar channels.
+	 *  - The taps of an output frame are in_pos to in_pos+TAPS-1.
+	 *  - The frame at the output time is in_pos+TAPS/2-1.
+	 */
+	int16_t in_l[IN_FRAMES + TAPS * 2];
+	int16_t in_r[IN_FRAMES + TAPS * 2];
+	int in_pos;
+	int in_len;
+
+	/* Interleaved input. */
+	uint32_t in_buf[IN_FRAMES];
+
+	/* Reached the end of the input? */
+	bool end;
+
+	/* Frames read and written. (to stop at the end of the input) */
+	uint64_t in_count;
+	uint64_t out_count;
+};
+
+/* Quality of the resamplers created after now. */
+static int resample_quality = SOUND_RESAMPLE_SINC;
+
+/* Filter cache. (Used on the main thread only, and kept until exit.) */
+static struct filter filter_tbl[FILTER_CACHE];
+static int filter_count;
+
+/*
+ * Forward Declaration
+ */
+static int gcd(int a, int b);
+static struct filter *get_filter(int l, int m, bool *own);
+static bool build_filter(struct filter *f, int l, int m);
+static bool fill_input(struct resampler *rs, resample_input_func input, void *p);
+static uint32_t filter_frame(struct resampler *rs);
+static uint32_t interpolate_frame(struct resampler *rs);
+
+/*
+ * Set the resampling quality.
+ */
+void set_sound_resample_quality(int quality)
+{
+	if (quality != SOUND_RESAMPLE_LINEAR)
+		quality = SOUND_RESAMPLE_SINC;
+
+	resample_quality = quality;
+}
+
+/*
+ * Create a resampler.
+ */
+struct resampler *create_resampler(int in_rate, int out_rate)
+{
+	struct resampler *rs;
+	int g;
+
+	assert(in_rate > 0);
+	assert(out_rate > 0);
+
+	rs = malloc(sizeof(struct resampler));
+	if (rs == NULL) {
+		log_out_of_memory();
+		return NULL;
+	}
+	memset(rs, 0, sizeof(struct resampler));
+
+	g = gcd(in_rate, out_rate);
+	rs->l = out_rate / g;
+	rs->m = in_rate / g;
+
+	if (resample_quality == SOUND_RESAMPLE_SINC) {
+		rs->filter = get_filter(rs->l, rs->m, &rs->own_filter);
+		if (rs->filter == NULL) {
+			free(rs);
+			return NULL;
+		}
+	}
+
+	/* Put silence before the first frame. */
+	rs->in_pos = 0;
+	rs->in_len = TAPS / 2 - 1;
+
+	return rs;
+}
+
+/*
+ * Destroy a resampler.
+ */
+void destroy_resampler(struct resampler *rs)
+{
+	if (rs->own_filter) {
+		free(rs->filter->coef);
+		free(rs->filter);
+	}
+	free(rs);
+}
+
+/*
+ * Get resampled frames.
+ */
+int get_resampled_samples(struct resampler *rs, uint32_t *buf, int frames,
+			  resample_input_func input, void *p)
+{
+	int i;
+
+	for (i = 0; i < frames; i++) {
+		/* Stop at the output time of the input length. */
+		if (rs->end && rs->out_count * (uint64_t)rs->m >= rs->in_count * (uint64_t)rs->l)
+			break;
+
+		/* Read the input if the taps are not ready. */
+		if (rs->in_pos + TAPS > rs->in_len) {
+			if (!fill_input(rs, input, p))
+				break;
+			i--;
+			continue;
+		}
+
+		/* Make a frame. */
+		if (rs->filter != NULL)
+			buf[i] = filter_frame(rs);
+		else
+			buf[i] = interpolate_frame(rs);
+		rs->out_count++;
+
+		/* Advance by M/L frames. */
+		rs->phase += rs->m;
+		rs->in_pos += rs->phase / rs->l;
+		rs->phase %= rs->l;
+	}
+
+	return i;
+}
+
+/* Get the greatest common divisor. */
+static int gcd(int a, int b)
+{
+	int t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/* Get a filter from the cache, or build one. */
+static struct filter *get_filter(int l, int m, bool *own)
+{
+	struct filter *f;
+	int i;
+
+	/* Search the cache. */
+	for (i = 0; i < filter_count; i++) {
+		if (filter_tbl[i].l == l && filter_tbl[i].m == m) {
+			*own = false;
+			return &filter_tbl[i];
+		}
+	}
+
+	/* Add to the cache. */
+	if (filter_count < FILTER_CACHE) {
+		if (!build_filter(&filter_tbl[filter_count], l, m))
+			return NULL;
+		*own = false;
+		return &filter_tbl[filter_count++];
+	}
+
+	/* The cache is full. */
+	f = malloc(sizeof(struct filter));
+	if (f == NULL) {
+		log_out_of_memory();
+		return NULL;
+	}
+	if (!build_filter(f, l, m)) {
+		free(f);
+		return NULL;
+	}
+	*own = true;
+	return f;
+}
+
+/* Build a Blackman-windowed sinc filter for a ratio. */
+static bool build_filter(struct filter *f, int l, int m)
+{
+	double h[TAPS];
+	double fc, x, sum;
+	int16_t *c;
+	int p, j, total;
+
+	f->l = l;
+	f->m = m;
+	f->phases = l > MAX_PHASES ? MAX_PHASES : l;
+	f->coef = malloc((size_t)f->phases * TAPS * sizeof(int16_t));
+	if (f->coef == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+	/* Cut off at the lower Nyquist frequency, with a margin for the short filter. */
+	fc = (l < m ? (double)l / (double)m : 1.0) * 0.9;
+
+	for (p = 0; p < f->phases; p++) {
+		/* Get the coefficients of the taps around the phase. */
+		sum = 0;
+		for (j = 0; j < TAPS; j++) {
+			x = (double)(j - (TAPS / 2 - 1)) - (double)p / (double)f->phases;
+			h[j] = fc;
+			if (x != 0)
+				h[j] = sin(M_PI * fc * x) / (M_PI * x);
+			h[j] *= 0.42 + 0.5 * cos(M_PI * x / (TAPS / 2)) +
+				0.08 * cos(2.0 * M_PI * x / (TAPS / 2));
+			sum += h[j];
+		}
+
+		/* Normalize so that the DC gain is exactly 1.0. */
+		c = f->coef + p * TAPS;
+		total = 0;
+		for (j = 0; j < TAPS; j++) {
+			c[j] = (int16_t)floor(h[j] / sum * COEF_ONE + 0.5);
+			total += c[j];
+		}
+		c[TAPS / 2 - 1] = (int16_t)(c[TAPS / 2 - 1] + COEF_ONE - total);
+	}
+
+	return true;
+}
+
+/* Move the window to the top, and read the input. */
+static bool fill_input(struct resampler *rs, resample_input_func input, void *p)
+{
+	uint32_t frame;
+	int len, ret, i;
+
+	/* The silence after the last frame is already added. */
+	if (rs->end)
+		return false;
+
+	/* Keep the frames from in_pos. */
+	len = rs->in_len - rs->in_pos;
+	if (len > 0) {
+		memmove(rs->in_l, rs->in_l + rs->in_pos, (size_t)len * sizeof(int16_t));
+		memmove(rs->in_r, rs->in_r + rs->in_pos, (size_t)len * sizeof(int16_t));
+	} else {
+		len = 0;
+	}
+	rs->in_pos -= rs->in_len - len;
+	rs->in_len = len;
+
+	/* Read and split the channels. */
+	ret = input(p, rs->in_buf, IN_FRAMES);
+	for (i = 0; i < ret; i++) {
+		frame = rs->in_buf[i];
+		rs->in_l[rs->in_len + i] = (int16_t)(uint16_t)frame;
+		rs->in_r[rs->in_len + i] = (int16_t)(uint16_t)(frame >> 16);
+	}
+	rs->in_len += ret;
+	rs->in_count += (uint64_t)ret;
+
+	/* Put silence after the last frame. */
+	if (ret < IN_FRAMES) {
+		memset(rs->in_l + rs->in_len, 0, TAPS / 2 * sizeof(int16_t));
+		memset(rs->in_r + rs->in_len, 0, TAPS / 2 * sizeof(int16_t));
+		rs->in_len += TAPS / 2;
+		rs->end = true;
+	}
+
+	return true;
+}
+
+/* Make a frame by the filter. */
+static uint32_t filter_frame(struct resampler *rs)
+{
+	const int16_t *c, *l, *r;
+	int phase;
+
+	/* Get the filter phase. */
+	phase = rs->phase;
+	if (rs->filter->phases != rs->l)
+		phase = (int)((int64_t)phase * rs->filter->phases / rs->l);
+
+	c = rs->filter->coef + phase * TAPS;
+	l = rs->in_l + rs->in_pos;
+	r = rs->in_r + rs->in_pos;
+
+#if defined(USE_SSE2_RESAMPLER)
+	{
+		__m128i c0, c1, sl, sr, s;
+
+		c0 = _mm_loadu_si128((const __m128i *)c);
+		c1 = _mm_loadu_si128((const __m128i *)(c + 8));
+		sl = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i *)l), c0),
+				   _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(l + 8)), c1));
+		sr = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i *)r), c0),
+				   _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(r + 8)), c1));
+
+		/* Sum the lanes into [L, R]. */
+		s = _mm_add_epi32(_mm_unpacklo_epi32(sl, sr), _mm_unpackhi_epi32(sl, sr));
+		s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+
+		/* Round and saturate. */
+		s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(COEF_ONE / 2)), 14);
+		s = _mm_packs_epi32(s, s);
+		return (uint32_t)_mm_cvtsi128_si32(s);
+	}
+#elif defined(USE_NEON_RESAMPLER)
+	{
+		int32x4_t sl, sr;
+		int32x2_t s;
+
+		sl = vmull_s16(vld1_s16(l), vld1_s16(c));
+		sl = vmlal_s16(sl, vld1_s16(l + 4), vld1_s16(c + 4));
+		sl = vmlal_s16(sl, vld1_s16(l + 8), vld1_s16(c + 8));
+		sl = vmlal_s16(sl, vld1_s16(l + 12), vld1_s16(c + 12));
+		sr = vmull_s16(vld1_s16(r), vld1_s16(c));
+		sr = vmlal_s16(sr, vld1_s16(r + 4), vld1_s16(c + 4));
+		sr = vmlal_s16(sr, vld1_s16(r + 8), vld1_s16(c + 8));
+		sr = vmlal_s16(sr, vld1_s16(r + 12), vld1_s16(c + 12));
+
+		/* Sum the lanes into [L, R]. */
+		s = vpadd_s32(vadd_s32(vget_low_s32(sl), vget_high_s32(sl)),
+			      vadd_s32(vget_low_s32(sr), vget_high_s32(sr)));
+
+		/* Round and saturate. */
+		return vget_lane_u32(vreinterpret_u32_s16(vqrshrn_n_s32(vcombine_s32(s, s), 14)), 0);
+	}
+#else
+	{
+		int32_t sl, sr;
+		int j;
+
+		sl = 0;
+		sr = 0;
+		for (j = 0; j < TAPS; j++) {
+			sl += (int32_t)l[j] * c[j];
+			sr += (int32_t)r[j] * c[j];
+		}
+
+		/* Round and saturate. */
+		sl = (sl + COEF_ONE / 2) >> 14;
+		sr = (sr + COEF_ONE / 2) >> 14;
+		sl = sl > 32767 ? 32767 : (sl < -32768 ? -32768 : sl);
+		sr = sr > 32767 ? 32767 : (sr < -32768 ? -32768 : sr);
+
+		return ((uint32_t)(uint16_t)(int16_t)sl) |
+		       (((uint32_t)(uint16_t)(int16_t)sr) << 16);
+	}
+#endif
+}
+
+/* Make a frame by linear interpolation. */
+static uint32_t interpolate_frame(struct resampler *rs)
+{
+	int32_t frac, l, r;
+	int i;
+
+	i = rs->in_pos + TAPS / 2 - 1;
+	frac = (int32_t)(((int64_t)rs->phase << 15) / rs->l);
+
+	l = rs->in_l[i] + (((rs->in_l[i + 1] - rs->in_l[i]) * frac) >> 15);
+	r = rs->in_r[i] + (((rs->in_r[i + 1] - rs->in_r[i]) * frac) >> 15);
+
+	return ((uint32_t)(uint16_t)(int16_t)l) |
+	       (((uint32_t)(uint16_t)(int16_t)r) << 16);
+}
@@ -0,0 +1,41 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Sample Rate Converter
+ */
+
+#ifndef PLATFORM_RESAMPLE_H
+#define PLATFORM_RESAMPLE_H
+
+#include "stratohal/platform.h"
+
+struct resampler;
+
+/*
+ * Input callback of a resampler.
+ *  - Fills 16-bit stereo frames of the input rate, and returns the count.
+ *  - A short count means the end of the input.
+ */
+typedef int (*resample_input_func)(void *p, uint32_t *buf, int frames);
+
+/*
+ * Create a resampler from a rate to another.
+ *  - The quality is the one set by set_sound_resample_quality().
+ */
+struct resampler *create_resampler(int in_rate, int out_rate);
+
+/* Destroy a resampler. */
+void destroy_resampler(struct resampler *rs);
+
+/*
+ * Get 16-bit stereo frames of the output rate.
+ *  - Returns a short count at the end of the input.
+ */
+int get_resampled_samples(struct resampler *rs, uint32_t *buf, int frames,
+			  resample_input_func input, void *p);
+
+#endif
@@ -18,6 +18,7 @@
 #define DRAW_IMAGE_RULE		draw_image_rule_scalar
 #define DRAW_IMAGE_MELT		draw_image_melt_scalar
 #define DRAW_IMAGE_SCALE	draw_image_scale_scalar
+#define DRAW_IMAGE_HALF		draw_image_half_scalar
 
 #include "drawimage.h"
 
@@ -6,10 +6,13 @@
 
 /*
  * HAL for OpenSL ES on Android
+ *  - The one-shot sounds are mixed by the software mixer, and played on
+ *    one more player with short buffers.
  */
 
 /* Base */
 #include "stratohal/platform.h"
+#include "mixer.h"
 
 /* OpenSLES */
 #include <SLES/OpenSLES.h>
@@ -32,6 +35,12 @@
 #define FRAME_SIZE		(4)
 #define BUF_FRAMES		(SAMPLING_RATE / 4)
 
+/*
+ * One-Shot Sound Buffer Parameters (Short to start a sound soon)
+ */
+#define EFFECT_FRAMES		(1024)
+#define EFFECT_BUFS		(2)
+
 /*
  * OpenSL ES Objects
  */
@@ -58,10 +67,21 @@ static float volume[SOUND_TRACKS];
 static bool pre_finish[SOUND_TRACKS];	 /* Shows if we reached an end-of-stream. */
 static bool post_finish[SOUND_TRACKS];	 /* Shows if we finished a playback of a final buffer. */
 
+/* One-Shot Sound Player */
+static SLObjectItf effect_player_object;
+static SLPlayItf effect_player_play;
+static SLAndroidSimpleBufferQueueItf effect_buffer_queue;
+static uint32_t effect_buf[EFFECT_BUFS][EFFECT_FRAMES];
+static int effect_buf_index;
+
+/* Mutex object to synchronize accesses to the mixer */
+static pthread_mutex_t effect_mutex;
+
 /*
  * Forward Declarations
  */
 static void play_callback(SLAndroidSimpleBufferQueueItf bq, void *context);
+static void effect_callback(SLAndroidSimpleBufferQueueItf bq, void *context);
 static void enqueue(int stream);
 static void scale_samples(uint32_t *buf, int frames, float vol);
 
@@ -106,6 +126,18 @@ void init_opensl_es(void)
 		(*bq_player_play[i])->SetCallbackEventsMask(bq_player_play[i], SL_PLAYEVENT_HEADATEND);
 		(*bq_player_play[i])->SetPlayState(bq_player_play[i], SL_PLAYSTATE_PLAYING);
 	}
+
+	/* Create a player for the one-shot sounds, and start it with silence. */
+	pthread_mutex_init(&effect_mutex, NULL);
+	mixer_reset();
+	(*engine_engine)->CreateAudioPlayer(engine_engine, &effect_player_object, &audio_src, &audioSnk, 1, bqids, bqreq);
+	(*effect_player_object)->Realize(effect_player_object, SL_BOOLEAN_FALSE);
+	(*effect_player_object)->GetInterface(effect_player_object, SL_IID_PLAY, &effect_player_play);
+	(*effect_player_object)->GetInterface(effect_player_object, SL_IID_BUFFERQUEUE, &effect_buffer_queue);
+	(*effect_buffer_queue)->RegisterCallback(effect_buffer_queue, effect_callback, NULL);
+	(*effect_player_play)->SetPlayState(effect_player_play, SL_PLAYSTATE_PLAYING);
+	for (int i = 0; i < EFFECT_BUFS; i++)
+		(*effect_buffer_queue)->Enqueue(effect_buffer_queue, effect_buf[i], sizeof(effect_buf[i]));
 }
 
 void sl_pause_sound(void)
@@ -114,6 +146,10 @@ void sl_pause_sound(void)
 		if (bq_player_play[i] != NULL)
 			(*bq_player_play[i])->SetPlayState(bq_player_play[i], SL_PLAYSTATE_STOPPED);
 	}
+
+	/* Pause to keep the buffer queue of the one-shot sounds. */
+	if (effect_player_play != NULL)
+		(*effect_player_play)->SetPlayState(effect_player_play, SL_PLAYSTATE_PAUSED);
 }
 
 void sl_resume_sound(void)
@@ -122,6 +158,9 @@ void sl_resume_sound(void)
 		if (bq_player_play[i] != NULL)
 			(*bq_player_play[i])->SetPlayState(bq_player_play[i], SL_PLAYSTATE_PLAYING);
 	}
+
+	if (effect_player_play != NULL)
+		(*effect_player_play)->SetPlayState(effect_player_play, SL_PLAYSTATE_PLAYING);
 }
 
 static void play_callback(SLAndroidSimpleBufferQueueItf bq, void *context)
@@ -133,6 +172,24 @@ static void play_callback(SLAndroidSimpleBufferQueueItf bq, void *context)
 	pthread_mutex_unlock(&sound_mutex[stream]);
 }
 
+static void effect_callback(SLAndroidSimpleBufferQueueItf bq, void *context)
+{
+	uint32_t *buf;
+
+	UNUSED_PARAMETER(context);
+
+	/* The buffers finish in the order of the enqueues. */
+	buf = effect_buf[effect_buf_index];
+	effect_buf_index = (effect_buf_index + 1) % EFFECT_BUFS;
+
+	/* Mix the one-shot sounds, or silence. */
+	pthread_mutex_lock(&effect_mutex);
+	mixer_mix_effects(buf, EFFECT_FRAMES);
+	pthread_mutex_unlock(&effect_mutex);
+
+	(*bq)->Enqueue(bq, buf, sizeof(effect_buf[0]));
+}
+
 static void enqueue(int stream)
 {
 	if (wave[stream] == NULL)
@@ -254,3 +311,66 @@ bool is_sound_finished(int stream)
 
 	return true;
 }
+
+bool fade_sound(int stream, float vol, int msec)
+{
+	/* Not supported. The caller sets the volume. */
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(vol);
+	UNUSED_PARAMETER(msec);
+	return false;
+}
+
+bool set_sound_pan(int stream, float pan)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(pan);
+	return false;
+}
+
+bool play_sound_effect(struct wave *w, float vol)
+{
+	/* Drop the sound if we have no output. */
+	if (effect_player_play == NULL) {
+		destroy_wave(w);
+		return true;
+	}
+
+	/* Mixed at the next effect_callback(). */
+	pthread_mutex_lock(&effect_mutex);
+	mixer_start_effect(w, vol);
+	pthread_mutex_unlock(&effect_mutex);
+
+	return true;
+}
+
+void stop_sound_effects(void)
+{
+	if (effect_player_play == NULL)
+		return;
+
+	pthread_mutex_lock(&effect_mutex);
+	mixer_stop_effects();
+	pthread_mutex_unlock(&effect_mutex);
+}
+
+void set_sound_buffer_config(int msec, int periods, bool low_latency)
+{
+	/* Not supported. */
+	UNUSED_PARAMETER(msec);
+	UNUSED_PARAMETER(periods);
+	UNUSED_PARAMETER(low_latency);
+}
+
+int get_sound_latency(void)
+{
+	/* Not measured. */
+	return -1;
+}
+
+void get_sound_stats(struct sound_stats *stats)
+{
+	/* Not measured. */
+	memset(stats, 0, sizeof(struct sound_stats));
+}
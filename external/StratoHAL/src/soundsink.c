@@ -0,0 +1,274 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Sound Sink (File and Null Outputs)
+ *  - A sink replaces the sound device, so that the mixer runs without
+ *    hardware, e.g., for benchmarks and loop checks on build machines.
+ *  - The WAV output writes the mixed frames to a file, and the null
+ *    output only counts them.
+ *  - The frames written are the virtual clock of the backend, which
+ *    paces the sink in real time or runs it as fast as possible.
+ *  - A sink is full at the output length or at the size limit of a WAV
+ *    file, so that a looping sound doesn't write without end.
+ */
+
+#include "stratohal/platform.h"
+#include "soundsink.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Format */
+#define SAMPLING_RATE	(44100)
+#define CHANNELS	(2)
+#define DEPTH		(16)
+#define FRAME_SIZE	(4)
+
+/* Size of the WAV header. */
+#define WAV_HEADER_SIZE	(44)
+
+/* Most frames of a WAV file. (The RIFF size is 32-bit.) */
+#define WAV_MAX_FRAMES	((0xffffffffUL - (WAV_HEADER_SIZE - 8)) / FRAME_SIZE)
+
+/* Default file of the WAV output. */
+#define DEFAULT_FILE	"sound.wav"
+
+/* Frames converted at once. */
+#define CHUNK_FRAMES	(1024)
+
+/* Output config. (Set before init_sound()) */
+static int output;
+static char *output_file;
+static bool output_realtime = true;
+static int output_msec;
+
+/* WAV file. (NULL for the null output) */
+static FILE *fp;
+
+/* Has a write failed? */
+static bool write_error;
+
+/* Frames written. */
+static uint64_t frame_count;
+
+/* Frames to write until the sink is full. (0 for no limit) */
+static uint64_t frame_limit;
+
+/* Little endian bytes of the frames. */
+static unsigned char chunk_buf[CHUNK_FRAMES * FRAME_SIZE];
+
+/* Forward Declaration */
+static void finish_file(void);
+static bool write_header(void);
+static void set_u16(unsigned char *p, uint32_t v);
+static void set_u32(unsigned char *p, uint32_t v);
+
+/*
+ * Select the sound output.
+ */
+void set_sound_output(int type, const char *file, bool realtime, int msec)
+{
+	if (type != SOUND_OUTPUT_WAV && type != SOUND_OUTPUT_NULL)
+		type = SOUND_OUTPUT_DEVICE;
+
+	output = type;
+	output_realtime = realtime;
+	output_msec = msec > 0 ? msec : 0;
+
+	if (output_file != NULL) {
+		free(output_file);
+		output_file = NULL;
+	}
+	if (file != NULL) {
+		output_file = strdup(file);
+		if (output_file == NULL)
+			log_out_of_memory();
+	}
+}
+
+/*
+ * Get the selected sound output.
+ */
+int get_sound_output(void)
+{
+	return output;
+}
+
+/*
+ * Check if the sink is paced in real time.
+ */
+bool is_sound_output_realtime(void)
+{
+	return output_realtime;
+}
+
+/*
+ * Open the sink.
+ */
+bool open_sound_sink(void)
+{
+	const char *file;
+
+	frame_count = 0;
+	write_error = false;
+
+	/* Get the frames to write. */
+	frame_limit = (uint64_t)output_msec * SAMPLING_RATE / 1000;
+	if (output == SOUND_OUTPUT_WAV &&
+	    (frame_limit == 0 || frame_limit > WAV_MAX_FRAMES))
+		frame_limit = WAV_MAX_FRAMES;
+
+	if (output != SOUND_OUTPUT_WAV) {
+		log_info("Sound output: null (%s).",
+			 output_realtime ? "real time" : "fast");
+		return true;
+	}
+
+	file = output_file != NULL ? output_file : DEFAULT_FILE;
+	fp = fopen(file, "wb");
+	if (fp == NULL) {
+		log_error("Cannot open \"%s\".", file);
+		return false;
+	}
+
+	/* Write a header with the sizes unknown yet. */
+	if (!write_header()) {
+		log_error("Cannot write to \"%s\".", file);
+		fclose(fp);
+		fp = NULL;
+		return false;
+	}
+
+	log_info("Sound output: \"%s\" (%s).", file,
+		 output_realtime ? "real time" : "fast");
+
+	return true;
+}
+
+/*
+ * Write frames to the sink.
+ */
+bool write_sound_sink(const uint32_t *buf, int frames)
+{
+	int len, i;
+
+	/* Discard the frames over the limit. */
+	if (frame_limit > 0 && (uint64_t)frames > frame_limit - frame_count)
+		frames = (int)(frame_limit - frame_count);
+
+	frame_count += (uint64_t)frames;
+
+	if (fp == NULL || write_error)
+		return !write_error;
+
+	/* Write in little endian. */
+	while (frames > 0) {
+		len = frames > CHUNK_FRAMES ? CHUNK_FRAMES : frames;
+		for (i = 0; i < len; i++)
+			set_u32(chunk_buf + i * FRAME_SIZE, buf[i]);
+		if (fwrite(chunk_buf, FRAME_SIZE, (size_t)len, fp) != (size_t)len) {
+			write_error = true;
+			return false;
+		}
+		buf += len;
+		frames -= len;
+	}
+
+	/* Finish the file now, so that it is valid even if killed. */
+	if (is_sound_sink_full()) {
+		finish_file();
+		return !write_error;
+	}
+
+	return true;
+}
+
+/*
+ * Check if the sink is full.
+ */
+bool is_sound_sink_full(void)
+{
+	return frame_limit > 0 && frame_count >= frame_limit;
+}
+
+/*
+ * Get the frames written.
+ */
+uint64_t get_sound_sink_frames(void)
+{
+	return frame_count;
+}
+
+/*
+ * Close the sink.
+ */
+void close_sound_sink(void)
+{
+	if (fp != NULL)
+		finish_file();
+
+	if (write_error)
+		log_error("Cannot write the sound output file.");
+}
+
+/* Rewrite the header with the sizes, and close the file. (Doesn't log) */
+static void finish_file(void)
+{
+	if (write_error || fseek(fp, 0, SEEK_SET) != 0 || !write_header())
+		write_error = true;
+
+	fclose(fp);
+	fp = NULL;
+}
+
+/* Write the WAV header for the frames written. */
+static bool write_header(void)
+{
+	unsigned char h[WAV_HEADER_SIZE];
+	uint64_t size;
+	uint32_t data_size;
+
+	/* The frames are up to WAV_MAX_FRAMES. */
+	size = frame_count * FRAME_SIZE;
+	data_size = (uint32_t)size;
+
+	memcpy(h, "RIFF", 4);
+	set_u32(h + 4, data_size + (WAV_HEADER_SIZE - 8));
+	memcpy(h + 8, "WAVE", 4);
+	memcpy(h + 12, "fmt ", 4);
+	set_u32(h + 16, 16);				/* fmt chunk size */
+	set_u16(h + 20, 1);				/* PCM */
+	set_u16(h + 22, CHANNELS);
+	set_u32(h + 24, SAMPLING_RATE);
+	set_u32(h + 28, SAMPLING_RATE * FRAME_SIZE);	/* bytes per second */
+	set_u16(h + 32, FRAME_SIZE);			/* block align */
+	set_u16(h + 34, DEPTH);
+	memcpy(h + 36, "data", 4);
+	set_u32(h + 40, data_size);
+
+	if (fwrite(h, 1, sizeof(h), fp) != sizeof(h))
+		return false;
+
+	return true;
+}
+
+/* Store a 16-bit value in little endian. */
+static void set_u16(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)((v >> 8) & 0xff);
+}
+
+/* Store a 32-bit value in little endian. */
+static void set_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)((v >> 8) & 0xff);
+	p[2] = (unsigned char)((v >> 16) & 0xff);
+	p[3] = (unsigned char)((v >> 24) & 0xff);
+}
@@ -0,0 +1,43 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Sound Sink (File and Null Outputs)
+ */
+
+#ifndef PLATFORM_SOUNDSINK_H
+#define PLATFORM_SOUNDSINK_H
+
+#include "stratohal/platform.h"
+
+/* Get the output selected by set_sound_output(). */
+int get_sound_output(void);
+
+/* Check if the output of a sink is paced in real time. */
+bool is_sound_output_realtime(void);
+
+/* Open the sink of the selected output. (SOUND_OUTPUT_WAV or SOUND_OUTPUT_NULL) */
+bool open_sound_sink(void);
+
+/*
+ * Write 44.1kHz 16-bit stereo frames to the sink.
+ *  - Called on the output thread, so this doesn't log.
+ *  - Returns false on a write error, and the later frames are discarded.
+ *  - The frames after the sink is full are also discarded, and the WAV
+ *    file is finished at that time.
+ */
+bool write_sound_sink(const uint32_t *buf, int frames);
+
+/* Check if the sink reached the length of the output or of a WAV file. */
+bool is_sound_sink_full(void);
+
+/* Get the frames written to the sink. (The virtual clock) */
+uint64_t get_sound_sink_frames(void);
+
+/* Close the sink, and finish the WAV header. */
+void close_sound_sink(void);
+
+#endif
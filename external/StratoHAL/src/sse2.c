@@ -18,6 +18,7 @@
 #define DRAW_IMAGE_RULE		draw_image_rule_sse2
 #define DRAW_IMAGE_MELT		draw_image_melt_sse2
 #define DRAW_IMAGE_SCALE	draw_image_scale_sse2
+#define DRAW_IMAGE_HALF		draw_image_half_sse2
 
 #include "drawimage.h"
 
@@ -20,6 +20,10 @@
  *     } [file_count];
  * };
  * u8 file_body[file_count][file_length]; // Obfuscated
+ *
+ * Entries with the same content share one body. Such entries have the
+ * same file_offset and file_size, and the body is obfuscated with the
+ * seed of the first entry that refers to it.
  */
 
 #include "stratohal/platform.h"
@@ -72,6 +76,9 @@ static const uint64_t NEXT_MASK2 = 0xfcbfaff8f2f4f3f0;
 /* File name length for an entry. */
 #define FILE_NAME_SIZE		(256)
 
+/* Read-ahead buffer size of a read stream. */
+#define READ_BUF_SIZE		(4096)
+
 /* Package file entry. */
 struct file_entry {
 	/* File name. */
@@ -82,6 +89,9 @@ struct file_entry {
 
 	/* Offset in the package file. */
 	uint64_t offset;
+
+	/* Index of the entry that owns the body. (not stored in a package) */
+	uint64_t body;
 };
 
 /* Package file path. */
@@ -108,13 +118,17 @@ struct rfile {
 
 	/* Obfuscation parameters */
 	uint64_t next_random;
-	uint64_t prev_random;
 
 	/* Effective for a packaged file: */
 	uint64_t index;
 	uint64_t size;
 	uint64_t offset;
 	uint64_t pos;
+
+	/* Read-ahead buffer (already decoded) */
+	size_t buf_len;
+	size_t buf_pos;
+	char buf[READ_BUF_SIZE];
 };
 
 /*
@@ -129,13 +143,17 @@ struct wfile {
  * Forward declarations.
  */
 static bool open_package(struct rfile *rf, const char *path);
+static void resolve_shared_bodies(void);
+static int search_entry(const char *path);
 #if !defined(TARGET_IOS) && !defined(TARGET_WASM)
 static bool open_real(struct rfile *rf, const char *path);
 #endif
-static void ungetc_rfile(struct rfile *rf, char c);
+static size_t read_rfile_direct(struct rfile *rf, void *buf, size_t size);
+static bool fill_rfile_buffer(struct rfile *rf);
+static bool getc_rfile(struct rfile *rf, char *c);
+static void ungetc_rfile(struct rfile *rf);
 static void set_random_seed(uint64_t index, uint64_t *next_random);
-static char get_next_random(uint64_t *next_random, uint64_t *prev_random);
-static void rewind_random(uint64_t *next_random, uint64_t *prev_random);
+static char get_next_random(uint64_t *next_random);
 
 /*
  * Initialize the stdfile module.
@@ -189,7 +207,7 @@ bool init_file(void)
 			break;
 		set_random_seed(i, &next_random);
 		for (j = 0; j < FILE_NAME_SIZE; j++)
-			entry[i].name[j] ^= get_next_random(&next_random, NULL);
+			entry[i].name[j] ^= get_next_random(&next_random);
 		if (fread(&entry[i].size, sizeof(uint64_t), 1, fp) < 1)
 			break;
 		if (fread(&entry[i].offset, sizeof(uint64_t), 1, fp) < 1)
@@ -201,6 +219,9 @@ bool init_file(void)
 		return false;
 	}
 
+	/* Find the entries that share a body. */
+	resolve_shared_bodies();
+
 	/*
 	 * Close the package for now;
 	 * we will reopen a FILE pointer per an input stream.
@@ -210,6 +231,34 @@ bool init_file(void)
 	return true;
 }
 
+/* Find the owner entry of each body. */
+static void resolve_shared_bodies(void)
+{
+	uint64_t i, j, end;
+
+	/*
+	 * Bodies are stored in the entry order, so an entry that owns a
+	 * body always starts at or after the end of the previous bodies.
+	 * An entry that points backward shares a body of a previous entry.
+	 */
+	end = 0;
+	for (i = 0; i < entry_count; i++) {
+		entry[i].body = i;
+		if (entry[i].offset >= end) {
+			end = entry[i].offset + entry[i].size;
+			continue;
+		}
+		for (j = 0; j < i; j++) {
+			if (entry[j].body == j &&
+			    entry[j].offset == entry[i].offset &&
+			    entry[j].size == entry[i].size) {
+				entry[i].body = j;
+				break;
+			}
+		}
+	}
+}
+
 /*
  * Cleanup the stdfile module.
  */
@@ -227,16 +276,13 @@ void cleanup_file(void)
 bool check_file_exist(const char *file)
 {
 	FILE *fp;
-	uint64_t i;
 
 	/* If we're using a package file. */
 	if (package_path != NULL) {
 		/* Check whether a file entry exists in the package. */
-		for (i = 0; i < entry_count; i++) {
-			if (strcasecmp(entry[i].name, file) == 0) {
-				/* Entry exists. */
-				return true;
-			}
+		if (search_entry(file) != -1) {
+			/* Entry exists. */
+			return true;
 		}
 	}
 
@@ -271,6 +317,38 @@ bool check_file_exist(const char *file)
 #endif
 }
 
+/*
+ * Get a canonical file name.
+ *  - Files that share the same content in a package have the same canonical name.
+ */
+const char *get_canonical_file_name(const char *file)
+{
+	int index;
+
+	if (package_path == NULL)
+		return file;
+
+	index = search_entry(file);
+	if (index == -1)
+		return file;
+
+	return entry[entry[index].body].name;
+}
+
+/* Search a file entry in the package. */
+static int search_entry(const char *path)
+{
+	uint64_t i;
+
+	for (i = 0; i < entry_count; i++) {
+		if (strcasecmp(entry[i].name, path) == 0)
+			return (int)i;
+	}
+
+	/* Not found. */
+	return -1;
+}
+
 /*
  * Open a read file stream.
  */
@@ -316,19 +394,20 @@ bool open_rfile(const char *path, struct rfile **f)
 /* Open a file in the package. */
 static bool open_package(struct rfile *f, const char *path)
 {
+	int index;
 	uint64_t i;
-		
+
 	/* Search a file entry on the package. */
-	for (i = 0; i < entry_count; i++) {
-		if (strcasecmp(entry[i].name, path) == 0)
-			break;
-	}
-	if (i == entry_count) {
+	index = search_entry(path);
+	if (index == -1) {
 		/* Not found. */
 		//log_error("Cannot open file \"%s\".", path);
 		return false;
 	}
 
+	/* Use the entry that owns the body for the obfuscation seed. */
+	i = entry[index].body;
+
 	/* Open a new FILE pointer to the package file. */
 #ifdef TARGET_WINDOWS
 	_fmode = _O_BINARY;
@@ -355,8 +434,9 @@ static bool open_package(struct rfile *f, const char *path)
 	f->size = entry[i].size;
 	f->offset = entry[i].offset;
 	f->pos = 0;
+	f->buf_len = 0;
+	f->buf_pos = 0;
 	set_random_seed(i, &f->next_random);
-	f->prev_random = 0;
 
 	return true;
 }
@@ -384,6 +464,8 @@ static bool open_real(struct rfile *f, const char *path)
 		return false;
 
 	f->is_packaged = false;
+	f->buf_len = 0;
+	f->buf_pos = 0;
 	return true;
 }
 #endif
@@ -415,11 +497,50 @@ bool get_rfile_size(struct rfile *f, size_t *ret)
  */
 bool read_rfile(struct rfile *f, void *buf, size_t size, size_t *ret)
 {
-	size_t len, obf;
+	char *dst;
+	size_t len, avail;
 
 	assert(f != NULL);
 	assert(f->fp != NULL);
 
+	dst = buf;
+	len = 0;
+	while (len < size) {
+		/* Serve from the read-ahead buffer. */
+		avail = f->buf_len - f->buf_pos;
+		if (avail > 0) {
+			if (avail > size - len)
+				avail = size - len;
+			memcpy(dst + len, f->buf + f->buf_pos, avail);
+			f->buf_pos += avail;
+			len += avail;
+			continue;
+		}
+
+		/* Read a large remainder directly into the destination. */
+		if (size - len >= READ_BUF_SIZE) {
+			avail = read_rfile_direct(f, dst + len, size - len);
+			len += avail;
+			break;
+		}
+
+		/* Refill the buffer. */
+		if (!fill_rfile_buffer(f))
+			break;
+	}
+
+	*ret = len;
+	if (len == 0)
+		return false;
+
+	return true;
+}
+
+/* Read bytes from the underlying FILE pointer, and decode them. */
+static size_t read_rfile_direct(struct rfile *f, void *buf, size_t size)
+{
+	size_t len, obf;
+
 	if (f->is_packaged) {
 		/*
 		 * For the case f points to a package entry.
@@ -429,13 +550,13 @@ bool read_rfile(struct rfile *f, void *buf, size_t size, size_t *ret)
 		if (f->pos + size > f->size)
 			size = (size_t)(f->size - f->pos);
 		if (size == 0)
-			return false;
+			return 0;
 		len = fread(buf, 1, size, f->fp);
 		f->pos += len;
 
 		/* Do obfuscation decode. */
 		for (obf = 0; obf < len; obf++)
-			*(((char *)buf) + obf) ^= get_next_random(&f->next_random, &f->prev_random);
+			*(((char *)buf) + obf) ^= get_next_random(&f->next_random);
 	} else {
 		/*
 		 * For the case f points to a real file.
@@ -445,8 +566,15 @@ bool read_rfile(struct rfile *f, void *buf, size_t size, size_t *ret)
 		len = fread(buf, 1, size, f->fp);
 	}
 
-	*ret = len;
-	if (len == 0)
+	return len;
+}
+
+/* Refill the read-ahead buffer. */
+static bool fill_rfile_buffer(struct rfile *f)
+{
+	f->buf_len = read_rfile_direct(f, f->buf, READ_BUF_SIZE);
+	f->buf_pos = 0;
+	if (f->buf_len == 0)
 		return false;
 
 	return true;
@@ -520,7 +648,7 @@ bool get_rfile_u8(struct rfile *f, uint8_t *data)
 bool get_rfile_string(struct rfile *f, char *buf, size_t size)
 {
 	char *ptr;
-	size_t len, read_size;
+	size_t len;
 	char c;
 
 	assert(f != NULL);
@@ -530,7 +658,7 @@ bool get_rfile_string(struct rfile *f, char *buf, size_t size)
 
 	ptr = buf;
 	for (len = 0; len < size - 1; len++) {
-		if (!read_rfile(f, &c, 1, &read_size)) {
+		if (!getc_rfile(f, &c)) {
 			*ptr = '\0';
 			if (len == 0)
 				return false;
@@ -541,7 +669,7 @@ bool get_rfile_string(struct rfile *f, char *buf, size_t size)
 			return true;
 		}
 		if (c == '\r') {
-			if (!read_rfile(f, &c, 1, &read_size)) {
+			if (!getc_rfile(f, &c)) {
 				*ptr = '\0';
 				return true;
 			}
@@ -549,7 +677,7 @@ bool get_rfile_string(struct rfile *f, char *buf, size_t size)
 				*ptr = '\0';
 				return true;
 			}
-			ungetc_rfile(f, c);
+			ungetc_rfile(f);
 			*ptr = '\0';
 			return true;
 		}
@@ -563,22 +691,26 @@ bool get_rfile_string(struct rfile *f, char *buf, size_t size)
 	return true;
 }
 
-/* Push back a character to a read file stream. */
-static void ungetc_rfile(struct rfile *f, char c)
+/* Get a character from a read file stream. */
+static INLINE bool getc_rfile(struct rfile *f, char *c)
+{
+	if (f->buf_pos == f->buf_len) {
+		if (!fill_rfile_buffer(f))
+			return false;
+	}
+
+	*c = f->buf[f->buf_pos++];
+	return true;
+}
+
+/* Push back the last character to a read file stream. */
+static void ungetc_rfile(struct rfile *f)
 {
 	assert(f != NULL);
-	assert(f->fp != NULL);
+	assert(f->buf_pos > 0);
 
-	if (f->is_packaged) {
-		/* If f points to a package entry. */
-		assert(f->pos != 0);
-		ungetc(c, f->fp);
-		f->pos--;
-		rewind_random(&f->next_random, &f->prev_random);
-	} else {
-		/* If f points to a real file. */
-		ungetc(c, f->fp);
-	}
+	/* The last character is always in the buffer. */
+	f->buf_pos--;
 }
 
 /*
@@ -606,12 +738,15 @@ void rewind_rfile(struct rfile *f)
 		fseek(f->fp, (long)f->offset, SEEK_SET);
 		f->pos = 0;
 		set_random_seed(f->index, &f->next_random);
-		f->prev_random = 0;
 	} else {
 		/* If f points to a real file. */
 		rewind(f->fp);
 		f->pos = 0;
 	}
+
+	/* Discard the read-ahead buffer. */
+	f->buf_len = 0;
+	f->buf_pos = 0;
 }
 
 /* Set a random seed. */
@@ -640,15 +775,11 @@ static void set_random_seed(uint64_t index, uint64_t *next_random)
 }
 
 /* Get a next random mask. */
-static char get_next_random(uint64_t *next_random, uint64_t *prev_random)
+static char get_next_random(uint64_t *next_random)
 {
 	uint64_t next;
 	char ret;
 
-	/* For ungetc(). */
-	if (prev_random != NULL)
-		*prev_random = *next_random;
-
 	ret = (char)(*next_random);
 	next = *next_random;
 	next = (((~(*key_ref) & 0xff00) * next + (~(*key_ref) & 0xff)) %
@@ -658,13 +789,6 @@ static char get_next_random(uint64_t *next_random, uint64_t *prev_random)
 	return ret;
 }
 
-/* Go back to the previous random mask. */
-static void rewind_random(uint64_t *next_random, uint64_t *prev_random)
-{
-	*next_random = *prev_random;
-	*prev_random = 0;
-}
-
 /*
  * Write
  */
@@ -737,7 +861,7 @@ bool write_wfile(struct wfile *wf, const void *buf, size_t size, size_t *ret)
 
 		/* Obfuscate the block. */
 		for (i = 0; i < block_size; i++)
-			obf[i] = *src++ ^ get_next_random(&wf->next_random, NULL);
+			obf[i] = *src++ ^ get_next_random(&wf->next_random);
 
 		/* Write the block to the stream. */
 		out = fwrite(obf, 1, block_size, wf->fp);
@@ -5,11 +5,19 @@
  */
 
 /*
- * Ogg Vorbis Input Stream
+ * Sound Input Stream
+ *  - Plays Ogg Vorbis files, RIFF WAV files (16-bit PCM and 32-bit float,
+ *    mono or stereo), and raw PCM files (".pcm", 44.1kHz 16-bit stereo).
+ *  - An Ogg Vorbis file and a small PCM file are held in memory. The
+ *    samples of a PCM file are kept as in the file and converted to
+ *    16-bit stereo on each read.
+ *  - A large PCM file is streamed from an rfile.
  */
 
 #include "stratohal/platform.h"
+#include "resample.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -33,17 +41,66 @@
 #define SAMPLING_RATE	(44100)
 #define IOSIZE		(4096)
 
+/* File formats. (FORMAT_NONE until the file is opened) */
+#define FORMAT_NONE	(0)
+#define FORMAT_VORBIS	(1)
+#define FORMAT_PCM16	(2)
+#define FORMAT_FLOAT32	(3)
+
+/* Largest PCM file held in memory. (Larger ones are streamed unless looping.) */
+#define PCM_MEMORY_SIZE	(1024 * 1024)
+
+/* Extension of raw PCM files. */
+#define RAW_EXT		".pcm"
+
+/* WAV format tags. */
+#define WAV_PCM		(0x0001)
+#define WAV_FLOAT	(0x0003)
+#define WAV_EXTENSIBLE	(0xfffe)
+
 /*
  * PCM stream with a format of 44.1kHz, 16bit, stereo
  */
 struct wave {
 	/* Input file. */
 	char *file;
-	struct rfile *rf;
 	bool loop;
 	uint32_t loop_start;
 	uint32_t loop_length;
 	bool monaural;
+	int rate;
+
+	/* File format. (FORMAT_*) */
+	int format;
+
+	/* Sampling rate converter. (NULL for 44.1kHz files) */
+	struct resampler *rs;
+
+	/*
+	 * File in memory.
+	 *  - An Ogg Vorbis file is held so that vorbisfile can seek in it
+	 *    for loops. (An rfile cannot seek, and a packaged one is
+	 *    obfuscated.)
+	 *  - data_pos is also the byte position of a streamed file.
+	 */
+	unsigned char *data;
+	size_t data_size;
+	size_t data_pos;
+
+	/* Streamed PCM file. (NULL if in memory) */
+	struct rfile *rf;
+	size_t rf_size;
+
+	/*
+	 * PCM data chunk.
+	 *  - The frames of pcm_frame_size bytes start at pcm_offset.
+	 *  - pcm_pos is the next frame to read, which differs from pos
+	 *    while the crossfade frames are read.
+	 */
+	size_t pcm_offset;
+	ogg_int64_t pcm_frames;
+	int pcm_frame_size;
+	ogg_int64_t pcm_pos;
 
 	/*
 	 * Enabled when loop=true.
@@ -55,21 +112,55 @@ struct wave {
 	/* Status. */
 	bool eos;
 	bool err;
-	bool do_skip;
-	long consumed_bytes;
+
+	/* Current frame position. */
+	ogg_int64_t pos;
+
+	/* Frame position where a loop goes back to loop_start. */
+	ogg_int64_t loop_end;
+
+	/* Frames after loop_start, which are crossfaded into the loop end. */
+	uint32_t *xfade_buf;
+	int xfade_frames;
 
 	/* Vorbis object. */
 	OggVorbis_File ovf;
+
+	/* Frames in memory. (NULL if decoded from the file) */
+	const uint32_t *frames;
+	int frame_count;
+	int frame_pos;
 };
 
 /*
  * Forward declarations.
  */
-static bool reopen(struct wave *w, bool loop);
+static bool open_file(struct wave *w, bool *is_pcm);
+static bool is_raw_file(const char *fname);
+static bool load_file(struct wave *w);
+static bool load_streamed_file(struct wave *w);
+static bool open_vorbis(struct wave *w, ogg_int64_t *total);
+static bool open_riff(struct wave *w, ogg_int64_t *total);
+static bool open_raw(struct wave *w, ogg_int64_t *total);
+static bool read_input(struct wave *w, void *buf, size_t size);
+static bool skip_input(struct wave *w, size_t size);
+static const unsigned char *get_input(struct wave *w, size_t size, unsigned char *tmp, size_t *ret);
+static uint32_t get_u32(const unsigned char *p);
+static uint16_t get_u16(const unsigned char *p);
+static void free_wave(struct wave *w);
 static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource);
-static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples);
-static int get_wave_samples_stereo(struct wave *w, uint32_t *buf, int samples);
-static void skip_if_needed(struct wave *w, int sample_bytes);
+static int seek_func(void *datasource, ogg_int64_t offset, int whence);
+static long tell_func(void *datasource);
+static bool is_looping(struct wave *w);
+static bool loop_back(struct wave *w);
+static bool seek_frames(struct wave *w, ogg_int64_t pos, bool lap);
+static int decode_frames(struct wave *w, uint32_t *buf, int frames);
+static int read_pcm_frames(struct wave *w, uint32_t *buf, int frames);
+static int16_t float_to_s16(uint32_t bits);
+static void crossfade_frames(struct wave *w, uint32_t *buf, int frames);
+static int get_wave_samples_file(struct wave *w, uint32_t *buf, int samples);
+static int read_resampler_input(void *p, uint32_t *buf, int frames);
+static int get_wave_samples_memory(struct wave *w, uint32_t *buf, int samples);
 
 /*
  * Create a PCM stream from a file.
@@ -77,21 +168,8 @@ static void skip_if_needed(struct wave *w, int sample_bytes);
 struct wave *create_wave_from_file(const char *fname, bool loop)
 {
 	struct wave *w;
-	vorbis_info *vi;
-	vorbis_comment *vc;
-	int i;
-
-	const char *LOOPSTART = "LOOPSTART=";
-	const char *LOOPLENGTH = "LOOPLENGTH=";
-	const size_t LOOPSTART_LEN = strlen(LOOPSTART);
-	const size_t LOOPLENGTH_LEN = strlen(LOOPLENGTH);
-
-	UNUSED_PARAMETER(OV_CALLBACKS_STREAMONLY_NOCLOSE);
-	UNUSED_PARAMETER(OV_CALLBACKS_STREAMONLY);
-	UNUSED_PARAMETER(OV_CALLBACKS_STREAMONLY);
-	UNUSED_PARAMETER(OV_CALLBACKS_NOCLOSE);
-	UNUSED_PARAMETER(OV_CALLBACKS_NOCLOSE);
-	UNUSED_PARAMETER(OV_CALLBACKS_DEFAULT);
+	ogg_int64_t total;
+	bool is_pcm, ret;
 
 	/* Alloc a wave struct. */
 	w = malloc(sizeof(struct wave));
@@ -109,23 +187,102 @@ struct wave *create_wave_from_file(const char *fname, bool loop)
 		return NULL;
 	}
 
-	/* Open a file. */
-	if (!reopen(w, false))
-		return NULL;
-
-	/* TODO: Check sampling rate and channel count by using ov_info(). */
-	vi = ov_info(&w->ovf, -1);
-	w->monaural = vi->channels == 1 ? true : false;
-
-	/* Alloc a wave struct. */
+	/* Setup the status. (The loop tags of the file may set the loop.) */
 	w->loop = loop;
 	w->loop_start = 0;
 	w->loop_length = 0;
 	w->times = -1;
 	w->eos = false;
 	w->err = false;
-	w->do_skip = false;
-	w->consumed_bytes = 0;
+	w->pos = 0;
+
+	/* Read or open the file, and open the format. */
+	if (!open_file(w, &is_pcm)) {
+		free_wave(w);
+		return NULL;
+	}
+	if (!is_pcm)
+		ret = open_vorbis(w, &total);
+	else if (is_raw_file(w->file))
+		ret = open_raw(w, &total);
+	else
+		ret = open_riff(w, &total);
+	if (!ret) {
+		free_wave(w);
+		return NULL;
+	}
+
+	/* Hold the file in memory if its "smpl" chunk enabled the loop. */
+	if (w->loop && w->rf != NULL && !load_streamed_file(w)) {
+		free_wave(w);
+		return NULL;
+	}
+
+	/* Convert the sampling rate if not 44.1kHz. */
+	if (w->rate != SAMPLING_RATE) {
+		w->rs = create_resampler(w->rate, SAMPLING_RATE);
+		if (w->rs == NULL) {
+			free_wave(w);
+			return NULL;
+		}
+	}
+
+	/* Get the loop end. (LOOPLENGTH, or the end of the file) */
+	w->loop_end = total;
+	if (w->loop_length > 0 && (ogg_int64_t)w->loop_start + w->loop_length < total)
+		w->loop_end = (ogg_int64_t)w->loop_start + w->loop_length;
+	if (w->loop && (total <= 0 || (ogg_int64_t)w->loop_start >= w->loop_end)) {
+		log_warn("Invalid loop point (%s).", w->file);
+		w->loop = false;
+	}
+
+	/* Succeeded. */
+	return w;
+}
+
+/*
+ * Open an Ogg Vorbis file in memory.
+ *  - Sets the channels, the rate, the loop tags, and the total frames.
+ */
+static bool open_vorbis(struct wave *w, ogg_int64_t *total)
+{
+	vorbis_info *vi;
+	vorbis_comment *vc;
+	ov_callbacks cb;
+	int i;
+
+	const char *LOOPSTART = "LOOPSTART=";
+	const char *LOOPLENGTH = "LOOPLENGTH=";
+	const size_t LOOPSTART_LEN = strlen(LOOPSTART);
+	const size_t LOOPLENGTH_LEN = strlen(LOOPLENGTH);
+
+	UNUSED_PARAMETER(OV_CALLBACKS_STREAMONLY_NOCLOSE);
+	UNUSED_PARAMETER(OV_CALLBACKS_STREAMONLY);
+	UNUSED_PARAMETER(OV_CALLBACKS_STREAMONLY);
+	UNUSED_PARAMETER(OV_CALLBACKS_NOCLOSE);
+	UNUSED_PARAMETER(OV_CALLBACKS_NOCLOSE);
+	UNUSED_PARAMETER(OV_CALLBACKS_DEFAULT);
+
+	/* Open the file by seekable callbacks. */
+	memset(&cb, 0, sizeof(cb));
+	cb.read_func = read_func;
+	cb.seek_func = seek_func;
+	cb.close_func = NULL;
+	cb.tell_func = tell_func;
+	if (ov_open_callbacks(w, &w->ovf, NULL, 0, cb) != 0) {
+		log_error("Audio file format error (%s).", w->file);
+		return false;
+	}
+	w->format = FORMAT_VORBIS;
+
+	/* Check the channel count. */
+	vi = ov_info(&w->ovf, -1);
+	if (vi->channels != 1 && vi->channels != 2) {
+		log_error("Audio file format error (%s).", w->file);
+		return false;
+	}
+	w->monaural = vi->channels == 1 ? true : false;
+	w->rate = (int)vi->rate;
 
 	/* Get LOOPSTART and LOOPLENGTH. */
 	vc = ov_comment(&w->ovf, -1);
@@ -141,51 +298,380 @@ struct wave *create_wave_from_file(const char *fname, bool loop)
 		}
 	}
 
-	/* Succeeded. */
+	*total = ov_pcm_total(&w->ovf, -1);
+
+	return true;
+}
+
+/*
+ * Open a RIFF WAV file.
+ *  - The first loop of a "smpl" chunk is the loop, as LOOPSTART and
+ *    LOOPLENGTH of an Ogg Vorbis file.
+ *  - A streamed file is not read beyond the data chunk, so that its
+ *    "smpl" chunk must be placed before the data chunk.
+ */
+static bool open_riff(struct wave *w, ogg_int64_t *total)
+{
+	unsigned char hdr[12], fmt[26], smpl[52];
+	size_t size, len, file_size, data_bytes;
+	uint32_t chunk_size, start, end;
+	int tag, channels, bits, block;
+	bool has_fmt, has_data;
+
+	file_size = w->rf != NULL ? w->rf_size : w->data_size;
+
+	/* Check the RIFF header. */
+	if (!read_input(w, hdr, 12) ||
+	    memcmp(hdr, "RIFF", 4) != 0 ||
+	    memcmp(hdr + 8, "WAVE", 4) != 0) {
+		log_error("Audio file format error (%s).", w->file);
+		return false;
+	}
+
+	/* Walk the chunks. */
+	has_fmt = false;
+	has_data = false;
+	data_bytes = 0;
+	tag = channels = bits = block = 0;
+	while (read_input(w, hdr, 8)) {
+		chunk_size = get_u32(hdr + 4);
+		size = (size_t)chunk_size + (chunk_size & 1);
+
+		if (memcmp(hdr, "fmt ", 4) == 0 && chunk_size >= 16) {
+			/* Format. (The extensible one has the tag in its GUID.) */
+			len = chunk_size >= sizeof(fmt) ? sizeof(fmt) : 16;
+			if (!read_input(w, fmt, len))
+				break;
+			size -= len;
+			tag = get_u16(fmt);
+			channels = get_u16(fmt + 2);
+			w->rate = (int)get_u32(fmt + 4);
+			block = get_u16(fmt + 12);
+			bits = get_u16(fmt + 14);
+			if (tag == WAV_EXTENSIBLE && len == sizeof(fmt))
+				tag = get_u16(fmt + 24);
+			has_fmt = true;
+		} else if (memcmp(hdr, "smpl", 4) == 0 && chunk_size >= sizeof(smpl)) {
+			/* The first sample loop. (The end is inclusive.) */
+			if (!read_input(w, smpl, sizeof(smpl)))
+				break;
+			size -= sizeof(smpl);
+			start = get_u32(smpl + 44);
+			end = get_u32(smpl + 48);
+			if (get_u32(smpl + 28) > 0 && end >= start) {
+				w->loop = true;
+				w->loop_start = start;
+				w->loop_length = end - start + 1;
+			}
+		} else if (memcmp(hdr, "data", 4) == 0) {
+			/* Samples. (Truncated files play to the end.) */
+			w->pcm_offset = w->data_pos;
+			len = file_size - w->data_pos;
+			data_bytes = chunk_size < len ? chunk_size : len;
+			has_data = true;
+			if (w->rf != NULL)
+				break;
+		}
+
+		if (!skip_input(w, size))
+			break;
+	}
+	if (!has_fmt || !has_data) {
+		log_error("Audio file format error (%s).", w->file);
+		return false;
+	}
+
+	/* Check the format. */
+	if (tag == WAV_PCM && bits == 16)
+		w->format = FORMAT_PCM16;
+	else if (tag == WAV_FLOAT && bits == 32)
+		w->format = FORMAT_FLOAT32;
+	if (w->format == FORMAT_NONE ||
+	    (channels != 1 && channels != 2) ||
+	    block != channels * bits / 8 ||
+	    w->rate <= 0) {
+		log_error("Audio file format error (%s).", w->file);
+		return false;
+	}
+	w->monaural = channels == 1 ? true : false;
+	w->pcm_frame_size = block;
+	w->pcm_frames = (ogg_int64_t)(data_bytes / (size_t)block);
+
+	/* Go to the first frame. */
+	if (!seek_frames(w, 0, false))
+		return false;
+
+	*total = w->pcm_frames;
+
+	return true;
+}
+
+/*
+ * Open a raw PCM file.
+ *  - The whole file is 44.1kHz 16-bit little endian stereo frames.
+ */
+static bool open_raw(struct wave *w, ogg_int64_t *total)
+{
+	w->format = FORMAT_PCM16;
+	w->monaural = false;
+	w->rate = SAMPLING_RATE;
+	w->pcm_frame_size = 4;
+	w->pcm_offset = 0;
+	w->pcm_frames = (ogg_int64_t)((w->rf != NULL ? w->rf_size : w->data_size) / 4);
+	w->pcm_pos = 0;
+
+	*total = w->pcm_frames;
+
+	return true;
+}
+
+/*
+ * Create a PCM stream that plays frames in memory.
+ *  - The frames are neither copied nor freed by the stream.
+ */
+struct wave *create_wave_from_frames(const uint32_t *frames, int count)
+{
+	struct wave *w;
+
+	assert(frames != NULL);
+	assert(count >= 0);
+
+	w = malloc(sizeof(struct wave));
+	if (w == NULL) {
+		log_out_of_memory();
+		return NULL;
+	}
+	memset(w, 0, sizeof(struct wave));
+
+	w->frames = frames;
+	w->frame_count = count;
+	w->frame_pos = 0;
+
 	return w;
 }
 
-/* Reopen a file. */
-static bool reopen(struct wave *w, bool loop)
+/*
+ * Decode a whole file into frames.
+ *  - This is for short clips that are played many times.
+ *  - Loop tags are ignored.
+ */
+bool decode_wave_file(const char *fname, uint32_t **frames, int *count)
 {
-	ov_callbacks cb;
-	int err;
+	struct wave *w;
+	uint32_t *buf, *tmp;
+	int size, ret;
 
-	if (w->rf == NULL) {
-		/* Open a file input stream. */
-		if (!open_rfile(w->file, &w->rf)) {
-			free(w->file);
-			free(w);
+	w = create_wave_from_file(fname, false);
+	if (w == NULL)
+		return false;
+	w->loop = false;
+	w->loop_length = 0;
+
+	size = SAMPLING_RATE;
+	buf = malloc((size_t)size * sizeof(uint32_t));
+	if (buf == NULL) {
+		log_out_of_memory();
+		destroy_wave(w);
+		return false;
+	}
+
+	*count = 0;
+	while (!w->eos) {
+		if (*count == size) {
+			size *= 2;
+			tmp = realloc(buf, (size_t)size * sizeof(uint32_t));
+			if (tmp == NULL) {
+				log_out_of_memory();
+				free(buf);
+				destroy_wave(w);
+				return false;
+			}
+			buf = tmp;
+		}
+
+		ret = get_wave_samples(w, buf + *count, size - *count);
+		if (w->err) {
+			free(buf);
+			destroy_wave(w);
 			return false;
 		}
-	} else {
-		rewind_rfile(w->rf);
+		*count += ret;
 	}
 
-	/* Open a file by a callback. */
-	memset(&cb, 0, sizeof(cb));
-	cb.read_func = read_func;
-	cb.close_func = NULL;
-	cb.seek_func = NULL;
-	cb.tell_func = NULL;
-	err = ov_open_callbacks(w, &w->ovf, NULL, 0, cb);
-	if (err != 0) {
+	destroy_wave(w);
+
+	*frames = buf;
+	return true;
+}
+
+/*
+ * Read a file into memory, or open it for streaming.
+ *  - A file is a PCM file if it has a RIFF header or the raw extension.
+ *  - Only a large PCM file is streamed. A looping one is held in memory
+ *    because an rfile is rewound to the head to seek back to the loop
+ *    start.
+ */
+static bool open_file(struct wave *w, bool *is_pcm)
+{
+	unsigned char hdr[4];
+	size_t len;
+
+	if (!open_rfile(w->file, &w->rf))
+		return false;
+
+	if (!get_rfile_size(w->rf, &w->rf_size) || w->rf_size == 0) {
 		log_error("Audio file format error (%s).", w->file);
-		free(w->file);
-		free(w);
 		return false;
 	}
 
-	w->do_skip = loop;
-	w->consumed_bytes = 0;
+	/* Check the format by the magic. */
+	*is_pcm = is_raw_file(w->file);
+	if (read_rfile(w->rf, hdr, sizeof(hdr), &len) && len == sizeof(hdr) &&
+	    memcmp(hdr, "RIFF", 4) == 0)
+		*is_pcm = true;
+	rewind_rfile(w->rf);
+
+	/* Keep a large PCM file open. */
+	if (*is_pcm && w->rf_size > PCM_MEMORY_SIZE && !w->loop) {
+		w->data_pos = 0;
+		return true;
+	}
+
+	/* Read the whole file, and close it. */
+	if (!load_file(w))
+		return false;
+	close_rfile(w->rf);
+	w->rf = NULL;
+
+	return true;
+}
+
+/* Check if a file name has the raw PCM extension. */
+static bool is_raw_file(const char *fname)
+{
+	size_t len, ext_len;
+
+	len = strlen(fname);
+	ext_len = strlen(RAW_EXT);
+	if (len < ext_len)
+		return false;
+
+	return strcmp(fname + len - ext_len, RAW_EXT) == 0;
+}
+
+/* Read a whole file into memory. */
+static bool load_file(struct wave *w)
+{
+	size_t len;
+
+	w->data = malloc(w->rf_size);
+	if (w->data == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+	w->data_size = 0;
+	while (w->data_size < w->rf_size) {
+		if (!read_rfile(w->rf, w->data + w->data_size, w->rf_size - w->data_size, &len) || len == 0)
+			break;
+		w->data_size += len;
+	}
 
+	w->data_pos = 0;
 	return true;
 }
 
+/* Read a streamed file into memory, and go to the first frame. */
+static bool load_streamed_file(struct wave *w)
+{
+	rewind_rfile(w->rf);
+	if (!load_file(w))
+		return false;
+	close_rfile(w->rf);
+	w->rf = NULL;
+
+	return seek_frames(w, 0, false);
+}
+
+/* Read bytes from the file in memory or the streamed file. */
+static bool read_input(struct wave *w, void *buf, size_t size)
+{
+	const unsigned char *src;
+	size_t len;
+
+	src = get_input(w, size, buf, &len);
+	if (len < size)
+		return false;
+	if (src != buf)
+		memcpy(buf, src, size);
+
+	return true;
+}
+
+/* Skip bytes of the file in memory or the streamed file. */
+static bool skip_input(struct wave *w, size_t size)
+{
+	unsigned char tmp[IOSIZE];
+	size_t len;
+
+	while (size > 0) {
+		get_input(w, size > IOSIZE ? IOSIZE : size, tmp, &len);
+		if (len == 0)
+			return false;
+		size -= len;
+	}
+
+	return true;
+}
+
+/*
+ * Get bytes of the file in memory or the streamed file.
+ *  - Returns a pointer into the file in memory, or tmp that has the
+ *    bytes read from the streamed file. (size <= IOSIZE for a stream)
+ *  - The bytes may be short at the end of the file.
+ */
+static const unsigned char *get_input(struct wave *w, size_t size, unsigned char *tmp, size_t *ret)
+{
+	const unsigned char *src;
+
+	if (w->rf == NULL) {
+		/* In memory. */
+		if (size > w->data_size - w->data_pos)
+			size = w->data_size - w->data_pos;
+		src = w->data + w->data_pos;
+	} else {
+		/* Streamed. */
+		assert(size <= IOSIZE);
+		if (size > 0 && !read_rfile(w->rf, tmp, size, &size))
+			size = 0;
+		src = tmp;
+	}
+
+	w->data_pos += size;
+	*ret = size;
+
+	return src;
+}
+
+/* Get a 32-bit little endian value. */
+static uint32_t get_u32(const unsigned char *p)
+{
+	return (uint32_t)p[0] |
+	       ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+/* Get a 16-bit little endian value. */
+static uint16_t get_u16(const unsigned char *p)
+{
+	return (uint16_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8));
+}
+
 /* File input callback. */
 static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource)
 {
-	struct wave *w;	
+	struct wave *w;
 	size_t len;
 
 	assert(ptr != NULL);
@@ -193,30 +679,62 @@ static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource)
 
 	w = (struct wave *)datasource;
 
-	if (!read_rfile(w->rf, ptr, size * nmemb, &len))
+	if (size == 0)
 		return 0;
 
+	len = size * nmemb;
+	if (len > w->data_size - w->data_pos)
+		len = w->data_size - w->data_pos;
+	len -= len % size;
+
+	memcpy(ptr, w->data + w->data_pos, len);
+	w->data_pos += len;
+
 	return len / size;
 }
 
-#if 0
-/* File close callback. */
-static int close_func(void *datasource)
+/* File seek callback. */
+static int seek_func(void *datasource, ogg_int64_t offset, int whence)
 {
 	struct wave *w;
+	ogg_int64_t pos;
 
 	assert(datasource != NULL);
 
 	w = (struct wave *)datasource;
 
-	if (w->loop && w->times != -1) {
-		close_rfile(w->rf);
-		w->rf = NULL;
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (ogg_int64_t)w->data_pos + offset;
+		break;
+	case SEEK_END:
+		pos = (ogg_int64_t)w->data_size + offset;
+		break;
+	default:
+		return -1;
 	}
+	if (pos < 0 || pos > (ogg_int64_t)w->data_size)
+		return -1;
+
+	w->data_pos = (size_t)pos;
 
 	return 0;
 }
-#endif
+
+/* File tell callback. */
+static long tell_func(void *datasource)
+{
+	struct wave *w;
+
+	assert(datasource != NULL);
+
+	w = (struct wave *)datasource;
+
+	return (long)w->data_pos;
+}
 
 /*
  * Set a loop count for a PCM stream.
@@ -229,15 +747,91 @@ void set_wave_repeat_times(struct wave *w, int n)
 	w->times = n;
 }
 
+/*
+ * Crossfade the loop end into the loop start.
+ *  - This must be called before the playback starts.
+ *  - The length is in milliseconds.
+ *  - The frames after loop_start are decoded here, and mixed into the
+ *    frames before the loop end, so that a loop seam is not heard.
+ */
+bool set_wave_loop_crossfade(struct wave *w, int msec)
+{
+	ogg_int64_t max;
+	int frames, len, ret;
+
+	assert(w != NULL);
+	assert(msec >= 0);
+
+	if (w->frames != NULL || !w->loop || msec == 0)
+		return true;
+
+	assert(w->pos == 0);
+	assert(w->xfade_buf == NULL);
+
+	/* Use at most a half of the loop. */
+	max = (w->loop_end - w->loop_start) / 2;
+	if ((ogg_int64_t)msec * w->rate / 1000 < max)
+		max = (ogg_int64_t)msec * w->rate / 1000;
+	frames = (int)max;
+	if (frames == 0)
+		return true;
+
+	w->xfade_buf = malloc((size_t)frames * sizeof(uint32_t));
+	if (w->xfade_buf == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+	/* Decode the frames after loop_start. */
+	if (!seek_frames(w, (ogg_int64_t)w->loop_start, false)) {
+		free(w->xfade_buf);
+		w->xfade_buf = NULL;
+		return false;
+	}
+	for (len = 0; len < frames; len += ret) {
+		ret = decode_frames(w, w->xfade_buf + len, frames - len);
+		if (ret <= 0)
+			break;
+	}
+
+	/* Go back to the top. */
+	if (len < frames || !seek_frames(w, 0, false)) {
+		log_error("Audio decode error (%s).", w->file);
+		free(w->xfade_buf);
+		w->xfade_buf = NULL;
+		return false;
+	}
+
+	w->xfade_frames = frames;
+
+	return true;
+}
+
 /*
  * Destroy a PCM stream.
  */
 void destroy_wave(struct wave *w)
 {
-	ov_clear(&w->ovf);
-	free(w->file);
+	if (w->frames != NULL) {
+		free(w);
+		return;
+	}
+
+	free_wave(w);
+}
+
+/* Free a file stream, which may be partially opened. */
+static void free_wave(struct wave *w)
+{
+	if (w->format == FORMAT_VORBIS)
+		ov_clear(&w->ovf);
 	if (w->rf != NULL)
 		close_rfile(w->rf);
+	if (w->rs != NULL)
+		destroy_resampler(w->rs);
+	free(w->xfade_buf);
+	free(w->data);
+	free(w->file);
 	free(w);
 }
 
@@ -254,157 +848,295 @@ bool is_wave_eos(struct wave *w)
  */
 int get_wave_samples(struct wave *w, uint32_t *buf, int samples)
 {
+	int ret;
+
 	/* If already reached end-of-stream. */
 	if (w->eos)
 		return 0;
 
-	/* Monaural case. */
-	if (w->monaural)
-		return get_wave_samples_monaural(w, buf, samples);
+	/* Memory case. */
+	if (w->frames != NULL)
+		return get_wave_samples_memory(w, buf, samples);
+
+	/* File case. */
+	if (w->rs != NULL)
+		ret = get_resampled_samples(w->rs, buf, samples, read_resampler_input, w);
+	else
+		ret = get_wave_samples_file(w, buf, samples);
 
-	/* Stereo case. */
-	return get_wave_samples_stereo(w, buf, samples);
+	/* Short only at the end of the stream or on an error. */
+	if (ret < samples)
+		w->eos = true;
+
+	return ret;
 }
 
-/* Get samples from a monaural stream. */
-static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples)
+/* Input callback of the resampler. */
+static int read_resampler_input(void *p, uint32_t *buf, int frames)
 {
-	unsigned char mbuf[IOSIZE];
-	long read_bytes, ret_bytes, last_ret_bytes;
-	int retain, bitstream, i;
-	bool loop_end;
+	return get_wave_samples_file((struct wave *)p, buf, frames);
+}
+
+/* Get samples from a file stream. */
+static int get_wave_samples_file(struct wave *w, uint32_t *buf, int samples)
+{
+	int retain, len, ret;
+	bool looped;
 
 	/* Until finish reading or reach eos. */
 	retain = 0;
-	last_ret_bytes = -1;
+	looped = false;
 	while (retain < samples) {
-		/* Skip for LOOPSTART. */
-		skip_if_needed(w, 2);
-
-		/* Decode. */
-		read_bytes = (samples - retain) * 2 > IOSIZE ? IOSIZE :
-			     (samples - retain) * 2;
-		loop_end = false;
-		if (w->loop_length > 0 &&
-		    w->consumed_bytes + read_bytes >= (long)(w->loop_start + w->loop_length) * 2) {
-			read_bytes = (long)(w->loop_start + w->loop_length) * 2 - w->consumed_bytes;
-			loop_end = true;
+		/* Go back to the loop start at the loop end. */
+		if (is_looping(w) && w->pos >= w->loop_end) {
+			if (looped || !loop_back(w))
+				break;		/* Error. */
+			looped = true;
+			continue;
 		}
-		ret_bytes = ov_read(&w->ovf, (char *)mbuf, (int)read_bytes, 0, 2, 1, &bitstream);
-		if (ret_bytes == 0 || (loop_end && ret_bytes == read_bytes)) {
-			/* End-of-stream. */
-			if ((w->loop && (w->times == -1 || w->times > 0)) || loop_end) {
-				/* Reopen. */
-				if (last_ret_bytes == 0)
-					return 0; 	/* Error */
-				ov_clear(&w->ovf);
-				if (!reopen(w, true))
-					return 0;	/* Error */
-				last_ret_bytes = 0;
-				if (w->times != -1)
-					w->times--;
-			} else {
-				/* Return read samples. */
-				w->eos = true;
-				return retain;
+
+		/* Decode until the loop end. */
+		len = samples - retain;
+		if (is_looping(w) && w->pos + len > w->loop_end)
+			len = (int)(w->loop_end - w->pos);
+		ret = decode_frames(w, buf + retain, len);
+		if (ret < 0) {
+			log_error("Audio decode error (%s).", w->file);
+			break;			/* Error. */
+		}
+		if (ret == 0) {
+			/* The file ended before the loop end. */
+			if (is_looping(w)) {
+				if (looped || !loop_back(w))
+					break;	/* Error. */
+				looped = true;
+				continue;
 			}
-		} else {
-			w->consumed_bytes += ret_bytes;
+
+			/* End-of-stream. */
+			return retain;
 		}
 
-		/* Convert to stereo. */
-		for (i = 0; i < ret_bytes / 2; i++) {
-			buf[retain + i] = (uint32_t)(mbuf[i*2] |
-						     (mbuf[i*2 + 1] << 8) |
-						     (mbuf[i*2] << 16) |
-						     (mbuf[i*2 + 1] << 24));
+		/* Mix the loop start into the loop end. */
+		if (w->xfade_frames > 0 && is_looping(w))
+			crossfade_frames(w, buf + retain, ret);
+
+		w->pos += ret;
+		retain += ret;
+		looped = false;
+	}
+	if (retain < samples) {
+		/* Stop the stream on an error. */
+		w->err = true;
+	}
+
+	return retain;
+}
+
+/* Check if a stream goes back to the loop start at the loop end. */
+static bool is_looping(struct wave *w)
+{
+	return w->loop && (w->times == -1 || w->times > 0);
+}
+
+/* Seek to the loop start on the open stream. */
+static bool loop_back(struct wave *w)
+{
+	ogg_int64_t target;
+
+	/* The crossfaded frames were already played at the loop end. */
+	target = (ogg_int64_t)w->loop_start + w->xfade_frames;
+
+	/* Seek with lapping so that the decoder output continues smoothly. */
+	if (!seek_frames(w, target, true))
+		return false;
+
+	w->pos = target;
+	if (w->times != -1)
+		w->times--;
+
+	return true;
+}
+
+/*
+ * Decode frames.
+ *  - Returns the number of frames, 0 at the end of the file, or -1 on
+ *    an error.
+ */
+static int decode_frames(struct wave *w, uint32_t *buf, int frames)
+{
+	unsigned char mbuf[IOSIZE];
+	long read_bytes, ret_bytes;
+	int bitstream, i;
+
+	/* PCM files are converted on read instead of decoded. */
+	if (w->format != FORMAT_VORBIS)
+		return read_pcm_frames(w, buf, frames);
+
+	do {
+		if (w->monaural) {
+			read_bytes = frames * 2 > IOSIZE ? IOSIZE : frames * 2;
+			ret_bytes = ov_read(&w->ovf, (char *)mbuf, (int)read_bytes, 0, 2, 1, &bitstream);
+		} else {
+			read_bytes = (long)frames * 4;
+			ret_bytes = ov_read(&w->ovf, (char *)buf, (int)read_bytes, 0, 2, 1, &bitstream);
 		}
-		retain += (int)ret_bytes / 2;
+	} while (ret_bytes == OV_HOLE);
+	if (ret_bytes < 0)
+		return -1;
+
+	if (!w->monaural)
+		return (int)(ret_bytes / 4);
+
+	/* Convert to stereo. */
+	for (i = 0; i < ret_bytes / 2; i++) {
+		buf[i] = (uint32_t)mbuf[i*2] |
+			 ((uint32_t)mbuf[i*2 + 1] << 8) |
+			 ((uint32_t)mbuf[i*2] << 16) |
+			 ((uint32_t)mbuf[i*2 + 1] << 24);
 	}
 
-	/* Fully filled. */
-	return samples;
+	return (int)(ret_bytes / 2);
 }
 
-/* Get samples from a stereo stream. */
-static int get_wave_samples_stereo(struct wave *w, uint32_t *buf, int samples)
+/*
+ * Seek to a frame.
+ *  - lap is for an Ogg Vorbis file, to continue the output smoothly.
+ *  - A streamed PCM file is rewound to seek backward. (Not a looping one,
+ *    which is in memory.)
+ */
+static bool seek_frames(struct wave *w, ogg_int64_t pos, bool lap)
 {
-	long read_bytes, ret_bytes, last_ret_bytes;
-	int retain, bitstream;
-	bool loop_end;
+	size_t target;
+	int ret;
 
-	/* Until finish reading or reach eos. */
-	retain = 0;
-	last_ret_bytes = -1;
-	while (retain < samples) {
-		/* Skip for LOOPSTART. */
-		skip_if_needed(w, 4);
-
-		/* Decode. */
-		read_bytes = (samples - retain) * 4;
-		loop_end = false;
-		if (w->loop_length > 0 &&
-		    w->consumed_bytes + read_bytes >= (long)(w->loop_start + w->loop_length) * 4) {
-			read_bytes = (long)(w->loop_start + w->loop_length) * 4 - w->consumed_bytes;
-			loop_end = true;
+	if (w->format == FORMAT_VORBIS) {
+		ret = lap ? ov_pcm_seek_lap(&w->ovf, pos) : ov_pcm_seek(&w->ovf, pos);
+		if (ret != 0) {
+			log_error("Audio seek error (%s).", w->file);
+			return false;
 		}
-		ret_bytes = ov_read(&w->ovf, (char *)(buf + retain), (int)read_bytes, 0, 2, 1, &bitstream);
-		if (ret_bytes == 0 || (loop_end && ret_bytes == read_bytes)) {
-			/* End-of-stream. */
-			if ((w->loop && (w->times == -1 || w->times > 0)) || loop_end) {
-				/* Reopen. */
-				if (last_ret_bytes == 0)
-					return 0; 	/* Error. */
-				ov_clear(&w->ovf);
-				if (!reopen(w, true))
-					return 0;	/* Error. */
-				last_ret_bytes = 0;
-				if (w->times != -1)
-					w->times--;
-			} else {
-				/* Return read sample. */
-				w->eos = true;
-				return retain;
-			}
+		return true;
+	}
+
+	if (pos > w->pcm_frames)
+		pos = w->pcm_frames;
+	target = w->pcm_offset + (size_t)pos * (size_t)w->pcm_frame_size;
+
+	if (w->rf == NULL) {
+		/* In memory. */
+		w->data_pos = target;
+	} else {
+		/* Streamed. */
+		if (target < w->data_pos) {
+			rewind_rfile(w->rf);
+			w->data_pos = 0;
+		}
+		if (!skip_input(w, target - w->data_pos)) {
+			log_error("Audio seek error (%s).", w->file);
+			return false;
+		}
+	}
+
+	w->pcm_pos = pos;
+
+	return true;
+}
+
+/*
+ * Read PCM frames, and convert them to 16-bit stereo.
+ *  - Returns the number of frames, or 0 at the end of the data.
+ */
+static int read_pcm_frames(struct wave *w, uint32_t *buf, int frames)
+{
+	unsigned char tmp[IOSIZE];
+	const unsigned char *src;
+	size_t len;
+	uint16_t l, r;
+	int i;
+
+	/* Read until the end of the data, and up to a buffer for a stream. */
+	if ((ogg_int64_t)frames > w->pcm_frames - w->pcm_pos)
+		frames = (int)(w->pcm_frames - w->pcm_pos);
+	if (w->rf != NULL && frames > IOSIZE / w->pcm_frame_size)
+		frames = IOSIZE / w->pcm_frame_size;
+	src = get_input(w, (size_t)frames * (size_t)w->pcm_frame_size, tmp, &len);
+	frames = (int)(len / (size_t)w->pcm_frame_size);
+
+	for (i = 0; i < frames; i++) {
+		if (w->format == FORMAT_PCM16) {
+			l = get_u16(src);
+			r = w->monaural ? l : get_u16(src + 2);
 		} else {
-			w->consumed_bytes += ret_bytes;
+			l = (uint16_t)float_to_s16(get_u32(src));
+			r = w->monaural ? l : (uint16_t)float_to_s16(get_u32(src + 4));
 		}
-		retain += (int)ret_bytes / 4;
+		buf[i] = (uint32_t)l | ((uint32_t)r << 16);
+		src += w->pcm_frame_size;
 	}
 
-	/* Fully filled. */
-	return samples;
+	w->pcm_pos += frames;
+
+	return frames;
 }
 
-/* Skip for LOOPSTART. */
-static void skip_if_needed(struct wave *w, int sample_bytes)
+/* Convert a 32-bit float sample to 16-bit. */
+static int16_t float_to_s16(uint32_t bits)
 {
-	uint32_t buf[1024];
-	size_t remain_samples;
-	size_t get_samples;
-	long ret_bytes;
-	int bitstream;
+	float f;
 
-	if (!w->do_skip || w->loop_start == 0)
-		return;
+	memcpy(&f, &bits, sizeof(f));
 
-	remain_samples = w->loop_start;
-	while (remain_samples > 0) {
-		get_samples = remain_samples > 1024 ? 1024 : remain_samples;
-
-		ret_bytes = ov_read(&w->ovf,
-				    (char *)buf,
-				    (int)get_samples * sample_bytes,
-				    0,
-				    2,
-				    1,
-				    &bitstream);
-		if (ret_bytes <= 0)
-			break;
+	/* Also clips NaN to zero. */
+	if (!(f > -1.0f))
+		return f <= -1.0f ? -32767 : 0;
+	if (f >= 1.0f)
+		return 32767;
 
-		remain_samples -= (size_t)(ret_bytes / sample_bytes);
+	return (int16_t)(f * 32767.0f + (f >= 0 ? 0.5f : -0.5f));
+}
+
+/* Mix the frames after loop_start into the frames before the loop end. */
+static void crossfade_frames(struct wave *w, uint32_t *buf, int frames)
+{
+	ogg_int64_t xfade_start;
+	uint32_t tail, head;
+	int32_t in, l, r;
+	int i, k;
+
+	xfade_start = w->loop_end - w->xfade_frames;
+	for (i = 0; i < frames; i++) {
+		if (w->pos + i < xfade_start)
+			continue;
+		k = (int)(w->pos + i - xfade_start);
+
+		/* Linear fade in Q15. */
+		in = (int32_t)(((int64_t)(k + 1) << 15) / (w->xfade_frames + 1));
+		tail = buf[i];
+		head = w->xfade_buf[k];
+		l = ((int32_t)(int16_t)(uint16_t)tail * (32768 - in) +
+		     (int32_t)(int16_t)(uint16_t)head * in) >> 15;
+		r = ((int32_t)(int16_t)(uint16_t)(tail >> 16) * (32768 - in) +
+		     (int32_t)(int16_t)(uint16_t)(head >> 16) * in) >> 15;
+		buf[i] = ((uint32_t)(uint16_t)(int16_t)l) |
+			 (((uint32_t)(uint16_t)(int16_t)r) << 16);
 	}
+}
+
+/* Get samples from frames in memory. */
+static int get_wave_samples_memory(struct wave *w, uint32_t *buf, int samples)
+{
+	int len;
+
+	len = w->frame_count - w->frame_pos;
+	if (len > samples)
+		len = samples;
+
+	memcpy(buf, w->frames + w->frame_pos, (size_t)len * sizeof(uint32_t));
+	w->frame_pos += len;
+
+	if (w->frame_pos == w->frame_count)
+		w->eos = true;
 
-	w->do_skip = false;
-	w->consumed_bytes = (long)w->loop_start * sample_bytes;
+	return len;
 }
@@ -124,11 +124,21 @@ void (APIENTRY *glVertexAttribPointer)(GLuint index, GLint size, GLenum type, GL
 void (APIENTRY *glEnableVertexAttribArray)(GLuint index);
 GLint (APIENTRY *glGetUniformLocation)(GLuint program, const GLchar *name);
 void (APIENTRY *glUniform1i)(GLint location, GLint v0);
+void (APIENTRY *glUniform4f)(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
 void (APIENTRY *glBufferData)(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+void (APIENTRY *glBufferSubData)(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
 void (APIENTRY *glDeleteShader)(GLuint shader);
 void (APIENTRY *glDeleteProgram)(GLuint program);
 void (APIENTRY *glDeleteVertexArrays)(GLsizei n, const GLuint *arrays);
 void (APIENTRY *glDeleteBuffers)(GLsizei n, const GLuint *buffers);
+void (APIENTRY *glGenFramebuffers)(GLsizei n, GLuint *framebuffers);
+void (APIENTRY *glBindFramebuffer)(GLenum target, GLuint framebuffer);
+void (APIENTRY *glFramebufferTexture2D)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+GLenum (APIENTRY *glCheckFramebufferStatus)(GLenum target);
+void (APIENTRY *glDeleteFramebuffers)(GLsizei n, const GLuint *framebuffers);
+void (APIENTRY *glBlendFuncSeparate)(GLenum sfactorRGB, GLenum dfactorRGB, GLenum sfactorAlpha, GLenum dfactorAlpha);
+void (APIENTRY *glDrawArraysInstanced)(GLenum mode, GLint first, GLsizei count, GLsizei instancecount);
+void (APIENTRY *glVertexAttribDivisor)(GLuint index, GLuint divisor);
 struct API
 {
 	void **func;
@@ -156,11 +166,26 @@ static struct API api[] =
 	{(void **)&glEnableVertexAttribArray, "glEnableVertexAttribArray"},
 	{(void **)&glGetUniformLocation, "glGetUniformLocation"},
 	{(void **)&glUniform1i, "glUniform1i"},
+	{(void **)&glUniform4f, "glUniform4f"},
 	{(void **)&glBufferData, "glBufferData"},
+	{(void **)&glBufferSubData, "glBufferSubData"},
 	{(void **)&glDeleteShader, "glDeleteShader"},
 	{(void **)&glDeleteProgram, "glDeleteProgram"},
 	{(void **)&glDeleteVertexArrays, "glDeleteVertexArrays"},
 	{(void **)&glDeleteBuffers, "glDeleteBuffers"},
+	{(void **)&glGenFramebuffers, "glGenFramebuffers"},
+	{(void **)&glBindFramebuffer, "glBindFramebuffer"},
+	{(void **)&glFramebufferTexture2D, "glFramebufferTexture2D"},
+	{(void **)&glCheckFramebufferStatus, "glCheckFramebufferStatus"},
+	{(void **)&glDeleteFramebuffers, "glDeleteFramebuffers"},
+	{(void **)&glBlendFuncSeparate, "glBlendFuncSeparate"},
+};
+
+/* Optional OpenGL API (used if available) */
+static struct API opt_api[] =
+{
+	{(void **)&glDrawArraysInstanced, "glDrawArraysInstanced"},
+	{(void **)&glVertexAttribDivisor, "glVertexAttribDivisor"},
 };
 
 /* forward declaration */
@@ -411,6 +436,8 @@ bool create_glx_window(void)
 			return false;
 		}
 	}
+	for (i = 0; i < (int)(sizeof(opt_api)/sizeof(struct API)); i++)
+		*opt_api[i].func = (void *)glXGetProcAddress((const unsigned char *)opt_api[i].name);
 
 	/* Initialize the OpenGL rendering subsystem. */
 	if (!init_opengl(screen_width, screen_height)) {
@@ -1113,6 +1140,30 @@ void notify_image_free(struct image *img)
 	opengl_notify_image_free(img);
 }
 
+/*
+ * Notify an image pre-warm.
+ */
+void notify_image_prewarm(struct image *img)
+{
+	opengl_notify_image_prewarm(img);
+}
+
+/*
+ * Start rendering to an image.
+ */
+bool begin_render_target(struct image *img, bool clear)
+{
+	return opengl_begin_render_target(img, clear);
+}
+
+/*
+ * End rendering to an image.
+ */
+void end_render_target(void)
+{
+	opengl_end_render_target();
+}
+
 /*
  * Render an image. (alpha blend)
  */
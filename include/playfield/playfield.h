@@ -31,16 +31,95 @@ playfield_create_color_texture(
 
 /*
  * Load a texture.
+ *  - The image is reduced to 1/scale at decode time. (1, 2, 4, or 8)
+ *  - Mipmap levels are generated if requested, for minified draws.
  */
 bool
 playfield_load_texture(
 	const char *fname,
+	int scale,
+	bool mipmap,
 	int *ret,
 	int *width,
 	int *height);
 
+/*
+ * Load a texture on a worker thread.
+ *  - The texture is not rendered until the load finishes.
+ */
+bool
+playfield_load_texture_async(
+	const char *fname,
+	int scale,
+	bool mipmap,
+	int *ret);
+
+/*
+ * Get a texture status.
+ */
+void
+playfield_get_texture_status(
+	int tex_id,
+	bool *is_ready,
+	bool *is_failed,
+	int *width,
+	int *height);
+
+/*
+ * Wait for a texture to be loaded.
+ */
+bool
+playfield_wait_texture(
+	int tex_id,
+	int *width,
+	int *height);
+
+/*
+ * Upload a texture to GPU over the next frames before it is drawn.
+ */
+void
+playfield_prewarm_texture(
+	int tex_id);
+
+/*
+ * Set the memory budget for the released textures to be retained.
+ *  - A released texture loaded from a file is kept for a later load.
+ *  - The least recently released textures are freed to fit the budget.
+ */
+void
+playfield_set_texture_cache_size(
+	size_t size);
+
+/*
+ * Create a render target texture.
+ *  - The texture is transparent at first.
+ */
+bool
+playfield_create_render_target(
+	int width,
+	int height,
+	int *ret);
+
+/*
+ * Start rendering to a render target texture.
+ *  - Rendering goes to the texture until playfield_end_render_target().
+ *  - Render targets cannot be nested.
+ */
+bool
+playfield_begin_render_target(
+	int tex_id,
+	bool clear);
+
+/*
+ * End rendering to a render target texture.
+ *  - Called at the end of a frame if still rendering to a texture.
+ */
+void
+playfield_end_render_target(void);
+
 /*
  * Destroy a texture.
+ *  - A texture loaded from a file is freed on the last release.
  */
 void
 playfield_destroy_texture(
@@ -114,11 +193,13 @@ playfield_create_text_texture(
 
 /*
  * Play a sound on a stream.
+ *  - A file with loop tags crossfades its loop seam for crossfade_ms.
  */
 bool
 playfield_play_sound(
 	int stream,
-	const char *file);
+	const char *file,
+	int crossfade_ms);
 
 /*
  * Stop a sound on a stream.
@@ -127,13 +208,53 @@ bool
 playfield_stop_sound(
 	int stream);
 
+/*
+ * Load a sound clip to play as one-shot sounds.
+ */
+bool
+playfield_load_sound(
+	const char *file,
+	int *clip_id);
+
+/*
+ * Play a sound clip as a one-shot sound.
+ */
+bool
+playfield_play_sound_effect(
+	int clip_id,
+	float vol);
+
 /*
  * Set a sound volume on a stream.
  */
 bool
-playfield_set_volume(
+playfield_set_sound_volue(
 	int stream,
-	float val);
+	float vol);
+
+/*
+ * Fade a sound volume on a stream in msec.
+ */
+bool
+playfield_fade_sound(
+	int stream,
+	float vol,
+	int msec);
+
+/*
+ * Set a sound pan on a stream. (-1.0 left to 1.0 right)
+ */
+bool
+playfield_set_sound_pan(
+	int stream,
+	float pan);
+
+/*
+ * Set the interval to log the sound statistics. (msec, 0 to disable)
+ */
+void
+playfield_set_sound_log_interval(
+	int msec);
 
 /*
  * Move to a tag file.
@@ -12,6 +12,7 @@
 
 #include "engine.h"
 #include "common.h"
+#include "loader.h"
 #include "tag.h"
 
 #include <stdio.h>
@@ -21,21 +22,97 @@
 
 #define TEXTURE_COUNT	(256)
 
+/* Texture IDs are used as loader job IDs. */
+#if TEXTURE_COUNT > LOADER_JOBS
+#error "LOADER_JOBS is too small."
+#endif
+
 /* Texture Struct */
 struct texture_entry {
 	bool is_used;
 	struct image *img;
+
+	/* Canonical file name. (NULL if not loaded from a file) */
+	char *file;
+
+	/* Reduction at decode time. (A file has a texture for each scale.) */
+	int scale;
+
+	/* Are mipmap levels requested? (Kept once requested by any load.) */
+	bool mipmap;
+
+	/* Reference count. (Loads of the same file return the same texture.) */
+	int ref_count;
+
+	/* Is being loaded on a worker thread? (img is NULL while loading) */
+	bool is_loading;
+
+	/* Did an asynchronous load fail? */
+	bool is_failed;
+
+	/* Is a pre-warm requested while loading? */
+	bool prewarm;
+
+	/* Is released but retained for a later load? (is_used is false) */
+	bool is_retained;
+
+	/* Time of the release for LRU. */
+	uint64_t release_time;
 };
 
 /* Texture table. */
 static struct texture_entry tex_tbl[TEXTURE_COUNT];
 
+/* Memory budget for the retained textures. (0 to disable) */
+static size_t retain_budget;
+
+/* Memory size of the retained textures. */
+static size_t retained_size;
+
+/* Release counter for LRU. */
+static uint64_t release_clock;
+
+/* Texture being rendered to. (-1 for the screen) */
+static int target_tex_id = -1;
+
 /* Wave table. */
 static struct wave *wave_tbl[SOUND_TRACKS];
 
+#define SOUND_CLIP_COUNT	(256)
+
+/* Sound Clip Struct (Decoded once, and played by one-shot sounds.) */
+struct sound_clip {
+	/* Canonical file name. (NULL if unused) */
+	char *file;
+
+	/* Decoded frames. */
+	uint32_t *frames;
+	int frame_count;
+};
+
+/* Sound clip table. */
+static struct sound_clip clip_tbl[SOUND_CLIP_COUNT];
+
+/* Interval to log the sound statistics. (msec, 0 to disable) */
+static int sound_log_interval;
+
+/* Time and statistics of the last sound log. */
+static uint64_t sound_log_origin;
+static struct sound_stats sound_log_prev;
+
 /* Forward Declaration */
 static int search_free_entry(void);
+static int search_file_entry(const char *file, int scale);
+static void reuse_entry(int index);
+static void retain_entry(int index);
+static void trim_retained_entries(size_t limit);
+static void release_entry(int index);
+static size_t get_texture_size(struct texture_entry *t);
+static void add_mipmaps(int index);
+static bool reload_texture(struct image *img, struct image **src);
+static void publish_loaded_textures(void);
 static bool create_texture(int width, int height, int *ret, struct image **img);
+static void log_sound_stats(void);
 
 /*
  * Initialization
@@ -47,6 +124,10 @@ static bool create_texture(int width, int height, int *ret, struct image **img);
 bool
 init_api(void)
 {
+	/* Start the image loader threads. */
+	if (!init_loader())
+		return false;
+
 	return true;
 }
 
@@ -58,13 +139,40 @@ cleanup_api(void)
 {
 	int i;
 
+	/* Stop the image loader, and discard the images not published. */
+	cleanup_loader();
+
 	for (i = 0; i < TEXTURE_COUNT; i++) {
-		if (tex_tbl[i].is_used) {
-			tex_tbl[i].is_used = false;
-			destroy_image(tex_tbl[i].img);
-		}
+		tex_tbl[i].is_loading = false;
+		if (tex_tbl[i].is_used || tex_tbl[i].is_retained)
+			release_entry(i);
 	}
-	
+
+	/* Stop the one-shot sounds before freeing the clips they play. */
+	stop_sound_effects();
+	for (i = 0; i < SOUND_CLIP_COUNT; i++) {
+		if (clip_tbl[i].file == NULL)
+			continue;
+		free(clip_tbl[i].file);
+		free(clip_tbl[i].frames);
+		clip_tbl[i].file = NULL;
+		clip_tbl[i].frames = NULL;
+	}
+}
+
+/*
+ * Update the API states. (Called every frame.)
+ */
+void
+update_api(void)
+{
+	/* Publish the textures decoded on the worker threads. */
+	publish_loaded_textures();
+
+	/* Log the sound statistics periodically. */
+	if (sound_log_interval > 0 &&
+	    get_lap_timer_millisec(&sound_log_origin) >= (uint64_t)sound_log_interval)
+		log_sound_stats();
 }
 
 /*
@@ -77,14 +185,36 @@ cleanup_api(void)
 bool
 playfield_load_texture(
 	const char *fname,
+	int scale,
+	bool mipmap,
 	int *ret,
 	int *width,
 	int *height)
 {
 	int index;
-	const char *ext;
-	char *data;
-	size_t size;
+	const char *canonical;
+
+	/* Files with the same content share a canonical name. */
+	canonical = get_canonical_file_name(fname);
+
+	/* Return the same texture if the file is already loaded. */
+	index = search_file_entry(canonical, scale);
+	if (index != -1) {
+		/* Wait if it is being loaded asynchronously. */
+		if (tex_tbl[index].is_loading) {
+			wait_image_load(index);
+			publish_loaded_textures();
+		}
+		if (tex_tbl[index].img != NULL) {
+			reuse_entry(index);
+			if (mipmap)
+				add_mipmaps(index);
+			*ret = index;
+			*width = tex_tbl[index].img->width;
+			*height = tex_tbl[index].img->height;
+			return true;
+		}
+	}
 
 	/* Allocate a texture entry. */
 	index = search_free_entry();
@@ -93,46 +223,40 @@ playfield_load_texture(
 		return false;
 	}
 
-	/* Get a file extension. */
-	ext = strrchr(fname, '.');
-	if (ext == NULL) {
-		log_error("Cannot determine a file type for \"%s\".", fname);
+	/* Keep the canonical file name. */
+	tex_tbl[index].file = strdup(canonical);
+	if (tex_tbl[index].file == NULL) {
+		log_out_of_memory();
 		return false;
 	}
 
-	/* Load a file content. */
-	if (!load_file(fname, &data, &size))
-		return false;
+	tex_tbl[index].scale = scale;
+	tex_tbl[index].mipmap = mipmap;
 
 	/* Load an image. */
-	if (strcmp(ext, ".jpg") == 0 ||
-	    strcmp(ext, ".JPG") == 0 ||
-	    strcmp(ext, ".jpeg") == 0 ||
-	    strcmp(ext, ".JPEG") == 0) {
-		if (!create_image_with_webp((const uint8_t *)data, size, &tex_tbl[index].img)) {
-			log_error("Cannot load an image \"%s\".", fname);
-			return false;
-		}
-	} else if (strcmp(ext, ".webp") == 0 ||
-		   strcmp(ext, ".WebP") == 0 ||
-		   strcmp(ext, ".WEBP") == 0) {
-		if (!create_image_with_webp((const uint8_t *)data, size, &tex_tbl[index].img)) {
-			log_error("Cannot load an image \"%s\".", fname);
-			return false;
-		}
-	} else {
-		if (!create_image_with_png((const uint8_t *)data, size, &tex_tbl[index].img)) {
-			log_error("Cannot load an image \"%s\".", fname);
-			return false;
-		}
+	if (!load_image_file(fname, scale, &tex_tbl[index].img)) {
+		log_error("Cannot load an image \"%s\".", fname);
+		free(tex_tbl[index].file);
+		tex_tbl[index].file = NULL;
+		return false;
 	}
-	free(data);
+
+	/* Generate the mipmap levels. (Drawn without them if failed.) */
+	if (mipmap)
+		create_image_mipmaps(tex_tbl[index].img);
+
+	/* Classify the alpha values for the software blending. (Optional) */
+	build_image_alpha_map(tex_tbl[index].img);
+
+	/* Never drawn into, so the renderer may release the pixels. */
+	tex_tbl[index].img->reload = reload_texture;
 
 	/* Fill alpha channel. */
 	notify_image_update(tex_tbl[index].img);
 
 	/* Mark as used. */
 	tex_tbl[index].is_used = true;
+	tex_tbl[index].ref_count = 1;
 
 	/* Succeeded. */
 	*ret = index;
@@ -141,6 +265,203 @@ playfield_load_texture(
 	return true;
 }
 
+/*
+ * Load a texture on a worker thread.
+ */
+bool
+playfield_load_texture_async(
+	const char *fname,
+	int scale,
+	bool mipmap,
+	int *ret)
+{
+	int index;
+	const char *canonical;
+
+	/* Files with the same content share a canonical name. */
+	canonical = get_canonical_file_name(fname);
+
+	/* Return the same texture if the file is already loaded or loading. */
+	index = search_file_entry(canonical, scale);
+	if (index != -1) {
+		reuse_entry(index);
+		if (mipmap)
+			add_mipmaps(index);
+		*ret = index;
+		return true;
+	}
+
+	/* Allocate a texture entry. */
+	index = search_free_entry();
+	if (index == -1) {
+		log_error("Too many textures.");
+		return false;
+	}
+
+	/* Keep the canonical file name. */
+	tex_tbl[index].file = strdup(canonical);
+	if (tex_tbl[index].file == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+	tex_tbl[index].scale = scale;
+	tex_tbl[index].mipmap = mipmap;
+
+	/* Request to the loader. (The mipmap levels are generated there.) */
+	if (!request_image_load(index, fname, scale, mipmap)) {
+		free(tex_tbl[index].file);
+		tex_tbl[index].file = NULL;
+		return false;
+	}
+
+	/* Mark as used. (The image will be set by update_api().) */
+	tex_tbl[index].img = NULL;
+	tex_tbl[index].is_used = true;
+	tex_tbl[index].ref_count = 1;
+	tex_tbl[index].is_loading = true;
+	tex_tbl[index].is_failed = false;
+
+	/* Succeeded. */
+	*ret = index;
+	return true;
+}
+
+/*
+ * Get a texture status.
+ */
+void
+playfield_get_texture_status(
+	int tex_id,
+	bool *is_ready,
+	bool *is_failed,
+	int *width,
+	int *height)
+{
+	struct texture_entry *t;
+
+	assert(tex_id >= 0 && tex_id < TEXTURE_COUNT);
+
+	t = &tex_tbl[tex_id];
+	assert(t->is_used);
+
+	*is_ready = t->img != NULL;
+	*is_failed = t->is_failed;
+	*width = t->img != NULL ? t->img->width : 0;
+	*height = t->img != NULL ? t->img->height : 0;
+}
+
+/*
+ * Wait for a texture to be loaded.
+ */
+bool
+playfield_wait_texture(
+	int tex_id,
+	int *width,
+	int *height)
+{
+	struct texture_entry *t;
+
+	assert(tex_id >= 0 && tex_id < TEXTURE_COUNT);
+
+	t = &tex_tbl[tex_id];
+	assert(t->is_used);
+
+	/* Wait for the loader, then publish. */
+	if (t->is_loading) {
+		wait_image_load(tex_id);
+		publish_loaded_textures();
+	}
+
+	if (t->img == NULL)
+		return false;
+
+	*width = t->img->width;
+	*height = t->img->height;
+	return true;
+}
+
+/*
+ * Upload a texture to GPU over the next frames before it is drawn.
+ *  - A texture being loaded is pre-warmed when it is published.
+ */
+void
+playfield_prewarm_texture(
+	int tex_id)
+{
+	struct texture_entry *t;
+
+	assert(tex_id >= 0 && tex_id < TEXTURE_COUNT);
+
+	t = &tex_tbl[tex_id];
+	assert(t->is_used);
+
+	if (t->img == NULL) {
+		t->prewarm = true;
+		return;
+	}
+
+	notify_image_prewarm(t->img);
+}
+
+/* Publish the images decoded on the worker threads. */
+static void
+publish_loaded_textures(void)
+{
+	struct texture_entry *t;
+	struct image *img;
+	int index;
+
+	while (get_loaded_image(&index, &img)) {
+		assert(index >= 0 && index < TEXTURE_COUNT);
+
+		t = &tex_tbl[index];
+		assert(t->is_loading);
+		t->is_loading = false;
+
+		/* The texture is destroyed while loading. */
+		if (!t->is_used) {
+			if (img != NULL)
+				destroy_image(img);
+			continue;
+		}
+
+		/* Failed to load. */
+		if (img == NULL) {
+			log_error("Cannot load an image \"%s\".", t->file);
+			t->is_failed = true;
+			continue;
+		}
+
+		/* Mipmap levels may be requested while loading. */
+		if (t->mipmap && img->mipmap == NULL)
+			create_image_mipmaps(img);
+
+		/* Never drawn into, so the renderer may release the pixels. */
+		img->reload = reload_texture;
+
+		/* Fill alpha channel. */
+		notify_image_update(img);
+		t->img = img;
+
+		if (t->prewarm) {
+			notify_image_prewarm(img);
+			t->prewarm = false;
+		}
+	}
+}
+
+/*
+ * Set the memory budget for the released textures to be retained.
+ */
+void
+playfield_set_texture_cache_size(
+	size_t size)
+{
+	retain_budget = size;
+	trim_retained_entries(retain_budget);
+}
+
 /*
  * Create a color texture.
  */
@@ -169,7 +490,7 @@ playfield_create_color_texture(
 
 	/* Mark as used. */
 	tex_tbl[index].is_used = true;
-	tex_tbl[index].img = tex_tbl[index].img;
+	tex_tbl[index].ref_count = 1;
 
 	/* Clear the image. */
 	clear_image(tex_tbl[index].img, make_pixel(a, r, g, b));
@@ -181,6 +502,83 @@ playfield_create_color_texture(
 	return true;
 }
 
+/*
+ * Create a render target texture.
+ */
+bool
+playfield_create_render_target(
+	int width,
+	int height,
+	int *ret)
+{
+	int index;
+
+	/* Allocate a texture entry. */
+	index = search_free_entry();
+	if (index == -1) {
+		log_error("Too many textures.");
+		return false;
+	}
+
+	/* Create a transparent image. */
+	if (!create_render_target_image(width, height, &tex_tbl[index].img))
+		return false;
+
+	/* Mark as used. */
+	tex_tbl[index].is_used = true;
+	tex_tbl[index].ref_count = 1;
+
+	/* Succeeded. */
+	*ret = index;
+
+	return true;
+}
+
+/*
+ * Start rendering to a render target texture.
+ */
+bool
+playfield_begin_render_target(
+	int tex_id,
+	bool clear)
+{
+	struct texture_entry *t;
+
+	assert(tex_id >= 0 && tex_id < TEXTURE_COUNT);
+
+	t = &tex_tbl[tex_id];
+	assert(t->is_used);
+
+	if (t->img == NULL || !t->img->is_render_target) {
+		log_error("Not a render target.");
+		return false;
+	}
+	if (target_tex_id != -1) {
+		log_error("Render targets cannot be nested.");
+		return false;
+	}
+
+	if (!begin_render_target(t->img, clear))
+		return false;
+
+	target_tex_id = tex_id;
+
+	return true;
+}
+
+/*
+ * End rendering to a render target texture.
+ */
+void
+playfield_end_render_target(void)
+{
+	if (target_tex_id == -1)
+		return;
+
+	end_render_target();
+	target_tex_id = -1;
+}
+
 /* Create a texture. (for font drawing) */
 static bool
 create_texture(
@@ -206,6 +604,7 @@ create_texture(
 
 	/* Mark as used. */
 	tex_tbl[index].is_used = true;
+	tex_tbl[index].ref_count = 1;
 	tex_tbl[index].img = *img;
 
 	/* Succeeded. */
@@ -214,34 +613,268 @@ create_texture(
 	return true;
 }
 
-/* Search a free texture index. */
+/* Search a free texture index. (Evicts a retained texture if full.) */
 static int
 search_free_entry(void)
+{
+	int i, lru;
+
+	for (i = 0; i < TEXTURE_COUNT; i++) {
+		if (!tex_tbl[i].is_used &&
+		    !tex_tbl[i].is_loading &&
+		    !tex_tbl[i].is_retained)
+			return i;
+	}
+
+	/* Evict the least recently released texture. */
+	lru = -1;
+	for (i = 0; i < TEXTURE_COUNT; i++) {
+		if (!tex_tbl[i].is_retained)
+			continue;
+		if (lru == -1 || tex_tbl[i].release_time < tex_tbl[lru].release_time)
+			lru = i;
+	}
+	if (lru != -1) {
+		release_entry(lru);
+		return lru;
+	}
+
+	return -1;
+}
+
+/* Search a texture index that is loaded or retained for a file. */
+static int
+search_file_entry(
+	const char *file,
+	int scale)
 {
 	int i;
 
 	for (i = 0; i < TEXTURE_COUNT; i++) {
-		if (!tex_tbl[i].is_used)
+		if ((tex_tbl[i].is_used || tex_tbl[i].is_retained) &&
+		    !tex_tbl[i].is_failed &&
+		    tex_tbl[i].file != NULL &&
+		    tex_tbl[i].scale == scale &&
+		    strcmp(tex_tbl[i].file, file) == 0)
 			return i;
 	}
 	return -1;
 }
 
+/* Add a reference to a loaded or retained texture. */
+static void
+reuse_entry(
+	int index)
+{
+	struct texture_entry *t;
+
+	t = &tex_tbl[index];
+	if (t->is_retained) {
+		/* Take back from the retained textures. */
+		retained_size -= get_texture_size(t);
+		t->is_retained = false;
+		t->is_used = true;
+		t->ref_count = 0;
+	}
+	t->ref_count++;
+}
+
+/* Keep a released texture for a later load. */
+static void
+retain_entry(
+	int index)
+{
+	struct texture_entry *t;
+
+	t = &tex_tbl[index];
+	t->is_used = false;
+	t->is_retained = true;
+	t->ref_count = 0;
+	t->release_time = ++release_clock;
+	retained_size += get_texture_size(t);
+
+	/* Keep the budget. */
+	trim_retained_entries(retain_budget);
+}
+
+/* Release the least recently released textures until the size fits. */
+static void
+trim_retained_entries(
+	size_t limit)
+{
+	int i, lru;
+
+	while (retained_size > limit) {
+		lru = -1;
+		for (i = 0; i < TEXTURE_COUNT; i++) {
+			if (!tex_tbl[i].is_retained)
+				continue;
+			if (lru == -1 || tex_tbl[i].release_time < tex_tbl[lru].release_time)
+				lru = i;
+		}
+		if (lru == -1)
+			break;
+		release_entry(lru);
+	}
+}
+
+/* Release a texture entry, and destroy the image. */
+static void
+release_entry(
+	int index)
+{
+	struct texture_entry *t;
+	struct image *img;
+
+	t = &tex_tbl[index];
+	img = t->img;
+
+	/* Return to the screen before the target is freed. */
+	if (index == target_tex_id)
+		playfield_end_render_target();
+
+	if (t->is_retained) {
+		retained_size -= get_texture_size(t);
+		t->is_retained = false;
+	}
+
+	/* Mark as unused. */
+	t->is_used = false;
+	t->is_failed = false;
+	t->prewarm = false;
+	t->mipmap = false;
+	t->ref_count = 0;
+	t->img = NULL;
+	if (t->file != NULL) {
+		free(t->file);
+		t->file = NULL;
+	}
+
+	/* Not loaded. */
+	if (img == NULL)
+		return;
+
+	destroy_image(img);
+}
+
+/*
+ * Get the memory size of a texture including the mipmap levels.
+ *  - The size is calculated from the dimensions because the renderer
+ *    may release the pixels of the image.
+ */
+static size_t
+get_texture_size(
+	struct texture_entry *t)
+{
+	size_t size;
+	int w, h;
+
+	w = t->img->width;
+	h = t->img->height;
+	size = (size_t)w * (size_t)h * sizeof(pixel_t);
+	if (!t->mipmap)
+		return size;
+
+	while (w > 1 || h > 1) {
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		size += (size_t)w * (size_t)h * sizeof(pixel_t);
+	}
+
+	return size;
+}
+
+/* Add mipmap levels to a texture. (Generated when published if loading.) */
+static void
+add_mipmaps(
+	int index)
+{
+	struct texture_entry *t;
+
+	t = &tex_tbl[index];
+	t->mipmap = true;
+
+	if (t->img == NULL || t->img->mipmap != NULL)
+		return;
+
+	/* Released pixels are reloaded with the mipmap levels on upload. */
+	if (t->img->pixels == NULL) {
+		notify_image_update(t->img);
+		return;
+	}
+
+	if (create_image_mipmaps(t->img))
+		notify_image_update(t->img);
+}
+
+/*
+ * Reload the pixels of a texture loaded from a file.
+ *  - Called by the renderer when it needs the pixels released after uploading.
+ */
+static bool
+reload_texture(
+	struct image *img,
+	struct image **src)
+{
+	struct texture_entry *t;
+	int i;
+
+	for (i = 0; i < TEXTURE_COUNT; i++) {
+		if (tex_tbl[i].img == img)
+			break;
+	}
+	if (i == TEXTURE_COUNT)
+		return false;
+	t = &tex_tbl[i];
+
+	if (!load_image_file(t->file, t->scale, src)) {
+		log_error("Cannot reload an image \"%s\".", t->file);
+		return false;
+	}
+
+	/* Generate the mipmap levels. (Drawn without them if failed.) */
+	if (t->mipmap)
+		create_image_mipmaps(*src);
+
+	return true;
+}
+
 /*
  * Destroy a texture.
+ *  - A texture loaded from a file is freed on the last release.
  */
 void
 playfield_destroy_texture(
 	int tex_id)
 {
+	struct texture_entry *t;
+
 	assert(tex_id >= 0);
 	assert(tex_id < TEXTURE_COUNT);
-	assert(tex_tbl[tex_id].is_used);
-	assert(tex_tbl[tex_id].img != NULL);
 
-	/* Mark as used. */
-	tex_tbl[tex_id].is_used = false;
-	destroy_image(tex_tbl[tex_id].img);
+	t = &tex_tbl[tex_id];
+	assert(t->is_used);
+	assert(t->ref_count > 0);
+
+	/* Still referenced. */
+	if (--t->ref_count > 0)
+		return;
+
+	/* Retain a texture loaded from a file if it fits in the budget. */
+	if (t->file != NULL &&
+	    t->img != NULL &&
+	    get_texture_size(t) <= retain_budget) {
+		retain_entry(tex_id);
+		return;
+	}
+
+	/* Cancel a load, or let update_api() discard the image later. */
+	if (t->is_loading) {
+		if (cancel_image_load(tex_id))
+			t->is_loading = false;
+	}
+
+	release_entry(tex_id);
 }
 
 /*
@@ -266,7 +899,10 @@ playfield_render_texture(
 
 	t = &tex_tbl[tex_id];
 	assert(t->is_used);
-	assert(t->img != NULL);
+
+	/* Not loaded yet. */
+	if (t->img == NULL)
+		return;
 
 	render_image_normal(dst_left,
 			    dst_top,
@@ -306,7 +942,10 @@ playfield_render_texture_3d(
 
 	t = &tex_tbl[tex_id];
 	assert(t->is_used);
-	assert(t->img != NULL);
+
+	/* Not loaded yet. */
+	if (t->img == NULL)
+		return;
 
 	render_image_3d_normal(x1, y1, x2, y2, x3, y3, x4, y4,
 			       t->img,
@@ -329,7 +968,10 @@ playfield_draw(
 
 	t = &tex_tbl[tex_id];
 	assert(t->is_used);
-	assert(t->img != NULL);
+
+	/* Not loaded yet. */
+	if (t->img == NULL)
+		return;
 
 	render_image_normal(x,
 			    y,
@@ -480,17 +1122,34 @@ playfield_create_text_texture(
 bool
 playfield_play_sound(
 	int stream,
-	const char *file)
+	const char *file,
+	int crossfade_ms)
 {
 	if (stream < 0 || stream >= SOUND_TRACKS) {
 		log_error("Invalid stream index.");
 		return false;
 	}
 
+	/* Stop and free the previous sound. */
+	if (wave_tbl[stream] != NULL) {
+		stop_sound(stream);
+		destroy_wave(wave_tbl[stream]);
+		wave_tbl[stream] = NULL;
+	}
+
 	wave_tbl[stream] = create_wave_from_file(file, false);
 	if (wave_tbl[stream] == NULL)
 		return false;
 
+	/* Crossfade the loop seam. (Only for a file with loop tags.) */
+	if (crossfade_ms > 0) {
+		if (!set_wave_loop_crossfade(wave_tbl[stream], crossfade_ms)) {
+			destroy_wave(wave_tbl[stream]);
+			wave_tbl[stream] = NULL;
+			return false;
+		}
+	}
+
 	if (!play_sound(stream, wave_tbl[stream]))
 		return false;
 
@@ -511,8 +1170,97 @@ playfield_stop_sound(
 
 	stop_sound(stream);
 
-	destroy_wave(wave_tbl[stream]);
-	wave_tbl[stream] = NULL;
+	if (wave_tbl[stream] != NULL) {
+		destroy_wave(wave_tbl[stream]);
+		wave_tbl[stream] = NULL;
+	}
+
+	return true;
+}
+
+/*
+ * Load a sound clip to play as one-shot sounds.
+ *  - The whole file is decoded into memory once.
+ *  - Loads of the same file return the same clip.
+ */
+bool
+playfield_load_sound(
+	const char *file,
+	int *clip_id)
+{
+	const char *canonical;
+	int i, index;
+
+	/* Files with the same content share a canonical name. */
+	canonical = get_canonical_file_name(file);
+
+	/* Search the same file, or a free entry. */
+	index = -1;
+	for (i = 0; i < SOUND_CLIP_COUNT; i++) {
+		if (clip_tbl[i].file == NULL) {
+			if (index == -1)
+				index = i;
+			continue;
+		}
+		if (strcmp(clip_tbl[i].file, canonical) == 0) {
+			*clip_id = i;
+			return true;
+		}
+	}
+	if (index == -1) {
+		log_error("Too many sounds.");
+		return false;
+	}
+
+	/* Decode. */
+	if (!decode_wave_file(file, &clip_tbl[index].frames, &clip_tbl[index].frame_count)) {
+		log_error("Cannot load a sound \"%s\".", file);
+		return false;
+	}
+
+	clip_tbl[index].file = strdup(canonical);
+	if (clip_tbl[index].file == NULL) {
+		log_out_of_memory();
+		free(clip_tbl[index].frames);
+		clip_tbl[index].frames = NULL;
+		return false;
+	}
+
+	*clip_id = index;
+	return true;
+}
+
+/*
+ * Play a sound clip as a one-shot sound.
+ *  - Instances overlap on the voice pool of the mixer.
+ *  - Fails on the backends without the mixer, leaving the tracks alone.
+ */
+bool
+playfield_play_sound_effect(
+	int clip_id,
+	float vol)
+{
+	struct wave *w;
+
+	if (clip_id < 0 || clip_id >= SOUND_CLIP_COUNT || clip_tbl[clip_id].file == NULL) {
+		log_error("Invalid sound index.");
+		return false;
+	}
+	if (vol < 0)
+		vol = 0;
+	if (vol > 1.0f)
+		vol = 1.0f;
+
+	w = create_wave_from_frames(clip_tbl[clip_id].frames, clip_tbl[clip_id].frame_count);
+	if (w == NULL)
+		return false;
+
+	/* Play on the voice pool. (The wave is owned by the mixer.) */
+	if (!play_sound_effect(w, vol)) {
+		destroy_wave(w);
+		log_error("One-shot sounds are not supported on this platform.");
+		return false;
+	}
 
 	return true;
 }
@@ -529,12 +1277,112 @@ playfield_set_sound_volue(
 		log_error("Invalid stream index.");
 		return false;
 	}
+	if (vol < 0)
+		vol = 0;
+	if (vol > 1.0f)
+		vol = 1.0f;
 
 	set_sound_volume(stream, vol);
 
 	return true;
 }
 
+/*
+ * Fade the sound volume on a stream.
+ *  - The backends that cannot fade set the volume at once.
+ */
+bool
+playfield_fade_sound(
+	int stream,
+	float vol,
+	int msec)
+{
+	if (stream < 0 || stream >= SOUND_TRACKS) {
+		log_error("Invalid stream index.");
+		return false;
+	}
+	if (vol < 0)
+		vol = 0;
+	if (vol > 1.0f)
+		vol = 1.0f;
+	if (msec < 0)
+		msec = 0;
+
+	if (!fade_sound(stream, vol, msec))
+		set_sound_volume(stream, vol);
+
+	return true;
+}
+
+/*
+ * Set the sound pan on a stream.
+ *  - The backends that cannot pan ignore it.
+ */
+bool
+playfield_set_sound_pan(
+	int stream,
+	float pan)
+{
+	if (stream < 0 || stream >= SOUND_TRACKS) {
+		log_error("Invalid stream index.");
+		return false;
+	}
+	if (pan < -1.0f)
+		pan = -1.0f;
+	if (pan > 1.0f)
+		pan = 1.0f;
+
+	set_sound_pan(stream, pan);
+
+	return true;
+}
+
+/*
+ * Set the interval to log the sound statistics.
+ */
+void
+playfield_set_sound_log_interval(
+	int msec)
+{
+	sound_log_interval = msec > 0 ? msec : 0;
+	reset_lap_timer(&sound_log_origin);
+	memset(&sound_log_prev, 0, sizeof(sound_log_prev));
+}
+
+/* Log the sound statistics since the last log. */
+static void
+log_sound_stats(void)
+{
+	struct sound_stats stats;
+	uint64_t periods, budget, mix, decode;
+
+	reset_lap_timer(&sound_log_origin);
+
+	get_sound_stats(&stats);
+
+	/* Loads against the time of the periods in the interval. (%) */
+	periods = stats.periods - sound_log_prev.periods;
+	budget = periods * (uint64_t)stats.period_usec;
+	mix = budget > 0 ? (stats.mix_usec - sound_log_prev.mix_usec) * 100 / budget : 0;
+	decode = budget > 0 ? (stats.decode_usec - sound_log_prev.decode_usec) * 100 / budget : 0;
+
+	log_info("Sound: %d periods, mix %d%%, decode %d%%, "
+		 "underruns %d, xruns %d, recoveries %d, "
+		 "device %d/%d, ahead %d/%d frames.",
+		 (int)periods,
+		 (int)mix,
+		 (int)decode,
+		 (int)(stats.underruns - sound_log_prev.underruns),
+		 (int)(stats.xruns - sound_log_prev.xruns),
+		 (int)(stats.recoveries - sound_log_prev.recoveries),
+		 stats.device_fill,
+		 stats.device_size,
+		 stats.ahead_fill,
+		 stats.ahead_size);
+
+	sound_log_prev = stats;
+}
+
 /*
  * Tag
  */
@@ -19,4 +19,7 @@ bool init_api(void);
 /* Cleanup the API. */
 void cleanup_api(void);
 
+/* Update the API states. (Called every frame.) */
+void update_api(void);
+
 #endif
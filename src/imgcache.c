@@ -0,0 +1,552 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Decoded Image Cache
+ *  - Decoded pixels are stored in the "imgcache" subdirectory of the save
+ *    directory, and mapped at the next load instead of decoding the image
+ *    file again.
+ *  - A cache file is keyed by the hash of the source file content and
+ *    the pixel order of the engine.
+ *  - This is available on the platforms that map files and have a
+ *    save directory on the file system.
+ *  - The cache directory is swept at startup: files of other format versions
+ *    and temporary files are removed, and the least recently used files
+ *    are removed while the total size exceeds CACHE_LIMIT.
+ *  - Only the files named exactly as the cache files are removed.
+ */
+
+#include "imgcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#if defined(TARGET_POSIX) || defined(TARGET_MACOS) || defined(TARGET_IOS)
+#define USE_IMAGE_CACHE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+/*
+ * [Cache File Format]
+ *
+ * struct header {
+ *     u32 magic;         // "PFIC"
+ *     u32 version;
+ *     u32 width;
+ *     u32 height;
+ *     u64 source_size;
+ *     u64 source_hash;
+ *     u8  reserved[32];
+ * };
+ * pixel_t pixels[height][width]; // In the engine pixel order
+ */
+
+/* Header size. (Keeps the pixels 64-byte aligned.) */
+#define HEADER_SIZE		(64)
+
+/* Magic number. */
+#define CACHE_MAGIC		(0x43494650)	/* "PFIC" */
+
+/* Format version. */
+#define CACHE_VERSION		(1)
+
+/* Maximum length of a cache file name. */
+#define CACHE_NAME_SIZE		(64)
+
+/* Total size limit of the cache files. (256MB) */
+#define CACHE_LIMIT		((uint64_t)256 * 1024 * 1024)
+
+/* Cache directory. (Separated from the save files.) */
+#define CACHE_DIR		"save/imgcache"
+
+/* Cache file name: "cache-<16 hex digits>-<rgba|bgra>.bin" */
+#define CACHE_PREFIX		"cache-"
+#define CACHE_SUFFIX		".bin"
+#define CACHE_KEY_DIGITS	(16)
+
+/* Temporary file name suffix: "<cache file name>.<writer>.tmp" */
+#define CACHE_TMP_SUFFIX	".tmp"
+
+/* Is the cache enabled? */
+static bool is_enabled;
+
+#if defined(USE_IMAGE_CACHE)
+/* A cache file found by the startup sweep. */
+struct cache_file {
+	char *path;
+	uint64_t size;
+	time_t mtime;
+};
+
+/* Forward Declaration */
+static bool make_cache_directory(void);
+static void prune_cache_files(void);
+static bool match_cache_file_name(const char *name, bool *is_tmp);
+static bool is_current_version(const char *path);
+static int compare_cache_file(const void *p1, const void *p2);
+static void make_cache_file_name(char *buf, size_t len, uint64_t key);
+static bool read_header(const char *path, uint64_t key, size_t size, int *width, int *height);
+static void put_u32(uint8_t *buf, uint32_t val);
+static void put_u64(uint8_t *buf, uint64_t val);
+static uint32_t get_u32(const uint8_t *buf);
+static uint64_t get_u64(const uint8_t *buf);
+#endif
+
+/*
+ * Enable the decoded image cache.
+ */
+void
+enable_image_cache(void)
+{
+#if defined(USE_IMAGE_CACHE)
+	if (!make_save_directory()) {
+		log_error("Cannot create the save directory.");
+		return;
+	}
+	if (!make_cache_directory()) {
+		log_error("Cannot create the image cache directory.");
+		return;
+	}
+	prune_cache_files();
+	is_enabled = true;
+#endif
+}
+
+/*
+ * Check if the decoded image cache is enabled.
+ */
+bool
+is_image_cache_enabled(void)
+{
+	return is_enabled;
+}
+
+/*
+ * Get a cache key of an image file content. (FNV-1a)
+ */
+uint64_t
+get_image_cache_key(
+	const uint8_t *data,
+	size_t size)
+{
+	uint64_t hash;
+	size_t i;
+
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/*
+ * Load a decoded image from the cache.
+ */
+bool
+load_cached_image(
+	uint64_t key,
+	size_t size,
+	struct image **img)
+{
+#if defined(USE_IMAGE_CACHE)
+	char name[CACHE_NAME_SIZE];
+	char *path;
+	int width, height;
+	bool ret;
+
+	if (!is_enabled)
+		return false;
+
+	make_cache_file_name(name, sizeof(name), key);
+	path = make_real_path(name);
+	if (path == NULL)
+		return false;
+
+	ret = false;
+	if (read_header(path, key, size, &width, &height))
+		ret = create_image_with_mapped_file(path, HEADER_SIZE, width, height, img);
+
+	/* Update the modification time to keep the file at the next sweep. */
+	if (ret)
+		utime(path, NULL);
+
+	free(path);
+	return ret;
+#else
+	UNUSED_PARAMETER(key);
+	UNUSED_PARAMETER(size);
+	UNUSED_PARAMETER(img);
+	return false;
+#endif
+}
+
+/*
+ * Store a decoded image to the cache.
+ *  - Errors are ignored because the cache is optional.
+ */
+void
+store_cached_image(
+	uint64_t key,
+	size_t size,
+	struct image *img)
+{
+#if defined(USE_IMAGE_CACHE)
+	char name[CACHE_NAME_SIZE];
+	char tmp_name[CACHE_NAME_SIZE * 2];
+	uint8_t header[HEADER_SIZE];
+	size_t pixels_size;
+	char *path, *tmp_path;
+	FILE *fp;
+	bool succeeded;
+
+	if (!is_enabled)
+		return;
+
+	make_cache_file_name(name, sizeof(name), key);
+	path = make_real_path(name);
+	if (path == NULL)
+		return;
+
+	/* Write to a temporary file first, since other threads may read the cache. */
+	snprintf(tmp_name, sizeof(tmp_name), "%s.%lx" CACHE_TMP_SUFFIX, name, (unsigned long)(uintptr_t)img);
+	tmp_path = make_real_path(tmp_name);
+	if (tmp_path == NULL) {
+		free(path);
+		return;
+	}
+
+	memset(header, 0, sizeof(header));
+	put_u32(&header[0], CACHE_MAGIC);
+	put_u32(&header[4], CACHE_VERSION);
+	put_u32(&header[8], (uint32_t)img->width);
+	put_u32(&header[12], (uint32_t)img->height);
+	put_u64(&header[16], (uint64_t)size);
+	put_u64(&header[24], key);
+
+	pixels_size = (size_t)img->width * (size_t)img->height * sizeof(pixel_t);
+
+	succeeded = false;
+	fp = fopen(tmp_path, "wb");
+	if (fp != NULL) {
+		if (fwrite(header, sizeof(header), 1, fp) == 1 &&
+		    fwrite(img->pixels, pixels_size, 1, fp) == 1)
+			succeeded = true;
+		if (fclose(fp) != 0)
+			succeeded = false;
+	}
+	if (succeeded)
+		succeeded = rename(tmp_path, path) == 0;
+	if (!succeeded)
+		remove(tmp_path);
+
+	free(tmp_path);
+	free(path);
+#else
+	UNUSED_PARAMETER(key);
+	UNUSED_PARAMETER(size);
+	UNUSED_PARAMETER(img);
+#endif
+}
+
+#if defined(USE_IMAGE_CACHE)
+
+/* Create the cache directory if it doesn't exist. */
+static bool
+make_cache_directory(void)
+{
+	struct stat st;
+	char *path;
+	bool ret;
+
+	path = make_real_path(CACHE_DIR);
+	if (path == NULL)
+		return false;
+
+	ret = true;
+	if (stat(path, &st) != 0) {
+		if (mkdir(path, 0700) != 0)
+			ret = false;
+	} else if (!S_ISDIR(st.st_mode)) {
+		ret = false;
+	}
+
+	free(path);
+	return ret;
+}
+
+/* Remove the stale and the least recently used cache files. */
+static void
+prune_cache_files(void)
+{
+	char name[256];
+	struct cache_file *files, *new_files;
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+	char *dir_path, *path;
+	uint64_t total;
+	bool is_tmp;
+	int count, capacity, removed, i;
+
+	dir_path = make_real_path(CACHE_DIR "/");
+	if (dir_path == NULL)
+		return;
+	dir = opendir(dir_path);
+	free(dir_path);
+	if (dir == NULL)
+		return;
+
+	files = NULL;
+	count = 0;
+	capacity = 0;
+	total = 0;
+	removed = 0;
+	while ((ent = readdir(dir)) != NULL) {
+		/* Never touch the files we didn't create. */
+		if (!match_cache_file_name(ent->d_name, &is_tmp))
+			continue;
+		if (strlen(CACHE_DIR "/") + strlen(ent->d_name) + 1 > sizeof(name))
+			continue;
+		snprintf(name, sizeof(name), CACHE_DIR "/%s", ent->d_name);
+		path = make_real_path(name);
+		if (path == NULL)
+			break;
+
+		/* Remove the temporary files left by a crash, and the files of other versions. */
+		if (is_tmp || !is_current_version(path)) {
+			if (remove(path) == 0)
+				removed++;
+			free(path);
+			continue;
+		}
+
+		if (stat(path, &st) != 0) {
+			free(path);
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity = capacity == 0 ? 64 : capacity * 2;
+			new_files = realloc(files, sizeof(struct cache_file) * (size_t)capacity);
+			if (new_files == NULL) {
+				free(path);
+				break;
+			}
+			files = new_files;
+		}
+		files[count].path = path;
+		files[count].size = (uint64_t)st.st_size;
+		files[count].mtime = st.st_mtime;
+		total += (uint64_t)st.st_size;
+		count++;
+	}
+	closedir(dir);
+
+	/* Remove the oldest files until the total size fits in the limit. */
+	if (total > CACHE_LIMIT) {
+		qsort(files, (size_t)count, sizeof(struct cache_file), compare_cache_file);
+		for (i = 0; i < count && total > CACHE_LIMIT; i++) {
+			if (remove(files[i].path) == 0) {
+				total -= files[i].size;
+				removed++;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		free(files[i].path);
+	free(files);
+
+	if (removed > 0)
+		log_info("Removed %d image cache files.", removed);
+}
+
+/*
+ * Check if a name is a cache file name, or a temporary file name of it.
+ *  - "cache-<16 hex digits>-<rgba|bgra>.bin"
+ *  - "cache-<16 hex digits>-<rgba|bgra>.bin.<hex digits>.tmp"
+ */
+static bool
+match_cache_file_name(
+	const char *name,
+	bool *is_tmp)
+{
+	int i;
+
+	if (strncmp(name, CACHE_PREFIX, strlen(CACHE_PREFIX)) != 0)
+		return false;
+	name += strlen(CACHE_PREFIX);
+
+	for (i = 0; i < CACHE_KEY_DIGITS; i++) {
+		if (!isxdigit((unsigned char)name[i]))
+			return false;
+	}
+	name += CACHE_KEY_DIGITS;
+
+	if (strncmp(name, "-rgba", 5) != 0 && strncmp(name, "-bgra", 5) != 0)
+		return false;
+	name += 5;
+
+	if (strncmp(name, CACHE_SUFFIX, strlen(CACHE_SUFFIX)) != 0)
+		return false;
+	name += strlen(CACHE_SUFFIX);
+
+	if (*name == '\0') {
+		*is_tmp = false;
+		return true;
+	}
+
+	/* A temporary file. */
+	if (*name++ != '.' || !isxdigit((unsigned char)*name))
+		return false;
+	while (isxdigit((unsigned char)*name))
+		name++;
+	if (strcmp(name, CACHE_TMP_SUFFIX) != 0)
+		return false;
+
+	*is_tmp = true;
+	return true;
+}
+
+/* Check if a cache file has the current format version. */
+static bool
+is_current_version(
+	const char *path)
+{
+	uint8_t header[8];
+	FILE *fp;
+	size_t ret;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+	ret = fread(header, sizeof(header), 1, fp);
+	fclose(fp);
+	if (ret != 1)
+		return false;
+
+	return get_u32(&header[0]) == CACHE_MAGIC &&
+	       get_u32(&header[4]) == CACHE_VERSION;
+}
+
+/* Compare cache files by the modification time for qsort(). */
+static int
+compare_cache_file(
+	const void *p1,
+	const void *p2)
+{
+	const struct cache_file *f1 = p1;
+	const struct cache_file *f2 = p2;
+
+	if (f1->mtime < f2->mtime)
+		return -1;
+	if (f1->mtime > f2->mtime)
+		return 1;
+	return 0;
+}
+
+/* Make a cache file name. */
+static void
+make_cache_file_name(
+	char *buf,
+	size_t len,
+	uint64_t key)
+{
+	const char *order;
+
+	/* The pixel order is decided at compile time by make_pixel(). */
+	order = make_pixel(0, 0xff, 0, 0) == 0xff ? "rgba" : "bgra";
+
+	snprintf(buf, len, CACHE_DIR "/" CACHE_PREFIX "%08x%08x-%s" CACHE_SUFFIX,
+		 (unsigned int)(key >> 32),
+		 (unsigned int)(key & 0xffffffff),
+		 order);
+}
+
+/* Read and check a cache file header. */
+static bool
+read_header(
+	const char *path,
+	uint64_t key,
+	size_t size,
+	int *width,
+	int *height)
+{
+	uint8_t header[HEADER_SIZE];
+	FILE *fp;
+	size_t ret;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+	ret = fread(header, sizeof(header), 1, fp);
+	fclose(fp);
+	if (ret != 1)
+		return false;
+
+	if (get_u32(&header[0]) != CACHE_MAGIC)
+		return false;
+	if (get_u32(&header[4]) != CACHE_VERSION)
+		return false;
+	if (get_u64(&header[16]) != (uint64_t)size)
+		return false;
+	if (get_u64(&header[24]) != key)
+		return false;
+
+	*width = (int)get_u32(&header[8]);
+	*height = (int)get_u32(&header[12]);
+	if (*width <= 0 || *height <= 0)
+		return false;
+
+	return true;
+}
+
+static void
+put_u32(
+	uint8_t *buf,
+	uint32_t val)
+{
+	buf[0] = (uint8_t)val;
+	buf[1] = (uint8_t)(val >> 8);
+	buf[2] = (uint8_t)(val >> 16);
+	buf[3] = (uint8_t)(val >> 24);
+}
+
+static void
+put_u64(
+	uint8_t *buf,
+	uint64_t val)
+{
+	put_u32(buf, (uint32_t)val);
+	put_u32(buf + 4, (uint32_t)(val >> 32));
+}
+
+static uint32_t
+get_u32(
+	const uint8_t *buf)
+{
+	return (uint32_t)buf[0] |
+	       ((uint32_t)buf[1] << 8) |
+	       ((uint32_t)buf[2] << 16) |
+	       ((uint32_t)buf[3] << 24);
+}
+
+static uint64_t
+get_u64(
+	const uint8_t *buf)
+{
+	return (uint64_t)get_u32(buf) | ((uint64_t)get_u32(buf + 4) << 32);
+}
+
+#endif /* defined(USE_IMAGE_CACHE) */
@@ -0,0 +1,31 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Decoded Image Cache
+ */
+
+#ifndef PLAYFIELD_IMGCACHE_H
+#define PLAYFIELD_IMGCACHE_H
+
+#include <playfield/playfield.h>
+
+/* Enable the decoded image cache. (Called from setup().) */
+void enable_image_cache(void);
+
+/* Check if the decoded image cache is enabled. */
+bool is_image_cache_enabled(void);
+
+/* Get a cache key of an image file content. */
+uint64_t get_image_cache_key(const uint8_t *data, size_t size);
+
+/* Load a decoded image from the cache. */
+bool load_cached_image(uint64_t key, size_t size, struct image **img);
+
+/* Store a decoded image to the cache. */
+void store_cached_image(uint64_t key, size_t size, struct image *img);
+
+#endif
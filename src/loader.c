@@ -0,0 +1,597 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Image Loader
+ *  - Images are read and decoded on worker threads.
+ *  - Files are streamed into the decoders, so a compressed file is not
+ *    kept in memory as a whole, except for the decoded image cache that
+ *    needs the whole content for the key.
+ *  - The results are published on the main thread by get_loaded_image().
+ *  - Wasm and Unity don't have worker threads, so images are loaded
+ *    at the time of a request.
+ *  - Android also loads synchronously because the asset reader uses
+ *    a JNIEnv that is only valid on the main thread.
+ */
+
+#include "loader.h"
+#include "imgcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(TARGET_WASM) || defined(TARGET_UNITY) || defined(TARGET_ANDROID)
+#define USE_SYNC_LOADER
+#elif defined(TARGET_WINDOWS)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Job states. */
+#define JOB_NONE	(0)
+#define JOB_QUEUED	(1)
+#define JOB_RUNNING	(2)
+#define JOB_DONE	(3)
+
+/* Job Struct */
+struct job {
+	int state;
+
+	/* Request order. (A smaller value is processed earlier.) */
+	uint64_t seq;
+
+	/* File name. (Owned while queued or running) */
+	char *file;
+
+	/* Reduction at decode time. (1, 2, 4, or 8) */
+	int scale;
+
+	/* Generate mipmap levels? */
+	bool mipmap;
+
+	/* Result. (NULL if failed) */
+	struct image *img;
+};
+
+/* Job table. */
+static struct job job_tbl[LOADER_JOBS];
+
+/* Next request order. */
+static uint64_t next_seq;
+
+#if !defined(USE_SYNC_LOADER)
+/* Quit flag for the worker threads. */
+static bool is_quitting;
+
+/* Worker threads, a lock, and condition variables. */
+#if defined(TARGET_WINDOWS)
+static HANDLE worker_thread[LOADER_THREADS];
+static CRITICAL_SECTION job_lock;
+static CONDITION_VARIABLE job_cond;
+static CONDITION_VARIABLE done_cond;
+#else
+static pthread_t worker_thread[LOADER_THREADS];
+static pthread_mutex_t job_lock;
+static pthread_cond_t job_cond;
+static pthread_cond_t done_cond;
+#endif
+static int worker_count;
+#endif
+
+/* Forward Declaration */
+static void load_job(int job_id);
+static bool decode_cached_image_file(const char *file, struct image **img);
+static bool read_image_file(const char *file, uint8_t **data, size_t *size);
+#if !defined(USE_SYNC_LOADER)
+static bool start_worker(int index);
+static void join_worker(int index);
+static void run_worker(void);
+static int search_queued_job(void);
+static void lock_jobs(void);
+static void unlock_jobs(void);
+static void wait_job_cond(void);
+static void wait_done_cond(void);
+static void wake_workers(void);
+static void wake_waiters(void);
+#endif
+
+/*
+ * Initialize the image loader.
+ */
+bool
+init_loader(void)
+{
+#if !defined(USE_SYNC_LOADER)
+	int i;
+#endif
+
+	memset(job_tbl, 0, sizeof(job_tbl));
+	next_seq = 0;
+
+#if !defined(USE_SYNC_LOADER)
+	is_quitting = false;
+
+#if defined(TARGET_WINDOWS)
+	InitializeCriticalSection(&job_lock);
+	InitializeConditionVariable(&job_cond);
+	InitializeConditionVariable(&done_cond);
+#else
+	pthread_mutex_init(&job_lock, NULL);
+	pthread_cond_init(&job_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+#endif
+
+	/* Start the worker threads. */
+	worker_count = 0;
+	for (i = 0; i < LOADER_THREADS; i++) {
+		if (!start_worker(i))
+			break;
+		worker_count++;
+	}
+	if (worker_count == 0) {
+		log_error("Cannot start an image loader thread.");
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+/*
+ * Cleanup the image loader.
+ */
+void
+cleanup_loader(void)
+{
+	int i;
+
+#if !defined(USE_SYNC_LOADER)
+	/* Stop the worker threads after the running jobs. */
+	lock_jobs();
+	is_quitting = true;
+	wake_workers();
+	unlock_jobs();
+	for (i = 0; i < worker_count; i++)
+		join_worker(i);
+	worker_count = 0;
+
+#if defined(TARGET_WINDOWS)
+	DeleteCriticalSection(&job_lock);
+#else
+	pthread_mutex_destroy(&job_lock);
+	pthread_cond_destroy(&job_cond);
+	pthread_cond_destroy(&done_cond);
+#endif
+#endif
+
+	/* Discard the jobs. */
+	for (i = 0; i < LOADER_JOBS; i++) {
+		if (job_tbl[i].file != NULL)
+			free(job_tbl[i].file);
+		if (job_tbl[i].img != NULL)
+			destroy_decoded_image(job_tbl[i].img);
+	}
+	memset(job_tbl, 0, sizeof(job_tbl));
+}
+
+/*
+ * Load an image file. (Doesn't log because this runs on worker threads.)
+ */
+bool
+load_image_file(
+	const char *file,
+	int scale,
+	struct image **img)
+{
+	struct rfile *f;
+	bool ret;
+
+	*img = NULL;
+
+	/* The decoded image cache keeps full size images. */
+	if (is_image_cache_enabled() && scale == 1)
+		return decode_cached_image_file(file, img);
+
+	/* Decode rows while reading the file. */
+	if (!open_rfile(file, &f))
+		return false;
+	ret = create_image_with_rfile(f, scale, img);
+	close_rfile(f);
+
+	return ret;
+}
+
+/*
+ * Request to load an image on a worker thread.
+ */
+bool
+request_image_load(
+	int job_id,
+	const char *file,
+	int scale,
+	bool mipmap)
+{
+	char *file_copy;
+
+	assert(job_id >= 0 && job_id < LOADER_JOBS);
+	assert(job_tbl[job_id].state == JOB_NONE);
+
+	file_copy = strdup(file);
+	if (file_copy == NULL) {
+		log_out_of_memory();
+		return false;
+	}
+
+#if defined(USE_SYNC_LOADER)
+	job_tbl[job_id].file = file_copy;
+	job_tbl[job_id].scale = scale;
+	job_tbl[job_id].mipmap = mipmap;
+	job_tbl[job_id].seq = next_seq++;
+	load_job(job_id);
+#else
+	lock_jobs();
+	job_tbl[job_id].state = JOB_QUEUED;
+	job_tbl[job_id].file = file_copy;
+	job_tbl[job_id].scale = scale;
+	job_tbl[job_id].mipmap = mipmap;
+	job_tbl[job_id].img = NULL;
+	job_tbl[job_id].seq = next_seq++;
+	wake_workers();
+	unlock_jobs();
+#endif
+
+	return true;
+}
+
+/*
+ * Cancel a request if it is not started yet.
+ */
+bool
+cancel_image_load(
+	int job_id)
+{
+	bool canceled;
+
+	assert(job_id >= 0 && job_id < LOADER_JOBS);
+
+#if !defined(USE_SYNC_LOADER)
+	lock_jobs();
+#endif
+	canceled = false;
+	if (job_tbl[job_id].state == JOB_QUEUED) {
+		free(job_tbl[job_id].file);
+		job_tbl[job_id].file = NULL;
+		job_tbl[job_id].state = JOB_NONE;
+		canceled = true;
+	}
+#if !defined(USE_SYNC_LOADER)
+	unlock_jobs();
+#endif
+
+	return canceled;
+}
+
+/*
+ * Wait for a request to finish.
+ */
+void
+wait_image_load(
+	int job_id)
+{
+	assert(job_id >= 0 && job_id < LOADER_JOBS);
+
+#if !defined(USE_SYNC_LOADER)
+	lock_jobs();
+
+	/* Process this job next. */
+	if (job_tbl[job_id].state == JOB_QUEUED)
+		job_tbl[job_id].seq = 0;
+
+	while (job_tbl[job_id].state == JOB_QUEUED ||
+	       job_tbl[job_id].state == JOB_RUNNING)
+		wait_done_cond();
+
+	unlock_jobs();
+#endif
+}
+
+/*
+ * Get a finished request.
+ */
+bool
+get_loaded_image(
+	int *job_id,
+	struct image **img)
+{
+	int i;
+	bool found;
+
+#if !defined(USE_SYNC_LOADER)
+	lock_jobs();
+#endif
+	found = false;
+	for (i = 0; i < LOADER_JOBS; i++) {
+		if (job_tbl[i].state == JOB_DONE) {
+			*job_id = i;
+			*img = job_tbl[i].img;
+			job_tbl[i].img = NULL;
+			job_tbl[i].state = JOB_NONE;
+			found = true;
+			break;
+		}
+	}
+#if !defined(USE_SYNC_LOADER)
+	unlock_jobs();
+#endif
+
+	return found;
+}
+
+/* Read and decode a file of a job. (Called without the lock.) */
+static void
+load_job(
+	int job_id)
+{
+	struct image *img;
+
+	if (!load_image_file(job_tbl[job_id].file, job_tbl[job_id].scale, &img))
+		img = NULL;
+
+	/* Generate the mipmap levels on this thread too. */
+	if (img != NULL && job_tbl[job_id].mipmap)
+		create_image_mipmaps(img);
+
+	/* Classify the alpha values for the software blending. (Optional) */
+	if (img != NULL)
+		build_image_alpha_map(img);
+
+#if !defined(USE_SYNC_LOADER)
+	lock_jobs();
+#endif
+	free(job_tbl[job_id].file);
+	job_tbl[job_id].file = NULL;
+	job_tbl[job_id].img = img;
+	job_tbl[job_id].state = JOB_DONE;
+#if !defined(USE_SYNC_LOADER)
+	wake_waiters();
+	unlock_jobs();
+#endif
+}
+
+/* Load an image file through the decoded image cache. */
+static bool
+decode_cached_image_file(
+	const char *file,
+	struct image **img)
+{
+	uint8_t *data;
+	size_t size;
+	uint64_t key;
+
+	if (!read_image_file(file, &data, &size))
+		return false;
+
+	/* Use the cache if the same content is decoded before. */
+	key = get_image_cache_key(data, size);
+	if (load_cached_image(key, size, img)) {
+		free(data);
+		return true;
+	}
+
+	/* Decode. (The format is detected by the content.) */
+	if (!create_image_with_data(data, size, img)) {
+		free(data);
+		return false;
+	}
+	free(data);
+
+	/* Store to the decoded image cache. */
+	store_cached_image(key, size, *img);
+
+	return true;
+}
+
+/* Read a file content. */
+static bool
+read_image_file(
+	const char *file,
+	uint8_t **data,
+	size_t *size)
+{
+	struct rfile *f;
+	size_t file_size, read_size;
+
+	if (!open_rfile(file, &f))
+		return false;
+
+	if (!get_rfile_size(f, &file_size) || file_size == 0) {
+		close_rfile(f);
+		return false;
+	}
+
+	*data = malloc(file_size);
+	if (*data == NULL) {
+		close_rfile(f);
+		return false;
+	}
+
+	if (!read_rfile(f, *data, file_size, &read_size) ||
+	    read_size != file_size) {
+		free(*data);
+		close_rfile(f);
+		return false;
+	}
+
+	close_rfile(f);
+
+	*size = file_size;
+	return true;
+}
+
+#if !defined(USE_SYNC_LOADER)
+
+/*
+ * Worker Thread
+ */
+
+#if defined(TARGET_WINDOWS)
+static DWORD WINAPI
+worker_main(
+	LPVOID param)
+{
+	UNUSED_PARAMETER(param);
+	run_worker();
+	return 0;
+}
+#else
+static void *
+worker_main(
+	void *param)
+{
+	UNUSED_PARAMETER(param);
+	run_worker();
+	return NULL;
+}
+#endif
+
+/* Start a worker thread. */
+static bool
+start_worker(
+	int index)
+{
+#if defined(TARGET_WINDOWS)
+	worker_thread[index] = CreateThread(NULL, 0, worker_main, NULL, 0, NULL);
+	if (worker_thread[index] == NULL)
+		return false;
+#else
+	if (pthread_create(&worker_thread[index], NULL, worker_main, NULL) != 0)
+		return false;
+#endif
+	return true;
+}
+
+/* Join a worker thread. */
+static void
+join_worker(
+	int index)
+{
+#if defined(TARGET_WINDOWS)
+	WaitForSingleObject(worker_thread[index], INFINITE);
+	CloseHandle(worker_thread[index]);
+#else
+	pthread_join(worker_thread[index], NULL);
+#endif
+}
+
+/* The main loop of a worker thread. */
+static void
+run_worker(void)
+{
+	int job_id;
+
+	lock_jobs();
+	while (!is_quitting) {
+		job_id = search_queued_job();
+		if (job_id == -1) {
+			wait_job_cond();
+			continue;
+		}
+
+		job_tbl[job_id].state = JOB_RUNNING;
+		unlock_jobs();
+
+		load_job(job_id);
+
+		lock_jobs();
+	}
+	unlock_jobs();
+}
+
+/* Search the oldest queued job. (Called with the lock.) */
+static int
+search_queued_job(void)
+{
+	int i, found;
+
+	found = -1;
+	for (i = 0; i < LOADER_JOBS; i++) {
+		if (job_tbl[i].state != JOB_QUEUED)
+			continue;
+		if (found == -1 || job_tbl[i].seq < job_tbl[found].seq)
+			found = i;
+	}
+
+	return found;
+}
+
+/*
+ * Lock and Condition Variables
+ */
+
+static void
+lock_jobs(void)
+{
+#if defined(TARGET_WINDOWS)
+	EnterCriticalSection(&job_lock);
+#else
+	pthread_mutex_lock(&job_lock);
+#endif
+}
+
+static void
+unlock_jobs(void)
+{
+#if defined(TARGET_WINDOWS)
+	LeaveCriticalSection(&job_lock);
+#else
+	pthread_mutex_unlock(&job_lock);
+#endif
+}
+
+static void
+wait_job_cond(void)
+{
+#if defined(TARGET_WINDOWS)
+	SleepConditionVariableCS(&job_cond, &job_lock, INFINITE);
+#else
+	pthread_cond_wait(&job_cond, &job_lock);
+#endif
+}
+
+static void
+wait_done_cond(void)
+{
+#if defined(TARGET_WINDOWS)
+	SleepConditionVariableCS(&done_cond, &job_lock, INFINITE);
+#else
+	pthread_cond_wait(&done_cond, &job_lock);
+#endif
+}
+
+static void
+wake_workers(void)
+{
+#if defined(TARGET_WINDOWS)
+	WakeAllConditionVariable(&job_cond);
+#else
+	pthread_cond_broadcast(&job_cond);
+#endif
+}
+
+static void
+wake_waiters(void)
+{
+#if defined(TARGET_WINDOWS)
+	WakeAllConditionVariable(&done_cond);
+#else
+	pthread_cond_broadcast(&done_cond);
+#endif
+}
+
+#endif /* !defined(USE_SYNC_LOADER) */
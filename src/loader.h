@@ -0,0 +1,43 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (c) 2025, Awe Morris. All rights reserved.
+ */
+
+/*
+ * Image Loader
+ */
+
+#ifndef PLAYFIELD_LOADER_H
+#define PLAYFIELD_LOADER_H
+
+#include <playfield/playfield.h>
+
+/* Maximum number of images that are decoded at the same time. */
+#define LOADER_THREADS		(2)
+
+/* Maximum job ID. (exclusive, same as the texture count) */
+#define LOADER_JOBS		(256)
+
+/* Initialize the image loader. */
+bool init_loader(void);
+
+/* Cleanup the image loader. */
+void cleanup_loader(void);
+
+/* Load an image file reduced to 1/scale. (Uses the decoded image cache if enabled.) */
+bool load_image_file(const char *file, int scale, struct image **img);
+
+/* Request to load an image on a worker thread. */
+bool request_image_load(int job_id, const char *file, int scale, bool mipmap);
+
+/* Cancel a request if it is not started yet. */
+bool cancel_image_load(int job_id);
+
+/* Wait for a request to finish. */
+void wait_image_load(int job_id);
+
+/* Get a finished request. (img is NULL if the load failed.) */
+bool get_loaded_image(int *job_id, struct image **img);
+
+#endif
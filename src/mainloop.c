@@ -98,10 +98,16 @@ bool on_event_frame(void)
 	/* Get the lap timer. */
 	set_vm_int("millisec", (int)get_lap_timer_millisec(&lap_origin));
 
+	/* Publish the textures loaded asynchronously. */
+	update_api();
+
 	/* Call frame(). */
 	if (!call_vm_function("frame"))
 		return false;
 
+	/* Return to the screen if frame() left a render target. */
+	playfield_end_render_target();
+
 	/* Check the exit flag. */
 	exit_flag = 0;
 	get_vm_int("exitFlag", &exit_flag);
@@ -15,6 +15,7 @@
 #include "api.h"
 #include "tag.h"
 #include "common.h"
+#include "imgcache.h"
 
 /* NoctLang */
 #include <noct/noct.h>
@@ -37,11 +38,13 @@ static NoctEnv *env;
 static bool load_startup_file(void);
 static bool call_setup(char **title, int *width, int *height, bool *fullscreen);
 static bool get_int_param(NoctEnv *env, const char *name, int *ret);
-#if 0
+static bool get_optional_int_param(NoctEnv *env, const char *name, int def, int *ret);
+static bool get_downscale_param(NoctEnv *env, int *ret);
 static bool get_float_param(NoctEnv *env, const char *name, float *ret);
-#endif
+static bool get_optional_float_param(NoctEnv *env, const char *name, float def, float *ret);
 static bool get_string_param(NoctEnv *env, const char *name, const char **ret);
 static bool get_dict_elem_int_param(NoctEnv *env, const char *name, const char *key, int *ret);
+static bool get_setup_int_param(NoctEnv *env, NoctValue *dict, const char *key, int def, int *ret);
 static bool install_api(NoctEnv *env);
 
 /*
@@ -119,7 +122,19 @@ static bool call_setup(char **title, int *width, int *height, bool *fullscreen)
 	NoctValue width_val;
 	NoctValue height_val;
 	NoctValue fullscreen_val;
+	NoctValue sound_output_val;
+	NoctValue sound_file_val;
 	const char *title_s;
+	int image_cache;
+	int texture_cache_size, texture_memory, texture_upload_size;
+	int sound_voices, sound_resampler;
+	int sound_buf, sound_periods, sound_low_latency;
+	bool sound_output_exist, sound_file_exist;
+	const char *sound_output_s;
+	const char *sound_file;
+	int sound_output;
+	int sound_fast, sound_length;
+	int sound_log_interval, sound_read_ahead;
 	bool succeeded;
 
 	succeeded = false;
@@ -167,6 +182,103 @@ static bool call_setup(char **title, int *width, int *height, bool *fullscreen)
 			}
 		}
 
+		/* Get the "imageCache" element from the dictionary. */
+		if (!get_setup_int_param(env, &ret, "imageCache", 0, &image_cache))
+			break;
+		if (image_cache)
+			enable_image_cache();
+
+		/* Get the "textureCacheSize" element from the dictionary. (MB) */
+		if (!get_setup_int_param(env, &ret, "textureCacheSize", 0, &texture_cache_size))
+			break;
+		if (texture_cache_size > 0)
+			playfield_set_texture_cache_size((size_t)texture_cache_size * 1024 * 1024);
+
+		/* Get the "textureMemory" element from the dictionary. (MB) */
+		if (!get_setup_int_param(env, &ret, "textureMemory", 0, &texture_memory))
+			break;
+		if (texture_memory > 0)
+			set_texture_budget((size_t)texture_memory * 1024 * 1024);
+
+		/* Get the "textureUploadSize" element from the dictionary. (KB per frame) */
+		if (!get_setup_int_param(env, &ret, "textureUploadSize", 0, &texture_upload_size))
+			break;
+		if (texture_upload_size > 0)
+			set_texture_upload_budget((size_t)texture_upload_size * 1024);
+
+		/* Get the "soundVoices" element from the dictionary. */
+		if (!get_setup_int_param(env, &ret, "soundVoices", 0, &sound_voices))
+			break;
+		if (sound_voices > 0)
+			set_sound_voice_count(sound_voices);
+
+		/* Get the "soundResampler" element from the dictionary. */
+		if (!get_setup_int_param(env, &ret, "soundResampler", 1, &sound_resampler))
+			break;
+		set_sound_resample_quality(sound_resampler == 0 ?
+					   SOUND_RESAMPLE_LINEAR :
+					   SOUND_RESAMPLE_SINC);
+
+		/* Get the "soundBuffer" element from the dictionary. (msec) */
+		if (!get_setup_int_param(env, &ret, "soundBuffer", 0, &sound_buf))
+			break;
+
+		/* Get the "soundPeriods" element from the dictionary. */
+		if (!get_setup_int_param(env, &ret, "soundPeriods", 0, &sound_periods))
+			break;
+
+		/* Get the "soundLowLatency" element from the dictionary. */
+		if (!get_setup_int_param(env, &ret, "soundLowLatency", 0, &sound_low_latency))
+			break;
+
+		set_sound_buffer_config(sound_buf, sound_periods, sound_low_latency ? true : false);
+
+		/* Get the "soundOutput" element from the dictionary. ("device", "wav" or "null") */
+		sound_output = SOUND_OUTPUT_DEVICE;
+		if (!noct_check_dict_key(env, &ret, "soundOutput", &sound_output_exist))
+			break;
+		if (sound_output_exist) {
+			if (!noct_get_dict_elem(env, &ret, "soundOutput", &sound_output_val))
+				break;
+			if (!noct_get_string(env, &sound_output_val, &sound_output_s))
+				break;
+			if (strcmp(sound_output_s, "wav") == 0)
+				sound_output = SOUND_OUTPUT_WAV;
+			else if (strcmp(sound_output_s, "null") == 0)
+				sound_output = SOUND_OUTPUT_NULL;
+		}
+
+		/* Get the "soundOutputFile" element from the dictionary. */
+		sound_file = NULL;
+		if (!noct_check_dict_key(env, &ret, "soundOutputFile", &sound_file_exist))
+			break;
+		if (sound_file_exist) {
+			if (!noct_get_dict_elem(env, &ret, "soundOutputFile", &sound_file_val))
+				break;
+			if (!noct_get_string(env, &sound_file_val, &sound_file))
+				break;
+		}
+
+		/* Get the "soundOutputFast" element from the dictionary. */
+		if (!get_setup_int_param(env, &ret, "soundOutputFast", 0, &sound_fast))
+			break;
+
+		/* Get the "soundOutputLength" element from the dictionary. (msec) */
+		if (!get_setup_int_param(env, &ret, "soundOutputLength", 0, &sound_length))
+			break;
+
+		set_sound_output(sound_output, sound_file, sound_fast ? false : true, sound_length);
+
+		/* Get the "soundLogInterval" element from the dictionary. (msec) */
+		if (!get_setup_int_param(env, &ret, "soundLogInterval", 0, &sound_log_interval))
+			break;
+		playfield_set_sound_log_interval(sound_log_interval);
+
+		/* Get the "soundReadAhead" element from the dictionary. (msec) */
+		if (!get_setup_int_param(env, &ret, "soundReadAhead", 100, &sound_read_ahead))
+			break;
+		set_sound_read_ahead(sound_read_ahead);
+
 		/* Do a fast GC. */
 		noct_fast_gc(env);
 
@@ -548,6 +660,8 @@ static bool Engine_createColorTexture(NoctEnv *env)
 static bool Engine_loadTexture(NoctEnv *env)
 {
 	const char *file;
+	int scale;
+	int mipmap;
 	int tex_id;
 	int tex_width;
 	int tex_height;
@@ -557,8 +671,49 @@ static bool Engine_loadTexture(NoctEnv *env)
 		noct_error(env, PPS_TR("file parameter is not set."));
 		return false;
 	}
+	if (!get_downscale_param(env, &scale))
+		return false;
+	if (!get_optional_int_param(env, "mipmap", 0, &mipmap))
+		return false;
+
+	if (!playfield_load_texture(file, scale, mipmap != 0, &tex_id, &tex_width, &tex_height)) {
+		noct_error(env, PPS_TR("Failed to load a texture."));
+		return false;
+	}
+
+	if (!noct_make_empty_dict(env, &ret))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "id", &tmp, tex_id))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "width", &tmp, tex_width))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "height", &tmp, tex_height))
+		return false;
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.loadTextureAsync() */
+static bool Engine_loadTextureAsync(NoctEnv *env)
+{
+	const char *file;
+	int scale;
+	int mipmap;
+	int tex_id;
+	NoctValue ret, tmp;
+
+	if (!get_string_param(env, "file", &file)) {
+		noct_error(env, PPS_TR("file parameter is not set."));
+		return false;
+	}
+	if (!get_downscale_param(env, &scale))
+		return false;
+	if (!get_optional_int_param(env, "mipmap", 0, &mipmap))
+		return false;
 
-	if (!playfield_load_texture(file, &tex_id, &tex_width, &tex_height)) {
+	if (!playfield_load_texture_async(file, scale, mipmap != 0, &tex_id)) {
 		noct_error(env, PPS_TR("Failed to load a texture."));
 		return false;
 	}
@@ -567,6 +722,33 @@ static bool Engine_loadTexture(NoctEnv *env)
 		return false;
 	if (!noct_set_dict_elem_make_int(env, &ret, "id", &tmp, tex_id))
 		return false;
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.getTextureStatus() */
+static bool Engine_getTextureStatus(NoctEnv *env)
+{
+	int tex_id;
+	int tex_width;
+	int tex_height;
+	bool is_ready;
+	bool is_failed;
+	NoctValue ret, tmp;
+
+	if (!get_dict_elem_int_param(env, "texture", "id", &tex_id))
+		return false;
+
+	playfield_get_texture_status(tex_id, &is_ready, &is_failed, &tex_width, &tex_height);
+
+	if (!noct_make_empty_dict(env, &ret))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "ready", &tmp, is_ready ? 1 : 0))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "failed", &tmp, is_failed ? 1 : 0))
+		return false;
 	if (!noct_set_dict_elem_make_int(env, &ret, "width", &tmp, tex_width))
 		return false;
 	if (!noct_set_dict_elem_make_int(env, &ret, "height", &tmp, tex_height))
@@ -577,6 +759,110 @@ static bool Engine_loadTexture(NoctEnv *env)
 	return true;
 }
 
+/* Engine.waitTexture() */
+static bool Engine_waitTexture(NoctEnv *env)
+{
+	int tex_id;
+	int tex_width;
+	int tex_height;
+	NoctValue ret, tmp;
+
+	if (!get_dict_elem_int_param(env, "texture", "id", &tex_id))
+		return false;
+
+	if (!playfield_wait_texture(tex_id, &tex_width, &tex_height)) {
+		noct_error(env, PPS_TR("Failed to load a texture."));
+		return false;
+	}
+
+	if (!noct_make_empty_dict(env, &ret))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "id", &tmp, tex_id))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "width", &tmp, tex_width))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "height", &tmp, tex_height))
+		return false;
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.prewarmTexture() */
+static bool Engine_prewarmTexture(NoctEnv *env)
+{
+	int tex_id;
+
+	if (!get_dict_elem_int_param(env, "texture", "id", &tex_id))
+		return false;
+
+	playfield_prewarm_texture(tex_id);
+
+	return true;
+}
+
+/* Engine.createRenderTarget() */
+static bool Engine_createRenderTarget(NoctEnv *env)
+{
+	int width;
+	int height;
+	int tex_id;
+	NoctValue ret, tmp;
+
+	if (!get_int_param(env, "width", &width))
+		return false;
+	if (!get_int_param(env, "height", &height))
+		return false;
+
+	if (!playfield_create_render_target(width, height, &tex_id)) {
+		noct_error(env, PPS_TR("Failed to create a render target."));
+		return false;
+	}
+
+	if (!noct_make_empty_dict(env, &ret))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "id", &tmp, tex_id))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "width", &tmp, width))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "height", &tmp, height))
+		return false;
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.beginRenderTarget() */
+static bool Engine_beginRenderTarget(NoctEnv *env)
+{
+	int tex_id;
+	int clear;
+
+	if (!get_dict_elem_int_param(env, "texture", "id", &tex_id))
+		return false;
+	if (!get_optional_int_param(env, "clear", 1, &clear))
+		return false;
+
+	if (!playfield_begin_render_target(tex_id, clear != 0)) {
+		noct_error(env, PPS_TR("Failed to start rendering to a texture."));
+		return false;
+	}
+
+	return true;
+}
+
+/* Engine.endRenderTarget() */
+static bool Engine_endRenderTarget(NoctEnv *env)
+{
+	UNUSED_PARAMETER(env);
+
+	playfield_end_render_target();
+
+	return true;
+}
+
 /* Engine.destroyTexture() */
 static bool Engine_destroyTexture(NoctEnv *env)
 {
@@ -706,19 +992,129 @@ static bool Engine_draw(NoctEnv *env)
 	return true;
 }
 
+/* Engine.getTextureStats() */
+static bool Engine_getTextureStats(NoctEnv *env)
+{
+	NoctValue ret;
+	NoctValue val;
+	struct texture_stats stats;
+
+	if (!noct_pin_local(env, 2, &ret, &val))
+		return false;
+
+	get_texture_stats(&stats);
+
+	if (!noct_make_empty_dict(env, &ret))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "residentCount", &val, stats.resident_count))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "residentKB", &val, (int)(stats.resident_bytes / 1024)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "budgetKB", &val, (int)(stats.budget / 1024)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "uploads", &val, (int)stats.uploads))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "uploadedKB", &val, (int)(stats.upload_bytes / 1024)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "evictions", &val, (int)stats.evictions))
+		return false;
+
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.getSoundLatency() */
+static bool Engine_getSoundLatency(NoctEnv *env)
+{
+	NoctValue ret;
+
+	noct_make_int(env, &ret, get_sound_latency());
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.getSoundStats() */
+static bool Engine_getSoundStats(NoctEnv *env)
+{
+	NoctValue ret;
+	NoctValue val;
+	struct sound_stats stats;
+	uint64_t periods, budget;
+
+	if (!noct_pin_local(env, 2, &ret, &val))
+		return false;
+
+	get_sound_stats(&stats);
+
+	/* Averages per period, and loads against the period time. (%) */
+	periods = stats.periods > 0 ? stats.periods : 1;
+	budget = periods * (uint64_t)stats.period_usec;
+	if (budget == 0)
+		budget = 1;
+
+	if (!noct_make_empty_dict(env, &ret))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "underruns", &val, (int)stats.underruns))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "underrunFrames", &val, (int)stats.underrun_frames))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "xruns", &val, (int)stats.xruns))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "recoveries", &val, (int)stats.recoveries))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "periods", &val, (int)stats.periods))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "periodUsec", &val, stats.period_usec))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "mixUsec", &val, (int)(stats.mix_usec / periods)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "mixUsecMax", &val, stats.mix_usec_max))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "mixLoad", &val, (int)(stats.mix_usec * 100 / budget)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "decodeUsec", &val, (int)(stats.decode_usec / periods)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "decodeUsecMax", &val, stats.decode_usec_max))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "decodeLoad", &val, (int)(stats.decode_usec * 100 / budget)))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "deviceFrames", &val, stats.device_fill))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "deviceSize", &val, stats.device_size))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "aheadFrames", &val, stats.ahead_fill))
+		return false;
+	if (!noct_set_dict_elem_make_int(env, &ret, "aheadSize", &val, stats.ahead_size))
+		return false;
+
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
 /* Engine.playSound() */
 static bool Engine_playSound(NoctEnv *env)
 {
 	int stream;
 	const char *file;
+	int crossfade;
 	NoctValue ret;
 
 	if (!get_int_param(env, "stream", &stream))
 		return false;
 	if (!get_string_param(env, "file", &file))
 		return false;
+	if (!get_optional_int_param(env, "crossfade", 0, &crossfade))
+		return false;
+	if (crossfade < 0)
+		crossfade = 0;
 
-	if (!playfield_play_sound(stream, file))
+	if (!playfield_play_sound(stream, file, crossfade))
 		return false;
 
 	noct_make_int(env, &ret, 1);
@@ -747,16 +1143,112 @@ static bool Engine_stopSound(NoctEnv *env)
 	return true;
 }
 
-/* Engine.stopSound() */
+/* Engine.loadSound() */
+static bool Engine_loadSound(NoctEnv *env)
+{
+	const char *file;
+	int clip_id;
+	NoctValue ret;
+
+	if (!get_string_param(env, "file", &file)) {
+		noct_error(env, PPS_TR("file parameter is not set."));
+		return false;
+	}
+
+	if (!playfield_load_sound(file, &clip_id)) {
+		noct_error(env, PPS_TR("Failed to load a sound."));
+		return false;
+	}
+
+	noct_make_int(env, &ret, clip_id);
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.playSoundEffect() */
+static bool Engine_playSoundEffect(NoctEnv *env)
+{
+	int clip_id;
+	float vol;
+	NoctValue ret;
+
+	if (!get_int_param(env, "sound", &clip_id))
+		return false;
+	if (!get_optional_float_param(env, "volume", 1.0f, &vol))
+		return false;
+
+	if (!playfield_play_sound_effect(clip_id, vol))
+		return false;
+
+	noct_make_int(env, &ret, 1);
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.fadeSound() */
+static bool Engine_fadeSound(NoctEnv *env)
+{
+	int stream;
+	float vol;
+	int msec;
+	NoctValue ret;
+
+	if (!get_int_param(env, "stream", &stream))
+		return false;
+	if (!get_float_param(env, "volume", &vol))
+		return false;
+	if (!get_int_param(env, "time", &msec))
+		return false;
+
+	if (!playfield_fade_sound(stream, vol, msec))
+		return false;
+
+	noct_make_int(env, &ret, 1);
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.setSoundPan() */
+static bool Engine_setSoundPan(NoctEnv *env)
+{
+	int stream;
+	float pan;
+	NoctValue ret;
+
+	if (!get_int_param(env, "stream", &stream))
+		return false;
+	if (!get_float_param(env, "pan", &pan))
+		return false;
+
+	if (!playfield_set_sound_pan(stream, pan))
+		return false;
+
+	noct_make_int(env, &ret, 1);
+	if (!noct_set_return(env, &ret))
+		return false;
+
+	return true;
+}
+
+/* Engine.setSoundVolume() */
 static bool Engine_setSoundVolume(NoctEnv *env)
 {
 	int stream;
+	float vol;
 	NoctValue ret;
 
 	if (!get_int_param(env, "stream", &stream))
 		return false;
+	if (!get_float_param(env, "volume", &vol))
+		return false;
 
-	if (!playfield_stop_sound(stream))
+	if (!playfield_set_sound_volue(stream, vol))
 		return false;
 
 	noct_make_int(env, &ret, 1);
@@ -923,40 +1415,98 @@ static bool get_int_param(NoctEnv *env, const char *name, int *ret)
 	return true;
 }
 
-#if 0
+/* Get an integer parameter that may be omitted. */
+static bool get_optional_int_param(NoctEnv *env, const char *name, int def, int *ret)
+{
+	NoctValue param;
+	bool exist;
+
+	if (!noct_get_arg(env, 0, &param)) {
+		noct_error(env, PPS_TR("Parameter is not set."));
+		return false;
+	}
+
+	if (!noct_check_dict_key(env, &param, name, &exist))
+		return false;
+	if (!exist) {
+		*ret = def;
+		return true;
+	}
+
+	return get_int_param(env, name, ret);
+}
+
+/* Get the "downscale" parameter of the texture loads. */
+static bool get_downscale_param(NoctEnv *env, int *ret)
+{
+	if (!get_optional_int_param(env, "downscale", 1, ret))
+		return false;
+
+	if (*ret != 1 && *ret != 2 && *ret != 4 && *ret != 8) {
+		noct_error(env, PPS_TR("downscale must be 1, 2, 4, or 8."));
+		return false;
+	}
+
+	return true;
+}
+
 /* Get a float parameter. */
 static bool get_float_param(NoctEnv *env, const char *name, float *ret)
 {
 	NoctValue param, elem;
+	int i;
+	const char *s;
 
-	if (!rt_get_arg(env, 0, &param)) {
+	if (!noct_get_arg(env, 0, &param)) {
 		noct_error(env, PPS_TR("Parameter is not set."));
 		return false;
 	}
 
-	if (!rt_get_dict_elem(env, &param, name, &elem)) {
+	if (!noct_get_dict_elem(env, &param, name, &elem)) {
 		noct_error(env, PPS_TR("Parameter %s is not set."), name);
 		return false;
 	}
 
 	switch (elem.type) {
 	case NOCT_VALUE_INT:
-		*ret = (float)elem.val.i;
+		noct_get_int(env, &elem, &i);
+		*ret = (float)i;
 		break;
 	case NOCT_VALUE_FLOAT:
-		*ret = elem.val.f;
+		noct_get_float(env, &elem, ret);
 		break;
 	case NOCT_VALUE_STRING:
-		*ret = (float)atof(elem.val.str->s);
+		noct_get_string(env, &elem, &s);
+		*ret = (float)atof(s);
 		break;
 	default:
-		rt_error(env, PPS_TR("Unexpected parameter value for %s."), name);
+		noct_error(env, PPS_TR("Unexpected parameter value for %s."), name);
 		return false;
 	}
 
 	return true;
 }
-#endif
+
+/* Get a float parameter that may be omitted. */
+static bool get_optional_float_param(NoctEnv *env, const char *name, float def, float *ret)
+{
+	NoctValue param;
+	bool exist;
+
+	if (!noct_get_arg(env, 0, &param)) {
+		noct_error(env, PPS_TR("Parameter is not set."));
+		return false;
+	}
+
+	if (!noct_check_dict_key(env, &param, name, &exist))
+		return false;
+	if (!exist) {
+		*ret = def;
+		return true;
+	}
+
+	return get_float_param(env, name, ret);
+}
 
 /* Get a string parameter. */
 static bool get_string_param(NoctEnv *env, const char *name, const char **ret)
@@ -1037,6 +1587,33 @@ static bool get_dict_elem_int_param(NoctEnv *env, const char *name, const char *
 	return true;
 }
 
+/* Get an integer element of the setup() dictionary that may be omitted. */
+static bool get_setup_int_param(NoctEnv *env, NoctValue *dict, const char *key, int def, int *ret)
+{
+	NoctValue elem;
+	bool exist;
+
+	if (!noct_check_dict_key(env, dict, key, &exist))
+		return false;
+	if (!exist) {
+		*ret = def;
+		return true;
+	}
+
+	if (!noct_get_dict_elem(env, dict, key, &elem))
+		return false;
+
+	if (elem.type != NOCT_VALUE_INT) {
+		noct_error(env, PPS_TR("Unexpected value for %s in setup()."), key);
+		return false;
+	}
+
+	if (!noct_get_int(env, &elem, ret))
+		return false;
+
+	return true;
+}
+
 /*
  * Engine Installation
  */
@@ -1060,13 +1637,28 @@ bool install_api(NoctEnv *env)
 		RTFUNC(callTagFunction),
 		RTFUNC(createColorTexture),
 		RTFUNC(loadTexture),
+		RTFUNC(loadTextureAsync),
+		RTFUNC(getTextureStatus),
+		RTFUNC(waitTexture),
+		RTFUNC(prewarmTexture),
+		RTFUNC(createRenderTarget),
+		RTFUNC(beginRenderTarget),
+		RTFUNC(endRenderTarget),
 		RTFUNC(destroyTexture),
 		RTFUNC(renderTexture),
 		RTFUNC(renderTexture3D),
 		RTFUNC(draw),
+		RTFUNC(getTextureStats),
 		RTFUNC(destroyTexture),
 		RTFUNC(playSound),
 		RTFUNC(stopSound),
+		RTFUNC(loadSound),
+		RTFUNC(playSoundEffect),
+		RTFUNC(setSoundVolume),
+		RTFUNC(fadeSound),
+		RTFUNC(setSoundPan),
+		RTFUNC(getSoundLatency),
+		RTFUNC(getSoundStats),
 		RTFUNC(loadFont),
 		RTFUNC(createTextTexture),
 		RTFUNC(getDate),